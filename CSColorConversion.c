@@ -0,0 +1,236 @@
+//
+//  CSColorConversion.c
+//  CSIconView
+//
+//  Created by Alastair Houghton on 15/03/2010.
+//  Copyright (c) 2005-2010 Coriolis Systems Limited
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+//
+
+#include <math.h>
+#include "CSColorConversion.h"
+
+/* The D65 white point */
+#define WHITE_X		0.95047
+#define WHITE_Y		1.0
+#define WHITE_Z		1.08883
+
+/* u' and v' for the white point */
+#define WHITE_U		(4.0 * WHITE_X / (WHITE_X + 15.0 * WHITE_Y + 3.0 * WHITE_Z))
+#define WHITE_V		(9.0 * WHITE_Y / (WHITE_X + 15.0 * WHITE_Y + 3.0 * WHITE_Z))
+
+/* (6/29)^3 and (29/3)^3, from the CIE definitions of L*a*b* and L*u*v* */
+#define EPSILON		(216.0 / 24389.0)
+#define KAPPA		(24389.0 / 27.0)
+
+/* Batches are converted in blocks this size, so that the intermediate
+   linear RGB values stay on the stack */
+#define BATCH_BLOCK_SIZE 64
+
+static inline double
+linearize (double c)
+{
+  if (c <= 0.04045)
+    return c / 12.92;
+  else
+    return pow ((c + 0.055) / 1.055, 2.4);
+}
+
+static inline float
+linearizef (float c)
+{
+  if (c <= 0.04045f)
+    return c / 12.92f;
+  else
+    return powf ((c + 0.055f) / 1.055f, 2.4f);
+}
+
+static inline double
+labf (double t)
+{
+  if (t > EPSILON)
+    return cbrt (t);
+  else
+    return (KAPPA * t + 16.0) / 116.0;
+}
+
+static inline float
+labff (float t)
+{
+  if (t > (float)EPSILON)
+    return cbrtf (t);
+  else
+    return ((float)KAPPA * t + 16.0f) / 116.0f;
+}
+
+void
+CSColorConvertSRGBToXYZ (double r, double g, double b, double xyz[3])
+{
+  r = linearize (r);
+  g = linearize (g);
+  b = linearize (b);
+
+  xyz[0] = 0.4124564 * r + 0.3575761 * g + 0.1804375 * b;
+  xyz[1] = 0.2126729 * r + 0.7151522 * g + 0.0721750 * b;
+  xyz[2] = 0.0193339 * r + 0.1191920 * g + 0.9503041 * b;
+}
+
+void
+CSColorConvertXYZToLab (const double xyz[3], double lab[3])
+{
+  double fx = labf (xyz[0] / WHITE_X);
+  double fy = labf (xyz[1] / WHITE_Y);
+  double fz = labf (xyz[2] / WHITE_Z);
+
+  lab[0] = 116.0 * fy - 16.0;
+  lab[1] = 500.0 * (fx - fy);
+  lab[2] = 200.0 * (fy - fz);
+}
+
+void
+CSColorConvertXYZToLuv (const double xyz[3], double luv[3])
+{
+  double denom = xyz[0] + 15.0 * xyz[1] + 3.0 * xyz[2];
+  double L = 116.0 * labf (xyz[1] / WHITE_Y) - 16.0;
+
+  luv[0] = L;
+
+  if (denom <= 0.0) {
+    luv[1] = luv[2] = 0.0;
+  } else {
+    double u = 4.0 * xyz[0] / denom;
+    double v = 9.0 * xyz[1] / denom;
+
+    luv[1] = 13.0 * L * (u - WHITE_U);
+    luv[2] = 13.0 * L * (v - WHITE_V);
+  }
+}
+
+double
+CSColorSRGBLightness (double r, double g, double b)
+{
+  double Y = (0.2126729 * linearize (r)
+	      + 0.7151522 * linearize (g)
+	      + 0.0721750 * linearize (b));
+
+  return 116.0 * labf (Y / WHITE_Y) - 16.0;
+}
+
+/* Converts up to BATCH_BLOCK_SIZE colours to planar XYZ */
+static void
+convertBlockToXYZ (const float *rgb, float *X, float *Y, float *Z,
+		   size_t count)
+{
+  float r[BATCH_BLOCK_SIZE], g[BATCH_BLOCK_SIZE], b[BATCH_BLOCK_SIZE];
+  size_t n;
+
+  for (n = 0; n < count; ++n) {
+    r[n] = linearizef (rgb[3 * n]);
+    g[n] = linearizef (rgb[3 * n + 1]);
+    b[n] = linearizef (rgb[3 * n + 2]);
+  }
+
+  for (n = 0; n < count; ++n) {
+    X[n] = 0.4124564f * r[n] + 0.3575761f * g[n] + 0.1804375f * b[n];
+    Y[n] = 0.2126729f * r[n] + 0.7151522f * g[n] + 0.0721750f * b[n];
+    Z[n] = 0.0193339f * r[n] + 0.1191920f * g[n] + 0.9503041f * b[n];
+  }
+}
+
+void
+CSColorConvertSRGBToXYZBatch (const float *rgb, float *xyz, size_t count)
+{
+  float X[BATCH_BLOCK_SIZE], Y[BATCH_BLOCK_SIZE], Z[BATCH_BLOCK_SIZE];
+
+  while (count) {
+    size_t todo = count < BATCH_BLOCK_SIZE ? count : BATCH_BLOCK_SIZE;
+    size_t n;
+
+    convertBlockToXYZ (rgb, X, Y, Z, todo);
+
+    for (n = 0; n < todo; ++n) {
+      xyz[3 * n] = X[n];
+      xyz[3 * n + 1] = Y[n];
+      xyz[3 * n + 2] = Z[n];
+    }
+
+    rgb += 3 * todo;
+    xyz += 3 * todo;
+    count -= todo;
+  }
+}
+
+void
+CSColorConvertSRGBToLabBatch (const float *rgb, float *lab, size_t count)
+{
+  float X[BATCH_BLOCK_SIZE], Y[BATCH_BLOCK_SIZE], Z[BATCH_BLOCK_SIZE];
+
+  while (count) {
+    size_t todo = count < BATCH_BLOCK_SIZE ? count : BATCH_BLOCK_SIZE;
+    size_t n;
+
+    convertBlockToXYZ (rgb, X, Y, Z, todo);
+
+    for (n = 0; n < todo; ++n) {
+      X[n] = labff (X[n] * (float)(1.0 / WHITE_X));
+      Y[n] = labff (Y[n] * (float)(1.0 / WHITE_Y));
+      Z[n] = labff (Z[n] * (float)(1.0 / WHITE_Z));
+    }
+
+    for (n = 0; n < todo; ++n) {
+      lab[3 * n] = 116.0f * Y[n] - 16.0f;
+      lab[3 * n + 1] = 500.0f * (X[n] - Y[n]);
+      lab[3 * n + 2] = 200.0f * (Y[n] - Z[n]);
+    }
+
+    rgb += 3 * todo;
+    lab += 3 * todo;
+    count -= todo;
+  }
+}
+
+void
+CSColorConvertSRGBToLuvBatch (const float *rgb, float *luv, size_t count)
+{
+  float X[BATCH_BLOCK_SIZE], Y[BATCH_BLOCK_SIZE], Z[BATCH_BLOCK_SIZE];
+
+  while (count) {
+    size_t todo = count < BATCH_BLOCK_SIZE ? count : BATCH_BLOCK_SIZE;
+    size_t n;
+
+    convertBlockToXYZ (rgb, X, Y, Z, todo);
+
+    for (n = 0; n < todo; ++n) {
+      float denom = X[n] + 15.0f * Y[n] + 3.0f * Z[n];
+      float L = 116.0f * labff (Y[n] * (float)(1.0 / WHITE_Y)) - 16.0f;
+      float scale = denom > 0.0f ? 1.0f / denom : 0.0f;
+      float u = denom > 0.0f ? 4.0f * X[n] * scale - (float)WHITE_U : 0.0f;
+      float v = denom > 0.0f ? 9.0f * Y[n] * scale - (float)WHITE_V : 0.0f;
+
+      luv[3 * n] = L;
+      luv[3 * n + 1] = 13.0f * L * u;
+      luv[3 * n + 2] = 13.0f * L * v;
+    }
+
+    rgb += 3 * todo;
+    luv += 3 * todo;
+    count -= todo;
+  }
+}
@@ -0,0 +1,69 @@
+//
+//  CSColorConversion.h
+//  CSIconView
+//
+//  Created by Alastair Houghton on 15/03/2010.
+//  Copyright (c) 2005-2010 Coriolis Systems Limited
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+//
+
+#ifndef CSCOLORCONVERSION_H_
+#define CSCOLORCONVERSION_H_
+
+#include <stddef.h>
+
+/* Closed-form colour conversions from sRGB (IEC 61966-2-1) to CIE XYZ and
+   from there to CIE L*a*b* and L*u*v*, all relative to the D65 white point.
+   These are plain C, so that they can be used without AppKit (or ColorSync)
+   and from any thread.
+
+   XYZ values are scaled so that the white point has Y = 1; L* runs from 0
+   to 100. */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void CSColorConvertSRGBToXYZ (double r, double g, double b, double xyz[3]);
+void CSColorConvertXYZToLab (const double xyz[3], double lab[3]);
+void CSColorConvertXYZToLuv (const double xyz[3], double luv[3]);
+
+/* Just the L* component, which only depends on Y */
+double CSColorSRGBLightness (double r, double g, double b);
+
+/* Batch versions of the above.  The input and output arrays hold count
+   interleaved triples; the loops are written so that the compiler can
+   vectorise them, and in and out may be the same array. */
+void CSColorConvertSRGBToXYZBatch (const float *rgb, float *xyz, size_t count);
+void CSColorConvertSRGBToLabBatch (const float *rgb, float *lab, size_t count);
+void CSColorConvertSRGBToLuvBatch (const float *rgb, float *luv, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CSCOLORCONVERSION_H_ */
+
+/*
+ * Local Variables:
+ * mode: C
+ * End:
+ *
+ */
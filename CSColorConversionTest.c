@@ -0,0 +1,233 @@
+//
+//  CSColorConversionTest.c
+//  CSIconView
+//
+//  Created by Alastair Houghton on 16/03/2010.
+//  Copyright (c) 2005-2010 Coriolis Systems Limited
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+//
+
+/* Checks the colour conversions against published reference values.  This
+   is plain C, so it builds and runs anywhere, e.g.
+
+     cc -o CSColorConversionTest CSColorConversionTest.c CSColorConversion.c -lm
+     ./CSColorConversionTest
+
+   It prints any failures and exits with a non-zero status if there were
+   any.  The reference values are for sRGB with a D65 white point, as given
+   by Bruce Lindbloom's colour calculator (www.brucelindbloom.com). */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <math.h>
+#include "CSColorConversion.h"
+
+/* The references are given to four decimal places */
+#define TOLERANCE	  0.001
+
+/* The batch conversions use single precision */
+#define BATCH_TOLERANCE	  0.01
+
+/* Enough colours to fill the batch code's 64-colour blocks twice and leave
+   a partial block at the end */
+#define LONG_BATCH_COUNT  133
+
+struct reference {
+  const char  *name;
+  double      rgb[3];
+  double      xyz[3];
+  double      lab[3];
+  double      luv[3];
+};
+
+static const struct reference references[] = {
+  { "black",
+    { 0.0, 0.0, 0.0 },
+    { 0.0, 0.0, 0.0 },
+    { 0.0, 0.0, 0.0 },
+    { 0.0, 0.0, 0.0 } },
+  { "white",
+    { 1.0, 1.0, 1.0 },
+    { 0.950470, 1.000000, 1.088830 },
+    { 100.0000, 0.0000, 0.0000 },
+    { 100.0000, 0.0000, 0.0000 } },
+  { "red",
+    { 1.0, 0.0, 0.0 },
+    { 0.412456, 0.212673, 0.019334 },
+    { 53.2408, 80.0925, 67.2032 },
+    { 53.2408, 175.0151, 37.7564 } },
+  { "green",
+    { 0.0, 1.0, 0.0 },
+    { 0.357576, 0.715152, 0.119192 },
+    { 87.7347, -86.1827, 83.1793 },
+    { 87.7347, -83.0776, 107.3985 } },
+  { "blue",
+    { 0.0, 0.0, 1.0 },
+    { 0.180437, 0.072175, 0.950304 },
+    { 32.2970, 79.1875, -107.8602 },
+    { 32.2970, -9.4054, -130.3423 } }
+};
+
+#define REFERENCE_COUNT (sizeof (references) / sizeof (references[0]))
+
+static unsigned failures;
+
+static void
+check (const char *name, const char *what, const double *got,
+       const double *expected, double tolerance)
+{
+  unsigned n;
+
+  for (n = 0; n < 3; ++n) {
+    if (fabs (got[n] - expected[n]) > tolerance) {
+      printf ("FAIL: %s %s: got (%.4f, %.4f, %.4f), expected "
+	      "(%.4f, %.4f, %.4f)\n", name, what,
+	      got[0], got[1], got[2], expected[0], expected[1], expected[2]);
+      ++failures;
+      return;
+    }
+  }
+}
+
+static void
+checkBatch (const char *what,
+	    void (*convert)(const float *, float *, size_t),
+	    size_t offset)
+{
+  float rgb[REFERENCE_COUNT * 3], out[REFERENCE_COUNT * 3];
+  unsigned n, m;
+
+  for (n = 0; n < REFERENCE_COUNT; ++n) {
+    for (m = 0; m < 3; ++m)
+      rgb[n * 3 + m] = (float)references[n].rgb[m];
+  }
+
+  convert (rgb, out, REFERENCE_COUNT);
+
+  for (n = 0; n < REFERENCE_COUNT; ++n) {
+    const double *expected 
+      = (const double *)((const char *)&references[n] + offset);
+    double got[3];
+
+    for (m = 0; m < 3; ++m)
+      got[m] = out[n * 3 + m];
+
+    check (references[n].name, what, got, expected,
+	   offset == offsetof (struct reference, xyz) 
+	   ? BATCH_TOLERANCE / 100.0 : BATCH_TOLERANCE);
+  }
+
+  // The output is allowed to overwrite the input
+  convert (rgb, rgb, REFERENCE_COUNT);
+
+  for (n = 0; n < REFERENCE_COUNT * 3; ++n) {
+    if (rgb[n] != out[n]) {
+      printf ("FAIL: in-place %s differs from out-of-place\n", what);
+      ++failures;
+      return;
+    }
+  }
+}
+
+/* Checks a long batch of arbitrary colours against the scalar functions,
+   so that every position in a block, and the partial block at the end,
+   gets converted at least once */
+static void
+checkLongBatch (const char *what,
+		void (*convert)(const float *, float *, size_t),
+		size_t offset)
+{
+  float rgb[LONG_BATCH_COUNT * 3], out[LONG_BATCH_COUNT * 3];
+  unsigned state = 1, n, m;
+
+  for (n = 0; n < LONG_BATCH_COUNT * 3; ++n) {
+    state = state * 1103515245u + 12345u;
+    rgb[n] = (float)((state >> 8) & 0xffff) / 65535.0f;
+  }
+
+  convert (rgb, out, LONG_BATCH_COUNT);
+
+  for (n = 0; n < LONG_BATCH_COUNT; ++n) {
+    struct reference scalar;
+    double got[3];
+    char name[32];
+
+    CSColorConvertSRGBToXYZ (rgb[n * 3], rgb[n * 3 + 1], rgb[n * 3 + 2],
+			     scalar.xyz);
+    CSColorConvertXYZToLab (scalar.xyz, scalar.lab);
+    CSColorConvertXYZToLuv (scalar.xyz, scalar.luv);
+
+    for (m = 0; m < 3; ++m)
+      got[m] = out[n * 3 + m];
+
+    sprintf (name, "colour %u", n);
+    check (name, what, got,
+	   (const double *)((const char *)&scalar + offset),
+	   offset == offsetof (struct reference, xyz)
+	   ? BATCH_TOLERANCE / 100.0 : BATCH_TOLERANCE);
+  }
+}
+
+int
+main (void)
+{
+  unsigned n;
+
+  for (n = 0; n < REFERENCE_COUNT; ++n) {
+    const struct reference *ref = &references[n];
+    double xyz[3], lab[3], luv[3], lightness[3], expectedLightness[3];
+
+    CSColorConvertSRGBToXYZ (ref->rgb[0], ref->rgb[1], ref->rgb[2], xyz);
+    CSColorConvertXYZToLab (xyz, lab);
+    CSColorConvertXYZToLuv (xyz, luv);
+
+    check (ref->name, "XYZ", xyz, ref->xyz, TOLERANCE / 100.0);
+    check (ref->name, "L*a*b*", lab, ref->lab, TOLERANCE);
+    check (ref->name, "L*u*v*", luv, ref->luv, TOLERANCE);
+
+    lightness[0] = CSColorSRGBLightness (ref->rgb[0], ref->rgb[1], ref->rgb[2]);
+    lightness[1] = lightness[2] = 0.0;
+    expectedLightness[0] = ref->lab[0];
+    expectedLightness[1] = expectedLightness[2] = 0.0;
+    check (ref->name, "L*", lightness, expectedLightness, TOLERANCE);
+  }
+
+  checkBatch ("batch XYZ", CSColorConvertSRGBToXYZBatch,
+	      offsetof (struct reference, xyz));
+  checkBatch ("batch L*a*b*", CSColorConvertSRGBToLabBatch,
+	      offsetof (struct reference, lab));
+  checkBatch ("batch L*u*v*", CSColorConvertSRGBToLuvBatch,
+	      offsetof (struct reference, luv));
+
+  checkLongBatch ("long batch XYZ", CSColorConvertSRGBToXYZBatch,
+		  offsetof (struct reference, xyz));
+  checkLongBatch ("long batch L*a*b*", CSColorConvertSRGBToLabBatch,
+		  offsetof (struct reference, lab));
+  checkLongBatch ("long batch L*u*v*", CSColorConvertSRGBToLuvBatch,
+		  offsetof (struct reference, luv));
+
+  if (failures) {
+    printf ("%u failure%s\n", failures, failures == 1 ? "" : "s");
+    return 1;
+  }
+
+  printf ("All colour conversion checks passed\n");
+  return 0;
+}
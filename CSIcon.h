@@ -42,7 +42,7 @@ extern NSString * const kCSOpenDropIconVariant;
 @interface CSIcon : NSObject
 {
   NSMutableDictionary *variants;
-  NSMutableSet        *cachedReps;
+  NSMutableDictionary *cachedReps;
   NSString	      *name;
 }
 
@@ -76,6 +76,23 @@ extern NSString * const kCSOpenDropIconVariant;
 - (BOOL)variant:(NSString*)variant wouldIntersectRect:(NSRect)rect
   ifDrawnInRect:(NSRect)drawRect;
 
+/* Drawing and hit testing use images holding a single bitmap with exactly
+   the number of pixels needed for the destination, built once (by box
+   filtering the closest larger representation) and cached per variant.
+   This returns that image, or nil if the size is too large to cache. */
+- (NSImage *)cachedImageForVariant:(NSString *)variant
+			      size:(NSSize)size
+			 pixelSize:(NSSize)pixelSize;
+- (void)flushCachedImages;
+
+/* Draws a cached bitmap no more than 32 pixels on a side, scaled up with
+   low quality interpolation if necessary.  This is much cheaper than
+   drawing at full resolution when lots of icons are being drawn at once,
+   e.g. while scrolling. */
+- (void)drawThumbnailOfVariant:(NSString *)variant inRect:(NSRect)rect
+		     operation:(NSCompositingOperation)operation
+		      fraction:(float)fraction;
+
 - (NSArray *)availableVariants;
 
 - (void)setImagesFromIconFamily:(IconFamilyHandle)handle;
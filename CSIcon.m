@@ -35,6 +35,14 @@ NSString * const kCSDropIconVariant = @"Drop";
 NSString * const kCSOpenIconVariant = @"Open";
 NSString * const kCSOpenDropIconVariant = @"OpenDrop";
 
+/* We keep this many cached images per variant, and won't cache anything
+   with more pixels than MAX_CACHED_PIXELS */
+#define MAX_CACHED_IMAGES   8
+#define MAX_CACHED_PIXELS   (1024 * 1024)
+
+/* The largest dimension of a thumbnail, in pixels */
+#define THUMBNAIL_PIXELS    32
+
 static const IconFamilyElement *findElement (Size containerSize,
 					     const IconFamilyElement *firstElement,
 					     OSType elementType);
@@ -143,7 +151,7 @@ static NSMutableDictionary *namedIcons;
 {
   if ((self = [super init])) {
     variants = [[NSMutableDictionary alloc] init];
-    cachedReps = [[NSMutableSet alloc] init];
+    cachedReps = [[NSMutableDictionary alloc] init];
   }
   
   return self;
@@ -249,19 +257,46 @@ static NSMutableDictionary *namedIcons;
   return name;
 }
 
+/* Icons can be drawn on several threads at once (see
+   -[CSIconView setRendersAsynchronously:]), so the variants and the image
+   cache are only touched with the icon locked. */
 - (NSImage *)imageForVariant:(NSString *)variant
 {
-  return [variants objectForKey:variant];
+  NSImage *image;
+
+  @synchronized (self) {
+    image = [[variants objectForKey:variant] retain];
+  }
+
+  return [image autorelease];
 }
 
 - (void)setImage:(NSImage *)newImage forVariant:(NSString *)variant
 {
-  [variants setObject:newImage forKey:variant];
+  @synchronized (self) {
+    [variants setObject:newImage forKey:variant];
+
+    // Other variants may fall back to this one, so flush everything
+    [self flushCachedImages];
+  }
+}
+
+- (void)flushCachedImages
+{
+  @synchronized (self) {
+    [cachedReps removeAllObjects];
+  }
 }
 
 - (NSArray *)availableVariants
 {
-  return [variants allKeys];
+  NSArray *result;
+
+  @synchronized (self) {
+    result = [variants allKeys];
+  }
+
+  return result;
 }
 
 /* Given an icon family, extract 32-bit images for each supported size.
@@ -301,6 +336,8 @@ static NSMutableDictionary *namedIcons;
   Size resourceSize;
   unsigned size, variant, n;
 
+  [self flushCachedImages];
+
   [baseImage setFlipped:YES];
   [variants setObject:baseImage forKey:kCSNormalIconVariant];
   
@@ -383,79 +420,199 @@ static NSMutableDictionary *namedIcons;
   HUnlock ((Handle)handle);
 }
 
-- (BOOL)variant:(NSString*)variant wouldIntersectRect:(NSRect)intersectRect
-  ifDrawnInRect:(NSRect)rect
+/* The image we actually draw for a variant, allowing for fallbacks */
+- (NSImage *)imageToDrawForVariant:(NSString *)variant
 {
-  NSImage *image = [variants objectForKey:variant];
-  NSBitmapImageRep *rep, *bestRep = nil;
-  NSArray *reps;
-  NSEnumerator *repEnum;
-  NSSize bestSize = NSMakeSize (0.0f, 0.0f);
+  NSImage *image;
+
+  @synchronized (self) {
+    image = [variants objectForKey:variant];
   
-  if (!image) {
-    if (variant == kCSDropIconVariant || variant == kCSOpenIconVariant) {
-      image = [variants objectForKey:kCSOpenDropIconVariant];
-    }
+    if (!image) {
+      if (variant == kCSDropIconVariant || variant == kCSOpenIconVariant) {
+	image = [variants objectForKey:kCSOpenDropIconVariant];
+      }
     
-    if (!image)
-      image = [variants objectForKey:kCSNormalIconVariant];
+      if (!image)
+	image = [variants objectForKey:kCSNormalIconVariant];
+    }
+
+    [image retain];
   }
-  
-  reps = [image representations];
-  repEnum = [reps objectEnumerator];
+
+  return [image autorelease];
+}
+
+/* The number of device pixels covered by the specified size in the
+   current graphics context, which takes account of the backing scale
+   factor and any scaling in the CTM */
+static NSSize
+devicePixelSize (NSSize size)
+{
+  NSGraphicsContext *context = [NSGraphicsContext currentContext];
+
+  if (context) {
+    CGSize deviceSize 
+      = CGContextConvertSizeToDeviceSpace ((CGContextRef)[context graphicsPort],
+					   NSSizeToCGSize (size));
+
+    size = NSMakeSize (fabs (deviceSize.width), fabs (deviceSize.height));
+  }
+
+  return NSMakeSize (floor (size.width + 0.5), floor (size.height + 0.5));
+}
+
+/* Find the smallest bitmap that's at least as large as the specified
+   pixel size, or nil if there isn't one */
+static NSBitmapImageRep *
+bestRepForPixelSize (NSImage *image, NSSize pixelSize)
+{
+  NSEnumerator *repEnum = [[image representations] objectEnumerator];
+  NSBitmapImageRep *rep, *bestRep = nil;
 
   while ((rep = [repEnum nextObject])) {
-    NSSize size = [rep size];
-    
-    if ([rep class] != [NSBitmapImageRep class])
+    if (![rep isKindOfClass:[NSBitmapImageRep class]]
+	|| [rep pixelsWide] < pixelSize.width
+	|| [rep pixelsHigh] < pixelSize.height)
       continue;
-    
-    if (NSEqualSizes (rect.size, size)) {
-      bestRep = rep;
-      bestSize = size;
-      break;
-    }
-    
-    if ((size.width > bestSize.width
-	 && size.height > bestSize.height)
-	|| (size.width * size.height) > (bestSize.width * bestSize.height)) {
-      bestSize = size;
+
+    if (!bestRep
+	|| [rep pixelsWide] * [rep pixelsHigh]
+	   < [bestRep pixelsWide] * [bestRep pixelsHigh])
       bestRep = rep;
+  }
+
+  return bestRep;
+}
+
+// Called with the icon locked
+- (NSImage *)lockedCachedImageForVariant:(NSString *)variant
+				    size:(NSSize)size
+			       pixelSize:(NSSize)pixelSize
+{
+  NSMutableArray *images = [cachedReps objectForKey:variant];
+  NSImage *image, *source;
+  NSBitmapImageRep *rep;
+  NSUInteger n, count = [images count];
+
+  if (pixelSize.width < 1 || pixelSize.height < 1
+      || pixelSize.width * pixelSize.height > MAX_CACHED_PIXELS)
+    return nil;
+
+  for (n = 0; n < count; ++n) {
+    image = [images objectAtIndex:n];
+    rep = [[image representations] objectAtIndex:0];
+
+    if (NSEqualSizes ([image size], size)
+	&& [rep pixelsWide] == pixelSize.width
+	&& [rep pixelsHigh] == pixelSize.height) {
+      // Keep recently used images at the front
+      if (n)
+	[images exchangeObjectAtIndex:n withObjectAtIndex:0];
+      return image;
     }
   }
+
+  source = [self imageToDrawForVariant:variant];
+
+  if (!source)
+    return nil;
+
+  rep = bestRepForPixelSize (source, pixelSize);
+
+  if (rep && [rep pixelsWide] == pixelSize.width
+      && [rep pixelsHigh] == pixelSize.height && [rep isPremultipliedRGBA]) {
+    rep = [[rep copy] autorelease];
+  } else if (rep) {
+    rep = [rep boxFilteredRepWithPixelsWide:pixelSize.width
+				 pixelsHigh:pixelSize.height];
+  } else {
+    /* Nothing big enough (or no bitmaps at all), so let AppKit scale the
+       image up, once, at high quality */
+    NSGraphicsContext *context;
+
+    rep = [NSBitmapImageRep premultipliedRGBARepWithPixelsWide:pixelSize.width
+						    pixelsHigh:pixelSize.height];
+    context = [NSGraphicsContext graphicsContextWithBitmapImageRep:rep];
+
+    [NSGraphicsContext saveGraphicsState];
+    [NSGraphicsContext setCurrentContext:context];
+    [context setImageInterpolation:NSImageInterpolationHigh];
+    [source drawInRect:NSMakeRect (0, 0, pixelSize.width, pixelSize.height)
+	      fromRect:NSZeroRect
+	     operation:NSCompositeCopy
+	      fraction:1.0];
+    [NSGraphicsContext restoreGraphicsState];
+  }
+
+  [rep setSize:size];
+
+  image = [[[NSImage alloc] initWithSize:size] autorelease];
+  [image setFlipped:[source isFlipped]];
+  [image setCacheMode:NSImageCacheNever];
+  [image addRepresentation:rep];
+
+  if (!images) {
+    images = [NSMutableArray arrayWithCapacity:MAX_CACHED_IMAGES];
+    [cachedReps setObject:images forKey:variant];
+  }
+
+  if ([images count] >= MAX_CACHED_IMAGES)
+    [images removeLastObject];
+  [images insertObject:image atIndex:0];
+
+  return image;
+}
+
+- (NSImage *)cachedImageForVariant:(NSString *)variant
+			      size:(NSSize)size
+			 pixelSize:(NSSize)pixelSize
+{
+  NSImage *image;
+
+  @synchronized (self) {
+    image = [[self lockedCachedImageForVariant:variant
+					  size:size
+				     pixelSize:pixelSize] retain];
+  }
+
+  return [image autorelease];
+}
+
+/* Hit testing uses the same cached bitmap we draw with at 1x, so what you
+   click on is exactly what you see */
+- (BOOL)variant:(NSString*)variant wouldIntersectRect:(NSRect)intersectRect
+  ifDrawnInRect:(NSRect)rect
+{
+  NSSize pixelSize = NSMakeSize (floor (rect.size.width + 0.5),
+				 floor (rect.size.height + 0.5));
+  NSImage *image = [self cachedImageForVariant:variant
+					  size:rect.size
+				     pixelSize:pixelSize];
+  NSBitmapImageRep *rep;
+  
+  if (!image)
+    return NSIntersectsRect (intersectRect, rect);
+
+  rep = [[image representations] objectAtIndex:0];
   
   intersectRect.origin.x -= rect.origin.x;
   intersectRect.origin.y -= rect.origin.y;
   
-  if (bestSize.width != rect.size.width
-      || bestSize.height != rect.size.height) {
-    float xScale = bestSize.width / rect.size.width;
-    float yScale = bestSize.height / rect.size.height;
-    
-    intersectRect.origin.x *= xScale;
-    intersectRect.size.width *= xScale;
-    intersectRect.origin.y *= yScale;
-    intersectRect.size.height *= yScale;
-  }
-  
-  return [bestRep rectIntersectsWithImage:intersectRect 
-		       withAlphaThreshold:0.1f];
+  return [rep rectIntersectsWithImage:intersectRect 
+		   withAlphaThreshold:0.1f];
 }
 
 - (void)drawVariant:(NSString *)variant inRect:(NSRect)rect
 	  operation:(NSCompositingOperation)operation
 	   fraction:(float)fraction
 {
-  NSImage *image = [variants objectForKey:variant];
-  
-  if (!image) {
-    if (variant == kCSDropIconVariant || variant == kCSOpenIconVariant) {
-      image = [variants objectForKey:kCSOpenDropIconVariant];
-    }
-    
-    if (!image)
-      image = [variants objectForKey:kCSNormalIconVariant];
-  }
+  NSImage *image = [self cachedImageForVariant:variant
+					  size:rect.size
+				     pixelSize:devicePixelSize (rect.size)];
+
+  if (!image)
+    image = [self imageToDrawForVariant:variant];
   
   [image drawInRect:rect
            fromRect:NSZeroRect
@@ -463,6 +620,41 @@ static NSMutableDictionary *namedIcons;
            fraction:fraction];
 }
 
+- (void)drawThumbnailOfVariant:(NSString *)variant inRect:(NSRect)rect
+		     operation:(NSCompositingOperation)operation
+		      fraction:(float)fraction
+{
+  NSGraphicsContext *context = [NSGraphicsContext currentContext];
+  NSImageInterpolation interpolation = [context imageInterpolation];
+  NSSize pixelSize = devicePixelSize (rect.size);
+  CGFloat largest = MAX (pixelSize.width, pixelSize.height);
+  NSImage *image;
+
+  if (largest > THUMBNAIL_PIXELS) {
+    CGFloat scale = THUMBNAIL_PIXELS / largest;
+
+    pixelSize = NSMakeSize (ceil (pixelSize.width * scale),
+			    ceil (pixelSize.height * scale));
+  }
+
+  image = [self cachedImageForVariant:variant
+				 size:rect.size
+			    pixelSize:pixelSize];
+
+  if (!image) {
+    [self drawVariant:variant inRect:rect 
+	    operation:operation fraction:fraction];
+    return;
+  }
+
+  [context setImageInterpolation:NSImageInterpolationLow];
+  [image drawInRect:rect
+	   fromRect:NSZeroRect
+	  operation:operation
+	   fraction:fraction];
+  [context setImageInterpolation:interpolation];
+}
+
 - (void)drawInRect:(NSRect)rect
 	 operation:(NSCompositingOperation)operation
 	  fraction:(float)fraction
@@ -27,6 +27,86 @@
 #import <Cocoa/Cocoa.h>
 #import "CSIcon.h"
 
+@class CSTitleLayout, CSTitleLayoutKey;
+
+/* How much effort to put into drawing.  Reduced detail draws a thumbnail
+   of the icon and a bar in place of the title, without any text layout;
+   minimal detail draws just the thumbnail. */
+typedef enum {
+  CSIconDetailFull,
+  CSIconDetailReduced,
+  CSIconDetailMinimal
+} CSIconDetailLevel;
+
+/* The parts of an icon that respond to the mouse, relative to the origin of
+   the icon's frame.  The renderer works these out once, after which hit
+   testing is just geometry.  The mask is the icon's cached bitmap at the
+   size it is drawn, or nil if the icon has no image of its own. */
+typedef struct CSIconHitRegion {
+  NSRect		iconRect;	// Highlight rectangle around the icon
+  NSRect		drawRect;	// Where the icon image is drawn
+  NSBitmapImageRep	*mask;
+  unsigned		lineCount;
+  NSRect		lineRects[1];	// Title lines; actually lineCount long
+} CSIconHitRegion;
+
+void CSIconHitRegionFree (CSIconHitRegion *region);
+BOOL CSIconHitRegionIntersectsRect (const CSIconHitRegion *region,
+				    NSRect		   rect,
+				    BOOL		   highlighted);
+BOOL CSIconHitRegionTitleContainsPoint (const CSIconHitRegion *region,
+					NSPoint			pt);
+
+enum {
+  CSIconDrawEnabled	    = 0x0001,
+  CSIconDrawHighlighted	    = 0x0002,
+  CSIconDrawFilledHighlight = 0x0004,
+  CSIconDrawTextOnRight	    = 0x0008,
+  CSIconDrawInKeyView	    = 0x0010,
+  CSIconDrawWithText	    = 0x0020
+};
+
+/* Everything a renderer needs to draw one item, apart from where to put
+   it.  Renderers are stateful, so they can't be shared between threads;
+   descriptions are immutable, so they can be captured on the main thread
+   and drawn by a renderer on any other.  Two descriptions are equal if they
+   would draw the same thing, so they also make good cache keys.  Icons are
+   compared by identity. */
+@interface CSIconDrawDescription : NSObject <NSCopying>
+{
+  CSIcon	*icon;
+  NSString	*variant;
+  NSString	*title;
+  NSDictionary	*titleAttributes;
+  NSColor	*labelColor;
+  NSColor	*labelShadeColor;
+  NSSize	iconSize;
+  NSSize	frameSize;
+  unsigned	flags;
+}
+
+- (id)initWithIcon:(CSIcon *)icon
+	   variant:(NSString *)variant
+	     title:(NSString *)title
+	attributes:(NSDictionary *)titleAttributes
+	labelColor:(NSColor *)labelColor
+	shadeColor:(NSColor *)labelShadeColor
+	  iconSize:(NSSize)iconSize
+	 frameSize:(NSSize)frameSize
+	     flags:(unsigned)flags;
+
+- (CSIcon *)icon;
+- (NSString *)variant;
+- (NSString *)title;
+- (NSDictionary *)titleAttributes;
+- (NSColor *)labelColor;
+- (NSColor *)labelShadeColor;
+- (NSSize)iconSize;
+- (NSSize)frameSize;
+- (unsigned)flags;
+
+@end
+
 @interface CSIconRenderer : NSObject
 {
   NSTextStorage	  *textStorage;
@@ -35,11 +115,21 @@
 
   BOOL		  needLayout;
 
+  NSString	  *originalTitle;
+  NSDictionary	  *titleAttributes;
+  BOOL		  cacheTitleLayout;
+  CSTitleLayout	  *titleLayout;
+  CSTitleLayoutKey *titleLayoutKey;
+  NSMutableDictionary *titleLayoutCache;
+  unsigned	  titleLayoutsPerformed;
+  unsigned	  titleLayoutCacheHits;
+
   CSIcon	  *icon;
   NSColor	  *labelColor;
   NSColor	  *labelShadeColor;
   NSSize	  iconSize;
   NSString	  *variant;
+  CSIconDetailLevel detailLevel;
 }
 
 - (CSIcon *)icon;
@@ -65,8 +155,21 @@
 - (NSSize)iconSize;
 - (void)setIconSize:(NSSize)newSize;
 
+- (CSIconDetailLevel)detailLevel;
+- (void)setDetailLevel:(CSIconDetailLevel)level;
+
 - (NSMutableArray *)iconTitleRectsInRect:(NSRect)rect;
 
+/* Title layouts are cached by title, attributes and size.  Renderers can
+   share a cache; passing nil gives this renderer a fresh one of its own. */
+- (NSMutableDictionary *)titleLayoutCache;
+- (void)setTitleLayoutCache:(NSMutableDictionary *)cache;
+
+/* Counts of title layouts since the last -resetStatistics */
+- (unsigned)titleLayoutsPerformed;
+- (unsigned)titleLayoutCacheHits;
+- (void)resetStatistics;
+
 - (void)renderIconTitleInRect:(NSRect)rect
 	       withBackground:(BOOL)background
 		 andFocusRing:(BOOL)focusRing
@@ -80,6 +183,11 @@
             inKeyView:(BOOL)inKeyView
              withText:(BOOL)withText;
 
+/* Sets the renderer up from the description and draws it, at the current
+   detail level, with the frame's origin at the given point */
+- (void)drawDescription:(CSIconDrawDescription *)description
+		atPoint:(NSPoint)origin;
+
 - (BOOL)isPoint:(NSPoint)pt inTextIfDrawnWithFrame:(NSRect)iconFrame
     textOnRight:(BOOL)textOnRight;
 
@@ -91,6 +199,12 @@
 - (NSRect)textRectIfDrawnWithFrame:(NSRect)iconFrame
                        textOnRight:(BOOL)textOnRight;
 
+/* Returns a malloc()ed hit region for the current icon, variant, title and
+   icon size in a frame of the given size, or NULL if we ran out of memory.
+   Free it with CSIconHitRegionFree(). */
+- (CSIconHitRegion *)newHitRegionForFrameSize:(NSSize)frameSize
+				  textOnRight:(BOOL)textOnRight;
+
 @end
 
 /*
@@ -26,6 +26,212 @@
 
 #import "CSIconRenderer.h"
 #import "CSShading.h"
+#import "NSBitmapImageRep+CSIconViewExtras.h"
+
+/* Title layouts are cached by title, attributes and container size; if we
+   end up with more than this many, we throw them all away and start again. */
+#define MAX_CACHED_TITLE_LAYOUTS  1024
+
+/* The key for the title layout cache.  The renderer keeps one of these around
+   as a probe, so looking up a layout doesn't allocate anything. */
+@interface CSTitleLayoutKey : NSObject <NSCopying>
+{
+@public
+  NSString	*title;
+  NSDictionary	*attributes;
+  NSSize	size;
+}
+
+@end
+
+/* The line fragment rects for a laid out title, relative to the origin of
+   the text container, together with the background path we last built around
+   them.  As with -iconTitleRectsInRect:, the last line comes first. */
+@interface CSTitleLayout : NSObject
+{
+@public
+  NSRect	*lineRects;
+  unsigned	lineCount;
+  CGFloat	height;
+  CGFloat	pathRadius;
+  CGFloat	pathPadding;
+  NSBezierPath	*backgroundPath;
+}
+
+@end
+
+@implementation CSTitleLayoutKey
+
+- (void)dealloc
+{
+  [title release];
+  [attributes release];
+  [super dealloc];
+}
+
+- (id)copyWithZone:(NSZone *)zone
+{
+  CSTitleLayoutKey *key = [[CSTitleLayoutKey allocWithZone:zone] init];
+
+  key->title = [title copy];
+  key->attributes = [attributes copy];
+  key->size = size;
+
+  return key;
+}
+
+- (NSUInteger)hash
+{
+  return [title hash] ^ ((NSUInteger)size.width << 16) ^ (NSUInteger)size.height;
+}
+
+- (BOOL)isEqual:(id)other
+{
+  CSTitleLayoutKey *key = (CSTitleLayoutKey *)other;
+
+  if (![other isKindOfClass:[CSTitleLayoutKey class]])
+    return NO;
+
+  return (NSEqualSizes (size, key->size)
+	  && (title == key->title || [title isEqualToString:key->title])
+	  && (attributes == key->attributes
+	      || [attributes isEqualToDictionary:key->attributes]));
+}
+
+@end
+
+@implementation CSTitleLayout
+
+- (void)dealloc
+{
+  free (lineRects);
+  [backgroundPath release];
+  [super dealloc];
+}
+
+@end
+
+@implementation CSIconDrawDescription
+
+- (id)initWithIcon:(CSIcon *)theIcon
+	   variant:(NSString *)theVariant
+	     title:(NSString *)theTitle
+	attributes:(NSDictionary *)theAttributes
+	labelColor:(NSColor *)theLabelColor
+	shadeColor:(NSColor *)theShadeColor
+	  iconSize:(NSSize)theIconSize
+	 frameSize:(NSSize)theFrameSize
+	     flags:(unsigned)theFlags
+{
+  if ((self = [super init])) {
+    icon = [theIcon retain];
+    variant = [theVariant copy];
+    title = [theTitle copy];
+    titleAttributes = [theAttributes copy];
+    labelColor = [theLabelColor retain];
+    labelShadeColor = [theShadeColor retain];
+    iconSize = theIconSize;
+    frameSize = theFrameSize;
+    flags = theFlags;
+  }
+
+  return self;
+}
+
+- (void)dealloc
+{
+  [icon release];
+  [variant release];
+  [title release];
+  [titleAttributes release];
+  [labelColor release];
+  [labelShadeColor release];
+  [super dealloc];
+}
+
+- (id)copyWithZone:(NSZone *)zone
+{
+  (void)zone;
+
+  return [self retain];
+}
+
+- (CSIcon *)icon
+{
+  return icon;
+}
+
+- (NSString *)variant
+{
+  return variant;
+}
+
+- (NSString *)title
+{
+  return title;
+}
+
+- (NSDictionary *)titleAttributes
+{
+  return titleAttributes;
+}
+
+- (NSColor *)labelColor
+{
+  return labelColor;
+}
+
+- (NSColor *)labelShadeColor
+{
+  return labelShadeColor;
+}
+
+- (NSSize)iconSize
+{
+  return iconSize;
+}
+
+- (NSSize)frameSize
+{
+  return frameSize;
+}
+
+- (unsigned)flags
+{
+  return flags;
+}
+
+- (NSUInteger)hash
+{
+  return ([title hash] ^ ((NSUInteger)icon >> 4) ^ (flags << 24)
+	  ^ ((NSUInteger)frameSize.width << 12) ^ (NSUInteger)iconSize.width);
+}
+
+static inline BOOL
+objectsEqual (id a, id b)
+{
+  return a == b || (a && b && [a isEqual:b]);
+}
+
+- (BOOL)isEqual:(id)other
+{
+  CSIconDrawDescription *description = (CSIconDrawDescription *)other;
+
+  if (![other isKindOfClass:[CSIconDrawDescription class]])
+    return NO;
+
+  return (icon == description->icon
+	  && flags == description->flags
+	  && NSEqualSizes (frameSize, description->frameSize)
+	  && NSEqualSizes (iconSize, description->iconSize)
+	  && objectsEqual (variant, description->variant)
+	  && objectsEqual (title, description->title)
+	  && objectsEqual (titleAttributes, description->titleAttributes)
+	  && objectsEqual (labelColor, description->labelColor)
+	  && objectsEqual (labelShadeColor, description->labelShadeColor));
+}
+
+@end
 
 // A Finder-like icon cell class
 @implementation CSIconRenderer
@@ -36,6 +242,8 @@
     layoutManager = [[NSLayoutManager alloc] init];
     textContainer = [[NSTextContainer alloc] init];
     textStorage = [[NSTextStorage alloc] init];
+    titleLayoutCache = [[NSMutableDictionary alloc] init];
+    titleLayoutKey = [[CSTitleLayoutKey alloc] init];
     [self setVariant:kCSNormalIconVariant];
     [layoutManager addTextContainer:textContainer];
     [textStorage addLayoutManager:layoutManager];
@@ -49,6 +257,11 @@
   [textStorage release];
   [layoutManager release];
   [textContainer release];
+  [titleLayoutCache release];
+  [titleLayoutKey release];
+  [titleLayout release];
+  [originalTitle release];
+  [titleAttributes release];
   [labelColor release];
   [labelShadeColor release];
   [icon release];
@@ -89,20 +302,48 @@
   return [textStorage string];
 }
 
+- (void)invalidateTitleLayout
+{
+  [titleLayout release];
+  titleLayout = nil;
+}
+
 - (void)setTitle:(NSString *)newTitle
 {
+  NSString *oldTitle = originalTitle;
+
   if (!newTitle)
     newTitle = @"";
   
   [textStorage replaceCharactersInRange:NSMakeRange (0, [textStorage length])
 			     withString:newTitle];
+
+  /* Make sure the attributes really are the ones we're using as part of the
+     layout cache key (they won't survive an empty title otherwise) */
+  if (titleAttributes) {
+    [textStorage setAttributes:titleAttributes
+			 range:NSMakeRange (0, [textStorage length])];
+  }
+
+  originalTitle = [newTitle copy];
+  [oldTitle release];
+  
   needLayout = YES;
+  cacheTitleLayout = YES;
+  [self invalidateTitleLayout];
 }
 
 - (void)setTitleAttributes:(NSDictionary *)newAttributes
 {
+  if (titleAttributes != newAttributes) {
+    NSDictionary *oldAttributes = titleAttributes;
+    titleAttributes = [newAttributes retain];
+    [oldAttributes release];
+  }
+
   [textStorage setAttributes:newAttributes
 		       range:NSMakeRange (0, [textStorage length])];
+  [self invalidateTitleLayout];
 }
 
 - (NSAttributedString *)attributedTitle
@@ -115,6 +356,12 @@
   [textStorage replaceCharactersInRange:NSMakeRange (0, [textStorage length])
 		   withAttributedString:newTitle];
   needLayout = YES;
+
+  // We don't cache layouts for arbitrary attributed strings
+  [titleAttributes release];
+  titleAttributes = nil;
+  cacheTitleLayout = NO;
+  [self invalidateTitleLayout];
 }
 
 - (NSColor *)labelColor
@@ -155,21 +402,46 @@
   iconSize = newSize;
 }
 
+- (CSIconDetailLevel)detailLevel
+{
+  return detailLevel;
+}
+
+- (void)setDetailLevel:(CSIconDetailLevel)level
+{
+  detailLevel = level;
+}
+
 /* Assumes the rectangles are all centred. */
-- (NSBezierPath *)bezierPathSurroundingRects:(NSMutableArray *)rectArray
+- (NSBezierPath *)bezierPathSurroundingRects:(const NSRect *)lineRects
+				       count:(unsigned)count
 				      radius:(float)r
 				     padding:(float)padding
 {
   BOOL changed1, changed2;
-  unsigned count = [rectArray count];
   float a = M_SQRT1_2 * r;
   NSBezierPath *path = [NSBezierPath bezierPath];
   NSRect prevRect, rect;
+  NSRect localRects[8];
+  NSRect *rectArray = localRects;
   float x[4], y[4];
   unsigned n;
     
   if (!count)
     return path;
+
+  // We adjust the rects below, so work on a copy
+  if (count > sizeof (localRects) / sizeof (localRects[0])) {
+    rectArray = (NSRect *) malloc (sizeof (NSRect) * count);
+
+    if (!rectArray) {
+      [NSException raise:@"CSOutOfMemory"
+		  format:@"%@", NSLocalizedString (@"Not enough memory.",
+						   @"Not enough memory.")];
+    }
+  }
+
+  memcpy (rectArray, lineRects, sizeof (NSRect) * count);
   
   /* First check if there are any rectangles that are too close in size
      to draw smooth curves between them.  If so, expand the smaller ones
@@ -182,8 +454,8 @@
       float xdiff;
       
       changed1 = changed2 = NO;
-      r1 = [[rectArray objectAtIndex:n] rectValue];
-      r2 = [[rectArray objectAtIndex:n + 1] rectValue];
+      r1 = rectArray[n];
+      r2 = rectArray[n + 1];
       
       xdiff = NSMinX (r1) - NSMinX (r2);
       if (xdiff != 0.0f && fabs (xdiff) < r) {
@@ -209,19 +481,15 @@
 	}
       }
 
-      if (changed1) {
-	[rectArray replaceObjectAtIndex:n 
-			     withObject:[NSValue valueWithRect:r1]];
-      }
-      if (changed2) {
-	[rectArray replaceObjectAtIndex:n + 1
-			     withObject:[NSValue valueWithRect:r2]];
-      }
+      if (changed1)
+	rectArray[n] = r1;
+      if (changed2)
+	rectArray[n + 1] = r2;
     }
   } while (changed1 || changed2);
   
   // Do the top part of the top element
-  rect = [[rectArray objectAtIndex:0] rectValue];
+  rect = rectArray[0];
   x[0] = NSMinX (rect) - padding;
   x[1] = NSMinX (rect) + a - padding;
   x[2] = NSMaxX (rect) + padding;
@@ -241,7 +509,7 @@
     float prevX, thisX;
     
     prevRect = rect;
-    rect = [[rectArray objectAtIndex:n] rectValue];
+    rect = rectArray[n];
     
     prevX = NSMaxX (prevRect);
     thisX = NSMaxX (rect);
@@ -278,7 +546,7 @@
   }
   
   // Do the bottom part of the bottom element
-  rect = [[rectArray objectAtIndex:count - 1] rectValue];
+  rect = rectArray[count - 1];
   x[0] = NSMaxX (rect) + padding;
   x[1] = NSMaxX (rect) - a + padding;
   x[2] = NSMinX (rect) - padding;
@@ -297,7 +565,7 @@
     float prevX, thisX;
     
     prevRect = rect;
-    rect = [[rectArray objectAtIndex:n - 1] rectValue];
+    rect = rectArray[n - 1];
 
     prevX = NSMinX (prevRect);
     thisX = NSMinX (rect);
@@ -335,6 +603,9 @@
 
   // Close the path
   [path closePath];
+
+  if (rectArray != localRects)
+    free (rectArray);
   
   return path;
 }
@@ -385,11 +656,28 @@
   }
 }
 
-- (NSMutableArray *)iconTitleRectsInRect:(NSRect)rect
+- (void)setTextContainerSize:(NSSize)size
 {
+  NSSize currentSize = [textContainer containerSize];
+  
+  if (currentSize.height != size.height
+      || currentSize.width != size.width) {
+    [textContainer setContainerSize:size];
+    needLayout = YES;
+    [self invalidateTitleLayout];
+  }
+}
+
+/* Lay out the title in the current text container and return the line
+   fragment rects (relative to the container) and overall height. */
+- (CSTitleLayout *)newTitleLayout
+{
+  CSTitleLayout *layout = [[CSTitleLayout alloc] init];
   NSRange glyphRange;
   unsigned glyph, numberOfGlyphs;
-  NSMutableArray *rectArray = [NSMutableArray array];
+  unsigned capacity = 0;
+  NSRectArray rects;
+  NSUInteger rectCount, n;
 
   [self updateTextStorage];
   glyph = 0;
@@ -424,34 +712,33 @@
 	lineRect.size.width -= width;
       }
     }
-    
-    lineRect.origin.x += rect.origin.x;
-    lineRect.origin.y += rect.origin.y;
-    
-    [rectArray insertObject:[NSValue valueWithRect:lineRect]
-		    atIndex:0];
+
+    if (layout->lineCount == capacity) {
+      NSRect *newRects;
+
+      capacity = capacity ? capacity * 2 : 4;
+      newRects = (NSRect *) realloc (layout->lineRects,
+				     sizeof (NSRect) * capacity);
+
+      if (!newRects) {
+	[layout release];
+	[NSException raise:@"CSOutOfMemory"
+		    format:@"%@", NSLocalizedString (@"Not enough memory.",
+						     @"Not enough memory.")];
+      }
+
+      layout->lineRects = newRects;
+    }
+
+    // Keep the last line first, as the background path expects
+    memmove (&layout->lineRects[1], &layout->lineRects[0],
+	     sizeof (NSRect) * layout->lineCount);
+    layout->lineRects[0] = lineRect;
+    ++layout->lineCount;
     
     glyph = glyphRange.location + glyphRange.length;
   }
-  
-  return rectArray;
-}
 
-- (float)heightOfTitleInRect:(NSRect)rect
-{
-  NSSize currentSize = [textContainer containerSize];
-  NSRectArray rects;
-  NSUInteger rectCount, n;
-  CGFloat height = 0.0;
-  
-  if (currentSize.height != rect.size.height
-      || currentSize.width != rect.size.width) {
-    [textContainer setContainerSize:rect.size];
-    needLayout = YES;
-  }
-  
-  [self updateTextStorage];
- 
   rects = [layoutManager rectArrayForGlyphRange:
     [layoutManager glyphRangeForTextContainer:textContainer]
 		       withinSelectedGlyphRange:NSMakeRange (NSNotFound, 0)
@@ -459,24 +746,135 @@
 				      rectCount:&rectCount];
   
   for (n = 0; n < rectCount; ++n) {
-    if (height < NSMaxY (rects[n]))
-      height = NSMaxY (rects[n]);
+    if (layout->height < NSMaxY (rects[n]))
+      layout->height = NSMaxY (rects[n]);
   }
-  
-  return height;
+
+  return layout;
 }
 
-- (NSArray *)titleRectArrayInRect:(NSRect)rect
+/* Return the layout of the title in the current text container, from the
+   cache if we've seen this title, attributes and container size before. */
+- (CSTitleLayout *)titleLayout
 {
-  NSSize currentSize = [textContainer containerSize];
-  
-  if (currentSize.height != rect.size.height
-      || currentSize.width != rect.size.width) {
-    [textContainer setContainerSize:rect.size];
-    needLayout = YES;
+  CSTitleLayout *layout = nil;
+
+  if (titleLayout)
+    return titleLayout;
+
+  if (cacheTitleLayout) {
+    titleLayoutKey->title = originalTitle;
+    titleLayoutKey->attributes = titleAttributes;
+    titleLayoutKey->size = [textContainer containerSize];
+
+    layout = [[titleLayoutCache objectForKey:titleLayoutKey] retain];
+
+    if (layout)
+      ++titleLayoutCacheHits;
+  }
+
+  if (!layout) {
+    layout = [self newTitleLayout];
+    ++titleLayoutsPerformed;
+
+    if (cacheTitleLayout) {
+      if ([titleLayoutCache count] >= MAX_CACHED_TITLE_LAYOUTS)
+	[titleLayoutCache removeAllObjects];
+
+      [titleLayoutCache setObject:layout forKey:titleLayoutKey];
+    }
+  }
+
+  // The probe doesn't own its title or attributes
+  titleLayoutKey->title = nil;
+  titleLayoutKey->attributes = nil;
+
+  titleLayout = layout;
+
+  return titleLayout;
+}
+
+- (CSTitleLayout *)titleLayoutInRect:(NSRect)rect
+{
+  [self setTextContainerSize:rect.size];
+
+  return [self titleLayout];
+}
+
+/* Returns the background path for a layout, relative to the origin of the
+   text container. */
+- (NSBezierPath *)backgroundPathForTitleLayout:(CSTitleLayout *)layout
+{
+  CGFloat radius = 0.5 * NSHeight (layout->lineRects[0]);
+  CGFloat padding = 1.0;
+
+  if (!layout->backgroundPath
+      || layout->pathRadius != radius
+      || layout->pathPadding != padding) {
+    [layout->backgroundPath release];
+    layout->backgroundPath 
+      = [[self bezierPathSurroundingRects:layout->lineRects
+				    count:layout->lineCount
+				   radius:radius
+				  padding:padding] retain];
+    layout->pathRadius = radius;
+    layout->pathPadding = padding;
   }
 
-  return [self iconTitleRectsInRect:rect];
+  return layout->backgroundPath;
+}
+
+- (NSMutableDictionary *)titleLayoutCache
+{
+  return titleLayoutCache;
+}
+
+- (void)setTitleLayoutCache:(NSMutableDictionary *)newCache
+{
+  if (!newCache)
+    newCache = [NSMutableDictionary dictionary];
+
+  if (newCache != titleLayoutCache) {
+    NSMutableDictionary *oldCache = titleLayoutCache;
+    titleLayoutCache = [newCache retain];
+    [oldCache release];
+  }
+}
+
+- (unsigned)titleLayoutsPerformed
+{
+  return titleLayoutsPerformed;
+}
+
+- (unsigned)titleLayoutCacheHits
+{
+  return titleLayoutCacheHits;
+}
+
+- (void)resetStatistics
+{
+  titleLayoutsPerformed = titleLayoutCacheHits = 0;
+}
+
+- (NSMutableArray *)iconTitleRectsInRect:(NSRect)rect
+{
+  CSTitleLayout *layout = [self titleLayout];
+  NSMutableArray *rectArray 
+    = [NSMutableArray arrayWithCapacity:layout->lineCount];
+  unsigned n;
+
+  for (n = 0; n < layout->lineCount; ++n) {
+    [rectArray addObject:
+      [NSValue valueWithRect:NSOffsetRect (layout->lineRects[n],
+					   rect.origin.x, rect.origin.y)]];
+  }
+  
+  return rectArray;
+}
+
+- (float)heightOfTitleInRect:(NSRect)rect
+{
+  return [self titleLayoutInRect:rect]->height;
 }
 
 - (void)renderIconTitleInRect:(NSRect)rect
@@ -485,22 +883,19 @@
                     inKeyView:(BOOL)inKeyView
 {
   NSRange glyphRange;
-  NSSize currentSize = [textContainer containerSize];
-  
-  if (currentSize.height != rect.size.height
-      || currentSize.width != rect.size.width) {
-    [textContainer setContainerSize:rect.size];
-    needLayout = YES;
-  }
+  CSTitleLayout *layout = [self titleLayoutInRect:rect];
   
   [self updateTextStorage];
 
-  if (background) {
-    NSMutableArray *rectArray = [self iconTitleRectsInRect:rect];
-    float height = NSHeight ([[rectArray objectAtIndex:0] rectValue]);
-    NSBezierPath *backgroundPath = [self bezierPathSurroundingRects:rectArray
-							     radius:0.5 * height
-							    padding:1.0];
+  if (background && layout->lineCount) {
+    NSBezierPath *backgroundPath 
+      = [self backgroundPathForTitleLayout:layout];
+    NSAffineTransform *transform = [NSAffineTransform transform];
+
+    // The cached path is relative to the text container
+    [NSGraphicsContext saveGraphicsState];
+    [transform translateXBy:rect.origin.x yBy:rect.origin.y];
+    [transform concat];
     
     if (!labelColor) {
       if (inKeyView)
@@ -522,13 +917,11 @@
       NSPoint top = NSMakePoint (0.0, NSMinY (bounds));
       NSPoint bottom = NSMakePoint (0.0, NSMaxY (bounds));
       CSShading *shading
-	= [CSShading axialShadingFromPoint:bottom
-				   toPoint:top
-				withColors:colorArray
-				     flags:CSShadingDefaultFlags];
+	= [CSShading axialShadingWithColors:colorArray
+				      flags:CSShadingDefaultFlags];
       
       [shading set];
-      [backgroundPath shade];
+      [backgroundPath shadeFromPoint:bottom toPoint:top];
     }
     
     if (focusRing) {
@@ -537,6 +930,8 @@
       [backgroundPath fill];
       [NSGraphicsContext restoreGraphicsState];
     }
+
+    [NSGraphicsContext restoreGraphicsState];
   }
   
   glyphRange = [layoutManager glyphRangeForTextContainer:textContainer];
@@ -545,6 +940,59 @@
 				 atPoint:rect.origin];
 }
 
+/* A stand-in for the title at reduced detail: a single bar about as wide
+   as the title would be, guessed from its length, so that we don't have
+   to lay out any text.  Bottom titles are centred at the top of the rect;
+   titles on the right are left aligned and centred vertically. */
+- (void)approximateIconTitleInRect:(NSRect)rect
+		    withBackground:(BOOL)background
+		       textOnRight:(BOOL)textOnRight
+			 inKeyView:(BOOL)inKeyView
+{
+  NSFont *titleFont = [titleAttributes objectForKey:NSFontAttributeName];
+  NSColor *textColor 
+    = [titleAttributes objectForKey:NSForegroundColorAttributeName];
+  CGFloat lineHeight = titleFont ? [titleFont pointSize] : 12.0;
+  CGFloat width = 0.5 * lineHeight * [originalTitle length];
+  NSRect lineRect, barRect;
+
+  if (!width || rect.size.width <= 0 || rect.size.height < lineHeight)
+    return;
+
+  if (width > rect.size.width)
+    width = rect.size.width;
+
+  if (textOnRight) {
+    lineRect = NSMakeRect (NSMinX (rect),
+			   NSMidY (rect) - 0.5 * lineHeight,
+			   width, lineHeight);
+  } else {
+    lineRect = NSMakeRect (NSMidX (rect) - 0.5 * width, NSMinY (rect),
+			   width, lineHeight);
+  }
+
+  if (background) {
+    NSBezierPath *path = [NSBezierPath bezierPath];
+
+    if (labelColor)
+      [labelColor set];
+    else if (inKeyView)
+      [[NSColor alternateSelectedControlColor] set];
+    else
+      [[NSColor secondarySelectedControlColor] set];
+
+    [path appendBezierPathWithRoundedRect:NSInsetRect (lineRect, -4.0, 0.0)
+				  xRadius:0.5 * lineHeight
+				  yRadius:0.5 * lineHeight];
+    [path fill];
+  }
+
+  barRect = NSInsetRect (lineRect, 0.0, 0.3 * lineHeight);
+  [[(textColor ? textColor : [NSColor textColor])
+     colorWithAlphaComponent:0.4] set];
+  NSRectFillUsingOperation (barRect, NSCompositeSourceOver);
+}
+
 - (void)drawWithFrame:(NSRect)iconFrame
 	      enabled:(BOOL)enabled
 	  highlighted:(BOOL)highlighted
@@ -590,7 +1038,10 @@
       }
     }
     
-    if (icon) {
+    if (icon && detailLevel != CSIconDetailFull) {
+      [icon drawThumbnailOfVariant:variant inRect:drawRect
+			 operation:NSCompositeSourceOver fraction:1.0];
+    } else if (icon) {
       [icon drawVariant:variant inRect:drawRect 
 	      operation:NSCompositeSourceOver fraction:1.0]; 
     } else {
@@ -614,7 +1065,10 @@
     NSRect drawRect = NSMakeRect (iconPos.x, iconPos.y - iconSize.height,
 				  iconSize.width, iconSize.height);
 
-    if (icon) {
+    if (icon && detailLevel != CSIconDetailFull) {
+      [icon drawThumbnailOfVariant:variant inRect:drawRect
+			 operation:NSCompositeSourceOver fraction:0.5];
+    } else if (icon) {
       [icon drawVariant:variant inRect:drawRect
 	      operation:NSCompositeSourceOver fraction:0.5];
     } else {
@@ -631,7 +1085,24 @@
     }
   }
   
-  if (withText) {
+  if (withText && detailLevel == CSIconDetailReduced) {
+    if (textOnRight) {
+      textRect.origin.x = iconPos.x + iconSize.width + 6.0;
+      textRect.origin.y = NSMinY (iconFrame);
+      textRect.size.width = NSMaxX (iconFrame) - textRect.origin.x - 4.0;
+      textRect.size.height = NSHeight (iconFrame);
+    } else {
+      textRect.origin.x = iconFrame.origin.x + 2.0;
+      textRect.size.width = iconFrame.size.width - 4.0;
+      textRect.origin.y = iconPos.y + 6.0;
+      textRect.size.height = NSMaxY (iconFrame) - textRect.origin.y - 4.0;
+    }
+
+    [self approximateIconTitleInRect:textRect
+		      withBackground:(enabled && highlighted) || labelColor
+			 textOnRight:textOnRight
+			   inKeyView:inKeyView];
+  } else if (withText && detailLevel == CSIconDetailFull) {
     if (textOnRight) {
       float height;
       
@@ -658,6 +1129,32 @@
   }
 }
 
+- (void)drawDescription:(CSIconDrawDescription *)description
+		atPoint:(NSPoint)origin
+{
+  unsigned flags = [description flags];
+  NSRect frame;
+
+  frame.origin = origin;
+  frame.size = [description frameSize];
+
+  [self setLabelColor:[description labelColor]];
+  [self setLabelShadeColor:[description labelShadeColor]];
+  [self setIconSize:[description iconSize]];
+  [self setIcon:[description icon]];
+  [self setTitle:[description title]];
+  [self setTitleAttributes:[description titleAttributes]];
+  [self setVariant:[description variant]];
+
+  [self drawWithFrame:frame
+	      enabled:(flags & CSIconDrawEnabled) ? YES : NO
+	  highlighted:(flags & CSIconDrawHighlighted) ? YES : NO
+      filledHighlight:(flags & CSIconDrawFilledHighlight) ? YES : NO
+	  textOnRight:(flags & CSIconDrawTextOnRight) ? YES : NO
+	    inKeyView:(flags & CSIconDrawInKeyView) ? YES : NO
+	     withText:(flags & CSIconDrawWithText) ? YES : NO];
+}
+
 - (NSRect)textRectIfDrawnWithFrame:(NSRect)iconFrame
                        textOnRight:(BOOL)textOnRight
 {
@@ -709,8 +1206,8 @@
   NSRect iconRect;
   NSPoint iconPos;
   NSRect textRect;
-  NSArray *rectArray;
-  unsigned n, count;
+  CSTitleLayout *layout;
+  unsigned n;
   
   iconFrame = NSInsetRect (iconFrame, 2.0, 2.0);
   
@@ -749,27 +1246,26 @@
     textRect.size.height = NSMaxY (iconFrame) - textRect.origin.y - 4.0;
   }
   
-  rectArray = [self titleRectArrayInRect:textRect];
-  count = [rectArray count];
-  for (n = 0; n < count; ++n) {
-    if (NSPointInRect (pt, [[rectArray objectAtIndex:n] rectValue]))
+  layout = [self titleLayoutInRect:textRect];
+  pt.x -= textRect.origin.x;
+  pt.y -= textRect.origin.y;
+  for (n = 0; n < layout->lineCount; ++n) {
+    if (NSPointInRect (pt, layout->lineRects[n]))
       return YES;
   }
   
   return NO;  
 }
 
-- (BOOL)intersectsWithRect:(NSRect)rect
-	  ifDrawnWithFrame:(NSRect)iconFrame
-	       highlighted:(BOOL)highlighted
-	       textOnRight:(BOOL)textOnRight
+- (CSIconHitRegion *)newHitRegionForFrameSize:(NSSize)frameSize
+				  textOnRight:(BOOL)textOnRight
 {
-  NSRect iconRect;
+  NSRect iconFrame = NSMakeRect (0.0, 0.0, frameSize.width, frameSize.height);
+  CSIconHitRegion *region;
   NSPoint iconPos;
   NSRect textRect;
-  NSRect drawRect;
-  NSArray *rectArray;
-  unsigned n, count;
+  CSTitleLayout *layout;
+  unsigned n;
   
   iconFrame = NSInsetRect (iconFrame, 2.0, 2.0);
   
@@ -783,20 +1279,6 @@
 			   NSMinY (iconFrame) + iconSize.height + 2.0);
   }
   
-  iconRect = NSMakeRect (iconPos.x - 2.0, iconPos.y - iconSize.height - 2.0,
-			 iconSize.width + 4.0, iconSize.height + 4.0);
-  drawRect = NSMakeRect (iconPos.x, iconPos.y - iconSize.height,
-			 iconSize.width, iconSize.height);
-
-  if (icon && !highlighted) {
-    if ([icon variant:variant wouldIntersectRect:rect
-	ifDrawnInRect:drawRect])
-      return YES;
-  } else if (highlighted && NSIntersectsRect (rect, iconRect))
-    return YES;
-  else if (NSIntersectsRect (rect, drawRect))
-    return YES;
-  
   if (textOnRight) {
     float height;
     
@@ -816,14 +1298,125 @@
     textRect.size.height = NSMaxY (iconFrame) - textRect.origin.y - 4.0;
   }
   
-  rectArray = [self titleRectArrayInRect:textRect];
-  count = [rectArray count];
-  for (n = 0; n < count; ++n) {
-    if (NSIntersectsRect (rect, [[rectArray objectAtIndex:n] rectValue]))
+  layout = [self titleLayoutInRect:textRect];
+
+  region = (CSIconHitRegion *)malloc (sizeof (CSIconHitRegion)
+				      + (layout->lineCount
+					 ? layout->lineCount - 1 : 0)
+				      * sizeof (NSRect));
+
+  if (!region)
+    return NULL;
+
+  region->iconRect = NSMakeRect (iconPos.x - 2.0,
+				 iconPos.y - iconSize.height - 2.0,
+				 iconSize.width + 4.0, iconSize.height + 4.0);
+  region->drawRect = NSMakeRect (iconPos.x, iconPos.y - iconSize.height,
+				 iconSize.width, iconSize.height);
+  region->mask = nil;
+
+  if (icon) {
+    NSSize pixelSize = NSMakeSize (floor (iconSize.width + 0.5),
+				   floor (iconSize.height + 0.5));
+    NSImage *image = [icon cachedImageForVariant:variant
+					    size:iconSize
+				       pixelSize:pixelSize];
+
+    if (image) {
+      region->mask 
+	= [[[image representations] objectAtIndex:0] retain];
+    }
+  }
+
+  region->lineCount = layout->lineCount;
+  for (n = 0; n < layout->lineCount; ++n) {
+    region->lineRects[n] = NSOffsetRect (layout->lineRects[n],
+					 textRect.origin.x,
+					 textRect.origin.y);
+  }
+
+  return region;
+}
+
+- (BOOL)intersectsWithRect:(NSRect)rect
+	  ifDrawnWithFrame:(NSRect)iconFrame
+	       highlighted:(BOOL)highlighted
+	       textOnRight:(BOOL)textOnRight
+{
+  CSIconHitRegion *region = [self newHitRegionForFrameSize:iconFrame.size
+					       textOnRight:textOnRight];
+  BOOL result;
+
+  if (!region) {
+    [NSException raise:@"CSOutOfMemory"
+		format:@"%@", NSLocalizedString (@"Not enough memory.",
+						 @"Not enough memory.")];
+  }
+
+  result = CSIconHitRegionIntersectsRect (region,
+					  NSOffsetRect (rect,
+							-iconFrame.origin.x,
+							-iconFrame.origin.y),
+					  highlighted);
+
+  CSIconHitRegionFree (region);
+
+  return result;
+}
+
+@end
+
+void
+CSIconHitRegionFree (CSIconHitRegion *region)
+{
+  if (!region)
+    return;
+
+  [region->mask release];
+  free (region);
+}
+
+/* rect is relative to the origin of the icon's frame.  As when drawing, a
+   highlighted icon is surrounded by a solid box; otherwise only the opaque
+   parts of the icon count. */
+BOOL
+CSIconHitRegionIntersectsRect (const CSIconHitRegion *region,
+			       NSRect		     rect,
+			       BOOL		     highlighted)
+{
+  unsigned n;
+
+  if (highlighted) {
+    if (NSIntersectsRect (rect, region->iconRect))
+      return YES;
+  } else if (region->mask) {
+    if ([region->mask rectIntersectsWithImage:
+	   NSOffsetRect (rect,
+			 -region->drawRect.origin.x,
+			 -region->drawRect.origin.y)
+			   withAlphaThreshold:0.1f])
+      return YES;
+  } else if (NSIntersectsRect (rect, region->drawRect))
+    return YES;
+
+  for (n = 0; n < region->lineCount; ++n) {
+    if (NSIntersectsRect (rect, region->lineRects[n]))
       return YES;
   }
-  
+
   return NO;
 }
 
-@end
+BOOL
+CSIconHitRegionTitleContainsPoint (const CSIconHitRegion *region,
+				   NSPoint		 pt)
+{
+  unsigned n;
+
+  for (n = 0; n < region->lineCount; ++n) {
+    if (NSPointInRect (pt, region->lineRects[n]))
+      return YES;
+  }
+
+  return NO;
+}
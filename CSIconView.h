@@ -26,20 +26,30 @@
 
 #import <Cocoa/Cocoa.h>
 #import "CSIconViewItem.h"
+#import "CSIconViewModel.h"
 #import "CSIconRenderer.h"
 #import "CSRectQuadTree.h"
 
-@class CSIconView;
+@class CSIconView, CSTitleIndex;
 
 #define CSIconViewNoItem (~0u)
 
-/* CSIconViewInternalDragData is an NSKeyedArchiver encoded NSDictionary
-   with two keys:
+/* CSIconViewInternalDragData is a compact binary encoding of
 
-     kCSIconView  (= [iconView iconViewUniqueID])
-        Specifies the icon view that initiated this drag operation.
-     kCSIconViewItems  (= [iconView selectedItemIndices])
-        Specifies the indices of the icons being dragged.
+     - the -iconViewUniqueID of the icon view that initiated the drag, and
+     - the indices of the icons being dragged, as a list of ranges,
+
+   so that it stays small however many items are dragged.  Use
+   CSIconViewDecodeDragData() to get at its contents; either of the output
+   pointers may be NULL.  It returns NO for data that is truncated, of the
+   wrong version, or has ranges that run past 2^32 - 1; the indices aren't
+   checked against any particular view.  (kCSIconView and kCSIconViewItems are the keys
+   that were used by the old NSKeyedArchiver format.)
+
+   The data for the types returned by -iconViewPasteboardTypesForDrag: is
+   requested from -iconView:writeItemData:toPasteboard: only when a drop
+   target asks for it, rather than when the drag starts.  It is asked for
+   at most once per drag, so it should write all of those types.
 
    The default handling will automatically deal with internal drag-drops.
    If you implement -iconView:validateDrop:onItemWithIndex:, you should return
@@ -52,6 +62,12 @@ extern NSString * const CSIconViewInternalDragData;
 extern NSString * const kCSIconView;
 extern NSString * const kCSIconViewItems;
 
+extern NSData *CSIconViewEncodeDragData (NSString   *viewID,
+					 NSIndexSet *indices);
+extern BOOL CSIconViewDecodeDragData (NSData	 *data,
+				      NSString	 **viewID,
+				      NSIndexSet **indices);
+
 @interface NSObject (CSIconViewDataSource)
 
 - (unsigned)numberOfItemsInIconView:(CSIconView *)view;
@@ -78,6 +94,53 @@ extern NSString * const kCSIconViewItems;
 
 @end
 
+/* Per-frame statistics, collected if you turn on
+   -setCollectsRenderStatistics:.  Times are in seconds.  The reload and
+   arrange times are for the most recent reload or arrange, which may not
+   have happened during the frame in question. */
+typedef struct {
+  unsigned	  itemsQueried;		// Returned by the quad tree
+  unsigned	  itemsDrawn;
+  unsigned	  itemsCulled;		// Queried, but not drawn
+  unsigned	  itemsReduced;		// Drawn at reduced or minimal detail
+  unsigned	  itemsFromTiles;	// Composited from rendered tiles
+  unsigned	  itemsPending;		// Placeholders for tiles not yet ready
+  unsigned	  titleLayouts;		// Title layouts actually performed
+  unsigned	  titleLayoutCacheHits;
+
+  NSTimeInterval  frameTime;		// The whole of -drawRect:
+  NSTimeInterval  queryTime;		// Finding the items to draw
+  NSTimeInterval  itemDrawTime;		// Drawing them
+  NSTimeInterval  overlayTime;		// Rubber band and focus ring
+  NSTimeInterval  reloadTime;
+  NSTimeInterval  arrangeTime;
+} CSIconViewRenderStatistics;
+
+/* Trace events; begin and end events always come in pairs.  The trace
+   function is called on whichever thread is drawing, and should be quick.
+   When no trace function is set, tracing costs a single test and branch. */
+typedef enum {
+  CSIconViewTraceBeginFrame,
+  CSIconViewTraceEndFrame,
+  CSIconViewTraceBeginReload,
+  CSIconViewTraceEndReload,
+  CSIconViewTraceBeginArrange,
+  CSIconViewTraceEndArrange,
+  CSIconViewTraceBeginQuery,
+  CSIconViewTraceEndQuery,
+  CSIconViewTraceBeginDrawItems,
+  CSIconViewTraceEndDrawItems,
+  CSIconViewTraceBeginRenderTiles,	// On a background thread
+  CSIconViewTraceEndRenderTiles
+} CSIconViewTraceEvent;
+
+typedef void (*CSIconViewTraceFunction)(CSIconView	     *view,
+					CSIconViewTraceEvent event,
+					void		     *context);
+
+extern void CSIconViewSetTraceFunction (CSIconViewTraceFunction function,
+					void			*context);
+
 extern NSString * const CSIconViewDidBeginEditingNotification;
 extern NSString * const CSIconViewTextDidChangeNotification;
 extern NSString * const CSIconViewDidEndEditingNotification;
@@ -93,6 +156,10 @@ extern NSString * const kCSIconViewItem;
 - (void)iconViewTextDidChange:(NSNotification *)aNotification;
 - (void)iconViewDidEndEditing:(NSNotification *)aNotification;
 
+/* Only sent if you've turned on -setCollectsRenderStatistics: */
+- (void)iconView:(CSIconView *)view
+    didFinishFrameWithStatistics:(CSIconViewRenderStatistics)statistics;
+
 @end
 
 typedef enum
@@ -133,6 +200,7 @@ typedef enum {
   NSUInteger                draggingSourceMask;
 
   NSMutableArray	    *items;
+  struct CSIconViewItemStore *itemStore;
   CSRectQuadTree	    *quadTree;
   NSMutableSet		    *selectedItems;
   NSMutableIndexSet         *selectedItemIndices;
@@ -163,7 +231,6 @@ typedef enum {
   BOOL			    needsArrange;
   BOOL			    needsReload;
   BOOL			    doingArrange;
-  BOOL			    drawOnlySelected;
   
   BOOL                      drawsFocusRing;
   CSIconViewItem            *focusedItem;
@@ -175,6 +242,7 @@ typedef enum {
   
   IBOutlet id		    dataSource;
   IBOutlet id               delegate;
+  CSIconViewModel	    *model;
   
   IBOutlet id               target;
   SEL                       action;
@@ -184,6 +252,41 @@ typedef enum {
   BOOL                      delegateSupportsDidEndEditing;
   
   NSTimer		    *autoscrollTimer;
+
+  BOOL			    collectsRenderStatistics;
+  CSIconViewRenderStatistics renderStatistics;
+
+  CSTitleIndex		    *titleIndex;
+  BOOL			    titleIndexIsValid;
+  NSMutableString	    *typeSelectString;
+  NSTimeInterval	    lastTypeSelectTime;
+
+  NSString		    *arrangeKey;
+  BOOL			    arrangesAscending;
+  BOOL			    arrangeOrderIsValid;
+  unsigned		    *arrangeOrder;
+
+  unsigned		    updateDepth;
+  NSMutableSet		    *pendingInsertions;
+  NSRect		    updateDirtyRect;
+
+  BOOL			    usesReducedDetail;
+  BOOL			    isLiveScrolling;
+  unsigned		    reducedDetailItemThreshold;
+  NSRect		    reducedDetailRect;
+
+  NSIndexSet		    *dragItemIndices;
+  BOOL			    providedDragItemData;
+
+  BOOL			    rendersAsynchronously;
+  BOOL			    isRenderingTiles;
+  CGFloat		    tileScale;
+  unsigned		    tileGeneration;
+  NSMutableDictionary	    *tileCache;
+  NSMutableArray	    *tileQueue;
+  NSMutableSet		    *pendingTiles;
+  NSMutableSet		    *visibleTiles;
+  NSRect		    pendingTileRect;
 }
 
 - (NSSize)maxDragImageSize;
@@ -222,15 +325,64 @@ typedef enum {
 - (id)dataSource;
 - (void)setDataSource:(id)newSource;
 
+/* A view attached to a model gets its items from the model rather than
+   from its data source, and follows the model's changes automatically.
+   The model is retained. */
+- (CSIconViewModel *)model;
+- (void)setModel:(CSIconViewModel *)newModel;
+
 - (BOOL)needsArrange;
 - (void)setNeedsArrange:(BOOL)needsArrange;
 
 - (NSSet *)itemsInRect:(NSRect)rect;
 
+/* An immutable copy of the view's spatial index, which background threads
+   can query while the view carries on.  Call this on the main thread.
+   After a change, only the parts of the index that changed are copied
+   again (see -[CSRectQuadTree snapshot]). */
+- (CSRectQuadTreeSnapshot *)snapshotOfItems;
+
 - (void)reloadItemAtIndex:(unsigned)ndx;
 - (void)reloadItems;
 - (void)arrangeItems;
 
+/* Incremental updates.  As with NSTableView, call these after changing the
+   data source.  Insertion indices are in terms of the data source after
+   the change, removal indices in terms of the view before it.  Bracket a
+   series of changes with -beginUpdates and -endUpdates and the quad tree
+   insertions, re-arranging and redisplay are coalesced and done once, at
+   the outermost -endUpdates. */
+- (void)beginUpdates;
+- (void)endUpdates;
+#if NS_BLOCKS_AVAILABLE
+- (void)performBatchUpdates:(void (^)(void))updates;
+#endif
+- (void)insertItemsAtIndexes:(NSIndexSet *)indexes;
+- (void)removeItemsAtIndexes:(NSIndexSet *)indexes;
+- (void)moveItemAtIndex:(unsigned)fromIndex toIndex:(unsigned)toIndex;
+
+/* Arranges the items sorted by the value of the specified key path on each
+   item (e.g. @"title"), rather than in index order.  Strings sort ignoring
+   case and diacritics, with embedded numbers compared numerically; other
+   values must respond to -compare:.  The order sticks, and is recomputed
+   when the items are reloaded; pass nil to go back to index order. */
+- (void)arrangeItemsByKey:(NSString *)keyPath ascending:(BOOL)ascending;
+- (NSString *)arrangeKey;
+- (BOOL)arrangesAscending;
+
+/* Layout snapshots hold the position, custom size and persistent state
+   bits of each item in fixed-width binary records, so that a free-form
+   layout can be saved and put back without a round trip through the data
+   source.  Restoring applies the records to the items currently in the
+   view, by index, ignoring any for indices the view doesn't have, and
+   returns NO if the snapshot is truncated, corrupt or of the wrong
+   version.  Snapshot files are memory mapped when read. */
+- (NSData *)layoutSnapshot;
+- (BOOL)restoreLayoutFromSnapshot:(NSData *)snapshot;
+- (BOOL)writeLayoutSnapshotToFile:(NSString *)path error:(NSError **)error;
+- (BOOL)restoreLayoutFromSnapshotFile:(NSString *)path
+				error:(NSError **)error;
+
 - (NSSet *)selectedItems;
 - (NSIndexSet *)selectedItemIndices;
 - (void)selectItem:(CSIconViewItem *)item;
@@ -246,6 +398,11 @@ typedef enum {
 - (BOOL)drawsFocusRing;
 - (void)setDrawsFocusRing:(BOOL)dfr;
 
+/* Type-ahead selection; selects, focuses and scrolls to the first item
+   (in title order) whose title starts with the specified prefix, ignoring
+   case and diacritics.  Returns NO if there was no such item. */
+- (BOOL)selectItemWithTitlePrefix:(NSString *)prefix;
+
 - (void)autoscrollOnTimer:(NSTimer *)timer;
 
 - (NSImage *)imageOfSelectedItems;
@@ -254,6 +411,36 @@ typedef enum {
 - (NSRect)boundingRectOfItem:(CSIconViewItem *)item;
 - (NSRect)boundingRectOfItems:(id)collection;
 
+- (BOOL)collectsRenderStatistics;
+- (void)setCollectsRenderStatistics:(BOOL)collects;
+- (CSIconViewRenderStatistics)renderStatistics;
+
+/* Level of detail.  If this is turned on, items are drawn with thumbnail
+   icons and approximate titles (see CSIconDetailLevel) while the enclosing
+   scroll view is scrolling, or when more than the threshold number of
+   items need drawing at once; the parts of the view that were drawn like
+   that are redrawn in full once scrolling stops.  Titles are left out
+   altogether when they would be too small to read.  Off by default. */
+- (BOOL)usesReducedDetail;
+- (void)setUsesReducedDetail:(BOOL)reduce;
+- (unsigned)reducedDetailItemThreshold;
+- (void)setReducedDetailItemThreshold:(unsigned)threshold;
+
+/* Asynchronous rendering.  If this is turned on, items are rendered into
+   cached tiles on a background thread, spread across the available CPUs,
+   and -drawRect: just composites the tiles, drawing reduced detail
+   placeholders for any that aren't ready yet.  A handful of missing tiles
+   are simply drawn there and then.  Text in tiles is antialiased without
+   subpixel rendering.  Off by default.
+
+   Tiles are matched to items by what they would draw, so they don't need
+   invalidating when items change; but icons are compared by identity, so
+   call -discardRenderedTiles if you change the images of an icon that is
+   already on show. */
+- (BOOL)rendersAsynchronously;
+- (void)setRendersAsynchronously:(BOOL)async;
+- (void)discardRenderedTiles;
+
 - (NSString *)iconViewUniqueID;
 - (BOOL)handleSimpleDrag:(id <NSDraggingInfo>)sender;
 
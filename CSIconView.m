@@ -25,14 +25,60 @@
 //
 
 #import "CSIconView.h"
+#import "CSIconViewItemStore.h"
+#import "CSTitleIndex.h"
+#import "CSParallel.h"
 #import "NSColor+CSIconViewExtras.h"
+#import "NSBitmapImageRep+CSIconViewExtras.h"
 #import "NSSet+CSSetOperations.h"
 #import "NSMutableSet+CSSymmetricDifference.h"
 
 #import <sys/types.h>
 #import <unistd.h>
+#import <objc/runtime.h>
+
+#if __APPLE__
+#import <mach/mach_time.h>
+#define HAVE_MACH_TIME 1
+#else
+#define HAVE_MACH_TIME 0
+#endif
 
 #define FADE_DISTANCE   128
+
+/* Scrolling is considered to have stopped when the clip view hasn't moved
+   for this long */
+#define LIVE_SCROLL_SETTLE_TIME	    0.15
+
+/* The default number of items above which we draw at reduced detail */
+#define REDUCED_DETAIL_ITEM_THRESHOLD	500
+
+/* Titles whose font would be less than this many points high in the
+   window aren't worth drawing */
+#define MIN_LEGIBLE_TITLE_HEIGHT    4.0
+
+/* Rendered tiles have this much room around the item's frame, for the
+   focus ring around labelled titles */
+#define TILE_MARGIN		    4.0
+
+/* With asynchronous rendering, fewer missing tiles than this are just
+   drawn there and then; it isn't worth the trip to another thread */
+#define ASYNC_TILE_THRESHOLD	    32
+
+/* We keep at least this many rendered tiles, or TILE_CACHE_SCREENS times
+   as many as are on show if that's more.  The tiles on show cover about
+   the visible area between them, so the cache holds a couple of screens'
+   worth of pixels however small the icons are. */
+#define MIN_CACHED_TILES	    2048
+#define TILE_CACHE_SCREENS	    2
+
+/* Tiles are handed out to the workers in this many chunks per CPU, which
+   evens out the load without making lots of renderers */
+#define TILE_CHUNKS_PER_CPU	    4
+
+/* How long to wait between keystrokes before starting a new type-ahead
+   search */
+#define TYPE_SELECT_TIMEOUT 1.0
 #define UNUSED(x)       ((void)(x))
 
 static NSDictionary *blackTextAttributes;
@@ -58,9 +104,61 @@ NSString * const kCSIconViewFieldEditor
 NSString * const kCSIconViewItem
   = @"kCSIconViewItem";
 
+static CSIconViewTraceFunction traceFunction;
+static void *traceContext;
+
+#define TRACE(event)						\
+  do {								\
+    if (__builtin_expect (traceFunction != NULL, 0))		\
+      traceFunction (self, (event), traceContext);		\
+  } while (0)
+
+void
+CSIconViewSetTraceFunction (CSIconViewTraceFunction function, void *context)
+{
+  traceFunction = NULL;
+  traceContext = context;
+  traceFunction = function;
+}
+
+/* A monotonic clock where we have one, for the render statistics */
+static NSTimeInterval
+currentTime (void)
+{
+#if HAVE_MACH_TIME
+  static double scale;
+
+  if (!scale) {
+    mach_timebase_info_data_t timebase;
+
+    mach_timebase_info (&timebase);
+    scale = 1e-9 * timebase.numer / timebase.denom;
+  }
+
+  return mach_absolute_time () * scale;
+#else
+  return [NSDate timeIntervalSinceReferenceDate];
+#endif
+}
+
 @interface CSIconView (Internal)
 
 - (void)reloadQuadTree;
+- (BOOL)isItemAtIndexHighlighted:(unsigned)ndx;
+- (CSIconDrawDescription *)drawDescriptionOfItemAtIndex:(unsigned)ndx
+                                            highlighted:(BOOL)selected
+                                              inKeyView:(BOOL)isKeyView;
+- (void)drawItemAtIndex:(unsigned)ndx
+            highlighted:(BOOL)selected
+              inKeyView:(BOOL)isKeyView;
+- (void)drawTiledItems:(NSSet *)renderItems inKeyView:(BOOL)isKeyView;
+- (void)startRenderingTiles;
+- (void)resetTiles;
+- (void)invalidateHitRegions;
+- (const CSIconHitRegion *)hitRegionOfItemAtIndex:(unsigned)ndx;
+- (BOOL)itemAtIndex:(unsigned)ndx intersectsRect:(NSRect)rect;
+- (const unsigned *)arrangeOrder;
+- (void)commitUpdates;
 - (NSImage *)dragImageFadeImage;
 - (NSImage *)draggingImageForSelectedItemsAroundPoint:(NSPoint)point
                                       representedRect:(NSRect *)repRect;
@@ -68,6 +166,9 @@ NSString * const kCSIconViewItem
 - (void)unregisterDelegateNotifications;
 - (void)registerDelegateNotifications;
 
+- (unsigned)numberOfSourceItems;
+- (CSIconViewItem *)sourceItemAtIndex:(unsigned)ndx;
+
 @end
 
 @implementation CSIconView
@@ -137,6 +238,7 @@ NSString * const kCSIconViewItem
     [self setFont:[NSFont systemFontOfSize:12]];
     
     items = [[NSMutableArray alloc] init];
+    itemStore = CSIconViewItemStoreCreate ();
     selectedItems = [[NSMutableSet alloc] init];
     selectedItemIndices = [[NSMutableIndexSet alloc] init];
     dragSelectedItems = [[NSMutableSet alloc] init];
@@ -149,6 +251,7 @@ NSString * const kCSIconViewItem
     
     needsReload = YES;
     needsArrange = YES;
+    reducedDetailItemThreshold = REDUCED_DETAIL_ITEM_THRESHOLD;
     
     // Watch for system colour changes
     [[NSNotificationCenter defaultCenter] 
@@ -223,6 +326,7 @@ static NSString * const kFont = @"kFont";
     }
 
     items = [[NSMutableArray alloc] init];
+    itemStore = CSIconViewItemStoreCreate ();
     selectedItems = [[NSMutableSet alloc] init];
     selectedItemIndices = [[NSMutableIndexSet alloc] init];
     dragSelectedItems = [[NSMutableSet alloc] init];
@@ -235,6 +339,7 @@ static NSString * const kFont = @"kFont";
     
     needsReload = YES;
     needsArrange = autoArrangesItems;
+    reducedDetailItemThreshold = REDUCED_DETAIL_ITEM_THRESHOLD;
 
     // Watch for system colour changes
     [[NSNotificationCenter defaultCenter] 
@@ -298,6 +403,7 @@ static NSString * const kFont = @"kFont";
   [[NSNotificationCenter defaultCenter] removeObserver:self];
   
   [dragImageFadeImage release];
+  CSIconViewItemStoreDestroy (itemStore);
   [items release];
   [selectedItems release];
   [selectedItemIndices release];
@@ -308,8 +414,19 @@ static NSString * const kFont = @"kFont";
   [darkTextAttributes release];
   [lightTextAttributes release];
   [quadTree release];
+  [titleIndex release];
+  [typeSelectString release];
+  [arrangeKey release];
+  free (arrangeOrder);
+  [pendingInsertions release];
   [deselectOnMouseUp release];
   [editOnMouseUp release];
+  [model release];
+  [dragItemIndices release];
+  [tileCache release];
+  [tileQueue release];
+  [pendingTiles release];
+  [visibleTiles release];
   [super dealloc];
 }
 
@@ -406,6 +523,11 @@ static NSString * const kFont = @"kFont";
   
   NSWindow *oldWindow = [self window];
   
+  [[NSNotificationCenter defaultCenter]
+    removeObserver:self
+              name:NSViewBoundsDidChangeNotification
+            object:nil];
+
   if (oldWindow) {
     [[NSNotificationCenter defaultCenter] 
       removeObserver:self
@@ -421,6 +543,15 @@ static NSString * const kFont = @"kFont";
 - (void)viewDidMoveToWindow
 {
   NSWindow *window = [self window];
+  NSClipView *clipView = [[self enclosingScrollView] contentView];
+  
+  if (clipView) {
+    [[NSNotificationCenter defaultCenter]
+      addObserver:self
+         selector:@selector(clipViewBoundsChanged:)
+             name:NSViewBoundsDidChangeNotification
+           object:clipView];
+  }
   
   [[NSNotificationCenter defaultCenter]
     addObserver:self
@@ -434,6 +565,37 @@ static NSString * const kFont = @"kFont";
          object:window];
 }
 
+/* There's no notification for the end of a scroll, so we wait until the
+   clip view has been still for a moment */
+- (void)clipViewBoundsChanged:(NSNotification *)aNotification
+{
+  UNUSED (aNotification);
+
+  if (!usesReducedDetail)
+    return;
+
+  isLiveScrolling = YES;
+  [NSObject cancelPreviousPerformRequestsWithTarget:self
+                                           selector:@selector(liveScrollDidEnd)
+                                             object:nil];
+  [self performSelector:@selector(liveScrollDidEnd)
+             withObject:nil
+             afterDelay:LIVE_SCROLL_SETTLE_TIME];
+}
+
+/* Redraw whatever we drew at reduced detail that's still visible */
+- (void)liveScrollDidEnd
+{
+  NSRect refineRect = NSIntersectionRect (reducedDetailRect,
+                                          [self visibleRect]);
+
+  isLiveScrolling = NO;
+  reducedDetailRect = NSZeroRect;
+
+  if (!NSIsEmptyRect (refineRect))
+    [self setNeedsDisplayInRect:refineRect];
+}
+
 - (void)keyWindowChanged:(NSNotification *)aNotification
 {
   UNUSED (aNotification);
@@ -446,6 +608,8 @@ static NSString * const kFont = @"kFont";
 {
   UNUSED (aNotification);
   
+  // Rendered tiles have the old highlight colours in them
+  [self resetTiles];
   [self setNeedsDisplay:YES];
 }
 
@@ -526,8 +690,132 @@ static NSString * const kFont = @"kFont";
   }
 }
 
+/* Whether the item should be drawn highlighted, allowing for a rubber band
+   selection in progress */
+- (BOOL)isItemAtIndexHighlighted:(unsigned)ndx
+{
+  BOOL selected = (itemStore->states[ndx] & kCSIVItemSelectedMask) ? YES : NO;
+
+  if (dragging && [dragSelectedItems containsObject:itemStore->items[ndx]])
+    selected = !selected;
+
+  return selected;
+}
+
+/* Captures everything needed to draw an item, so that it can be drawn by
+   any renderer, on any thread */
+- (CSIconDrawDescription *)drawDescriptionOfItemAtIndex:(unsigned)ndx
+                                            highlighted:(BOOL)selected
+                                              inKeyView:(BOOL)isKeyView
+{
+  CSIconViewItem *item = itemStore->items[ndx];
+  unsigned itemState = itemStore->states[ndx];
+  NSColor *labelColor = nil, *labelShadeColor = nil;
+  NSDictionary *attributes;
+  NSString *variant;
+  NSSize itemIconSize, frameSize;
+  unsigned flags = 0;
+  
+  if (itemState & kCSIVItemLabelledMask) {
+    labelColor = [item labelColor];
+    labelShadeColor = [item labelShadeColor];
+    
+    if (!labelShadeColor) {
+      labelShadeColor
+        = [labelColor blendedColorWithFraction:0.8
+                                       ofColor:[NSColor whiteColor]];
+    }
+  }
+  
+  if (allowsCustomSizes && (itemState & kCSIVItemCustomSizeMask))
+    itemIconSize = itemStore->customIconSizes[ndx];
+  else
+    itemIconSize = iconSize;
+  
+  if (itemState & kCSIVItemDisabledMask) {
+    attributes = mediumTextAttributes;
+  } else if (itemState & kCSIVItemLabelledMask) {
+    if ([item labelColorIsLight])
+      attributes = darkTextAttributes;
+    else
+      attributes = lightTextAttributes;
+  } else if (selected) {
+    if (!isKeyView)
+      attributes = mediumTextAttributes;
+    else
+      attributes = lightTextAttributes;
+  } else {
+    attributes = darkTextAttributes;
+  }
+  
+  if (itemState & kCSIVItemOpenMask)
+    variant = kCSOpenIconVariant;
+  else if (itemState & kCSIVItemAcceptingDropMask)
+    variant = kCSDropIconVariant;
+  else
+    variant = kCSNormalIconVariant;
+
+  frameSize = CSIconViewItemStoreSizeAtIndex (itemStore, ndx, gridSize,
+                                              allowsCustomSizes);
+
+  if (!(itemState & kCSIVItemDisabledMask))
+    flags |= CSIconDrawEnabled;
+  if ([self labelPosition] == CSLabelPositionRight)
+    flags |= CSIconDrawTextOnRight;
+  if (!isEditing || item != editingItem)
+    flags |= CSIconDrawWithText;
+
+  /* The highlight style and key state only make a difference to highlighted
+     items; leaving them out otherwise means that rendered tiles survive
+     focus changes */
+  if (selected) {
+    flags |= CSIconDrawHighlighted;
+    if ([self isOpaque])
+      flags |= CSIconDrawFilledHighlight;
+    if (isKeyView)
+      flags |= CSIconDrawInKeyView;
+  }
+
+  return [[[CSIconDrawDescription alloc] initWithIcon:[item icon]
+                                              variant:variant
+                                                title:[item title]
+                                           attributes:attributes
+                                           labelColor:labelColor
+                                           shadeColor:labelShadeColor
+                                             iconSize:itemIconSize
+                                            frameSize:frameSize
+                                                flags:flags] autorelease];
+}
+
+/* Draws a single item, in the current graphics context, in view
+   co-ordinates */
+- (void)drawItemAtIndex:(unsigned)ndx
+            highlighted:(BOOL)selected
+              inKeyView:(BOOL)isKeyView
+{
+  [renderer drawDescription:[self drawDescriptionOfItemAtIndex:ndx
+                                                   highlighted:selected
+                                                     inKeyView:isKeyView]
+                    atPoint:itemStore->positions[ndx]];
+}
+
 - (void)drawRect:(NSRect)rect
 {
+  NSTimeInterval frameStart = 0.0, phaseStart = 0.0;
+  
+  TRACE (CSIconViewTraceBeginFrame);
+
+  if (collectsRenderStatistics) {
+    NSTimeInterval reloadTime = renderStatistics.reloadTime;
+    NSTimeInterval arrangeTime = renderStatistics.arrangeTime;
+
+    memset (&renderStatistics, 0, sizeof (renderStatistics));
+    renderStatistics.reloadTime = reloadTime;
+    renderStatistics.arrangeTime = arrangeTime;
+    [renderer resetStatistics];
+    frameStart = currentTime ();
+  }
+
   if (needsReload) {
     needsReload = NO;
     [self reloadItems];
@@ -541,87 +829,72 @@ static NSString * const kFont = @"kFont";
       gridWidth = 1;
   }
   
+  TRACE (CSIconViewTraceBeginQuery);
+  if (collectsRenderStatistics)
+    phaseStart = currentTime ();
+
   NSSet *renderItems = [quadTree objectsIntersectingRect:rect];
   NSEnumerator *itemEnum = [renderItems objectEnumerator];
   CSIconViewItem *item;
-  BOOL selected;
   BOOL isKeyView = ([[self window] isKeyWindow]
                     && [[self window] firstResponder] == self);
+  CSIconDetailLevel detailLevel = CSIconDetailFull;
+
+  if (collectsRenderStatistics) {
+    NSTimeInterval now = currentTime ();
+    
+    renderStatistics.queryTime = now - phaseStart;
+    renderStatistics.itemsQueried = [renderItems count];
+    phaseStart = now;
+  }
+  TRACE (CSIconViewTraceEndQuery);
+
+  if (usesReducedDetail) {
+    CGFloat titleHeight = [self convertSize:NSMakeSize (0.0, [font pointSize])
+                                     toView:nil].height;
+
+    if (fabs (titleHeight) < MIN_LEGIBLE_TITLE_HEIGHT)
+      detailLevel = CSIconDetailMinimal;
+    else if (isLiveScrolling
+             || [renderItems count] > reducedDetailItemThreshold)
+      detailLevel = CSIconDetailReduced;
+
+    // Only the scroll case gets refined; otherwise we'd just do it again
+    if (detailLevel != CSIconDetailFull && isLiveScrolling)
+      reducedDetailRect = NSUnionRect (reducedDetailRect, rect);
+  }
+
+  [renderer setDetailLevel:detailLevel];
   
   [backgroundColor set];
   NSRectFill (rect);
 
-  while ((item = [itemEnum nextObject])) {
-    NSPoint pos = [item position];
-    NSRect frame = NSMakeRect (pos.x, pos.y,
-			       gridSize.width, gridSize.height);
-    unsigned itemState = [item state];
-    
-    if (itemState & kCSIVItemLabelledMask) {
-      NSColor *labelColor = [item labelColor];
-      NSColor *labelShadeColor = [item labelShadeColor];
-      
-      if (!labelShadeColor) {
-	labelShadeColor
-	  = [labelColor blendedColorWithFraction:0.8
-					 ofColor:[NSColor whiteColor]];
-      }
-      
-      [renderer setLabelColor:labelColor];
-      [renderer setLabelShadeColor:labelShadeColor];
-    } else {
-      [renderer setLabelColor:nil];
-      [renderer setLabelShadeColor:nil];
-    }
-    
-    if (allowsCustomSizes && (itemState & kCSIVItemCustomSizeMask)) {
-      [renderer setIconSize:[item customIconSize]];
-      frame.size = [item customSize];
-    } else {
-      [renderer setIconSize:iconSize];
-    }
-    
-    [renderer setIcon:[item icon]];
-    [renderer setTitle:[item title]];
-    
-    selected = (itemState & kCSIVItemSelectedMask) ? YES : NO;
-    
-    if (dragging && [dragSelectedItems containsObject:item])
-      selected = !selected;
-    
-    if (drawOnlySelected && !selected)
-      continue;
+  TRACE (CSIconViewTraceBeginDrawItems);
+  if (rendersAsynchronously && detailLevel == CSIconDetailFull) {
+    [self drawTiledItems:renderItems inKeyView:isKeyView];
+  } else {
+    while ((item = [itemEnum nextObject])) {
+      unsigned ndx = [item index];
     
-    if (itemState & kCSIVItemDisabledMask) {
-      [renderer setTitleAttributes:mediumTextAttributes];
-    } else if (itemState & kCSIVItemLabelledMask) {
-      if ([item labelColorIsLight])
-	[renderer setTitleAttributes:darkTextAttributes];
-      else
-	[renderer setTitleAttributes:lightTextAttributes];
-    } else if (selected) {
-      if (!isKeyView)
-        [renderer setTitleAttributes:mediumTextAttributes];
-      else
-        [renderer setTitleAttributes:lightTextAttributes];
-    } else {
-      [renderer setTitleAttributes:darkTextAttributes];
+      [self drawItemAtIndex:ndx
+                highlighted:[self isItemAtIndexHighlighted:ndx]
+                  inKeyView:isKeyView];
+
+      ++renderStatistics.itemsDrawn;
     }
+  }
+  TRACE (CSIconViewTraceEndDrawItems);
+
+  if (detailLevel != CSIconDetailFull) {
+    renderStatistics.itemsReduced = renderStatistics.itemsDrawn;
+    [renderer setDetailLevel:CSIconDetailFull];
+  }
+
+  if (collectsRenderStatistics) {
+    NSTimeInterval now = currentTime ();
     
-    if (itemState & kCSIVItemOpenMask)
-      [renderer setVariant:kCSOpenIconVariant];
-    else if (itemState & kCSIVItemAcceptingDropMask)
-      [renderer setVariant:kCSDropIconVariant];
-    else
-      [renderer setVariant:kCSNormalIconVariant];
-    
-    [renderer drawWithFrame:frame
-		    enabled:!(itemState & kCSIVItemDisabledMask)
-		highlighted:selected
-	    filledHighlight:[self isOpaque]
-		textOnRight:[self labelPosition] == CSLabelPositionRight
-                  inKeyView:isKeyView
-                   withText:!isEditing || item != editingItem];
+    renderStatistics.itemDrawTime = now - phaseStart;
+    phaseStart = now;
   }
 
   if (dragging) {
@@ -689,6 +962,24 @@ static NSString * const kFont = @"kFont";
   
   /* Uncomment this to see the quadtree */
   // [quadTree stroke];
+
+  if (collectsRenderStatistics) {
+    NSTimeInterval now = currentTime ();
+    
+    renderStatistics.overlayTime = now - phaseStart;
+    renderStatistics.frameTime = now - frameStart;
+    renderStatistics.itemsCulled = (renderStatistics.itemsQueried
+                                    - renderStatistics.itemsDrawn);
+    renderStatistics.titleLayouts = [renderer titleLayoutsPerformed];
+    renderStatistics.titleLayoutCacheHits = [renderer titleLayoutCacheHits];
+
+    if ([delegate respondsToSelector:
+         @selector(iconView:didFinishFrameWithStatistics:)]) {
+      [delegate iconView:self didFinishFrameWithStatistics:renderStatistics];
+    }
+  }
+
+  TRACE (CSIconViewTraceEndFrame);
 }
 
 - (NSSize)maxDragImageSize
@@ -714,6 +1005,7 @@ static NSString * const kFont = @"kFont";
 - (void)setGridSize:(NSSize)newSize
 {
   gridSize = newSize;
+  [self invalidateHitRegions];
 }
 
 - (NSSize)iconSize
@@ -724,6 +1016,7 @@ static NSString * const kFont = @"kFont";
 - (void)setIconSize:(NSSize)newSize
 {
   iconSize = newSize;
+  [self invalidateHitRegions];
 }
 
 - (NSFont *)font
@@ -749,6 +1042,10 @@ static NSString * const kFont = @"kFont";
     
     [mediumTextAttributes setObject:font forKey:NSFontAttributeName];
     [lightTextAttributes setObject:font forKey:NSFontAttributeName];
+
+    // None of the rendered tiles will match any more
+    [self resetTiles];
+    [self invalidateHitRegions];
   }
 }
 
@@ -801,6 +1098,9 @@ static NSString * const kFont = @"kFont";
     [lightTextAttributes setObject:centeredStyle 
 			    forKey:NSParagraphStyleAttributeName];
   }
+
+  [self resetTiles];
+  [self invalidateHitRegions];
 }
 
 - (BOOL)snapsToGrid
@@ -840,6 +1140,7 @@ static NSString * const kFont = @"kFont";
 - (void)setAllowsCustomSizes:(BOOL)allows
 {
   allowsCustomSizes = allows;
+  [self invalidateHitRegions];
 }
 
 - (void)updateDragAndDropTypeRegistration
@@ -908,6 +1209,100 @@ static NSString * const kFont = @"kFont";
   [self updateDragAndDropTypeRegistration];
 }
 
+- (CSIconViewModel *)model
+{
+  return model;
+}
+
+- (void)setModel:(CSIconViewModel *)newModel
+{
+  NSNotificationCenter *center = [NSNotificationCenter defaultCenter];
+
+  if (model == newModel)
+    return;
+
+  if (model) {
+    [center removeObserver:self
+                      name:CSIconViewModelDidReloadNotification
+                    object:model];
+    [center removeObserver:self
+                      name:CSIconViewModelItemDidChangeNotification
+                    object:model];
+    [center removeObserver:self
+                      name:CSIconViewModelDidInsertItemsNotification
+                    object:model];
+    [center removeObserver:self
+                      name:CSIconViewModelDidRemoveItemsNotification
+                    object:model];
+    [model release];
+  }
+
+  model = [newModel retain];
+
+  if (model) {
+    [center addObserver:self
+               selector:@selector(modelDidReload:)
+                   name:CSIconViewModelDidReloadNotification
+                 object:model];
+    [center addObserver:self
+               selector:@selector(modelItemDidChange:)
+                   name:CSIconViewModelItemDidChangeNotification
+                 object:model];
+    [center addObserver:self
+               selector:@selector(modelDidInsertItems:)
+                   name:CSIconViewModelDidInsertItemsNotification
+                 object:model];
+    [center addObserver:self
+               selector:@selector(modelDidRemoveItems:)
+                   name:CSIconViewModelDidRemoveItemsNotification
+                 object:model];
+  }
+
+  [renderer setTitleLayoutCache:[model titleLayoutCache]];
+  [self reloadItems];
+}
+
+- (void)modelDidReload:(NSNotification *)notification
+{
+  UNUSED (notification);
+  [self reloadItems];
+}
+
+- (void)modelItemDidChange:(NSNotification *)notification
+{
+  [self reloadItemAtIndex:[[[notification userInfo]
+                             objectForKey:kCSIconViewModelItemIndex]
+                            unsignedIntValue]];
+}
+
+- (void)modelDidInsertItems:(NSNotification *)notification
+{
+  [self insertItemsAtIndexes:[[notification userInfo]
+                               objectForKey:kCSIconViewModelItemIndexes]];
+}
+
+- (void)modelDidRemoveItems:(NSNotification *)notification
+{
+  [self removeItemsAtIndexes:[[notification userInfo]
+                               objectForKey:kCSIconViewModelItemIndexes]];
+}
+
+/* Views attached to a model each have their own copies of the model's
+   items, since an item's position and state belong to a single view */
+- (unsigned)numberOfSourceItems
+{
+  if (model)
+    return [model numberOfItems];
+  return [dataSource numberOfItemsInIconView:self];
+}
+
+- (CSIconViewItem *)sourceItemAtIndex:(unsigned)ndx
+{
+  if (model)
+    return [[[model itemAtIndex:ndx] copy] autorelease];
+  return [dataSource iconView:self itemAtIndex:ndx];
+}
+
 - (NSArray *)items
 {
   return items;
@@ -916,26 +1311,31 @@ static NSString * const kFont = @"kFont";
 - (void)reloadItemAtIndex:(unsigned)ndx
 {
   CSIconViewItem *currentItem = [items objectAtIndex:ndx];
-  NSPoint itemPos = [currentItem position];
-  CSIconViewItem *newItem = [dataSource iconView:self itemAtIndex:ndx];
-  NSSize itemSize;
-  NSRect itemRect;
-  unsigned itemState = [currentItem state];
-  
-  if (itemState & kCSIVItemCustomSizeMask)
-    itemSize = [currentItem customSize];
-  else
-    itemSize = gridSize;
-  
-  itemRect = NSMakeRect (itemPos.x, itemPos.y,
-                         itemSize.width, itemSize.height);
+  CSIconViewItem *newItem = [self sourceItemAtIndex:ndx];
+  NSRect itemRect = CSIconViewItemStoreFrameAtIndex (itemStore, ndx, gridSize,
+                                                     allowsCustomSizes);
+  NSPoint itemPos = itemRect.origin;
+  /* An item inserted during the current batch isn't in the quad tree yet;
+     -commitUpdates will add whatever is in its slot by then */
+  BOOL isPending = [pendingInsertions containsObject:currentItem];
   
   [self setNeedsDisplayInRect:NSInsetRect (itemRect, -2.0, -2.0)];
   
   if (isEditing)
     [[self window] makeFirstResponder:self];
   
+  if (isPending) {
+    [pendingInsertions removeObject:currentItem];
+    [pendingInsertions addObject:newItem];
+  } else
+    [quadTree removeObject:currentItem inRect:itemRect];
+
   if (currentItem != newItem) {
+    [currentItem retain];
+    [items replaceObjectAtIndex:ndx withObject:newItem];
+    [currentItem detachFromStore];
+    [newItem attachToStore:itemStore atIndex:ndx];
+
     if ([selectedItems containsObject:currentItem]) {
       [selectedItems removeObject:currentItem];
       [selectedItems addObject:newItem];
@@ -944,90 +1344,319 @@ static NSString * const kFont = @"kFont";
     [newItem setPosition:itemPos];
     if (focusedItem == currentItem)
       [self setFocusedItem:newItem];
-    [items replaceObjectAtIndex:ndx withObject:newItem];
+    [currentItem release];
   }
   
   if ([self autoArrangesItems])
     [self setNeedsArrange:YES];
+
+  if (titleIndexIsValid)
+    [titleIndex setTitle:[newItem title] forItemAtIndex:ndx];
+
+  if (arrangeKey) {
+    arrangeOrderIsValid = NO;
+    if ([self autoArrangesItems])
+      [self setNeedsArrange:YES];
+  }
   
-  itemPos = [newItem position];
-  
-  if (itemState & kCSIVItemCustomSizeMask)
-    itemSize = [newItem customSize];
-  else
-    itemSize = gridSize;
-  
-  itemRect = NSMakeRect (itemPos.x, itemPos.y,
-                         itemSize.width, itemSize.height);
+  itemRect = CSIconViewItemStoreFrameAtIndex (itemStore, ndx, gridSize,
+                                              allowsCustomSizes);
   
+  if (!isPending)
+    [quadTree addObject:newItem withBounds:itemRect];
+
   [self setNeedsDisplayInRect:NSInsetRect (itemRect, -2.0, -2.0)];
 }
 
 - (void)reloadItems
 {
-  unsigned n, count = [dataSource numberOfItemsInIconView:self];
+  unsigned n, count = [self numberOfSourceItems];
+  NSTimeInterval startTime = 0.0;
+
+  TRACE (CSIconViewTraceBeginReload);
+  if (collectsRenderStatistics)
+    startTime = currentTime ();
   
+  CSIconViewItemStoreRemoveAllItems (itemStore);
   [items removeAllObjects];
   [quadTree removeAllObjects];
+
+  // We rebuild the title index the next time someone types
+  titleIndexIsValid = NO;
+  arrangeOrderIsValid = NO;
+
+  if (!CSIconViewItemStoreSetCount (itemStore, count)) {
+    [NSException raise:@"CSOutOfMemory"
+		format:@"%@",
+      NSLocalizedString (@"Not enough memory.",
+                         @"Not enough memory.")];
+  }
+
   for (n = 0; n < count; ++n) {
-    CSIconViewItem *item = [dataSource iconView:self itemAtIndex:n];
-    NSPoint pos = [item position];
-    NSRect itemFrame = NSMakeRect (pos.x, pos.y,
-				   gridSize.width, gridSize.height);
+    CSIconViewItem *item = [self sourceItemAtIndex:n];
     
-    if (allowsCustomSizes && ([item state] & kCSIVItemCustomSizeMask))
-      itemFrame.size = [item customSize];
-
-    [item setIndex:n];
     [items addObject:item];
-    [quadTree addObject:item withBounds:itemFrame];
+    [item attachToStore:itemStore atIndex:n];
   }
 
+  [self reloadQuadTree];
+
   if ([self autoArrangesItems])
     [self setNeedsArrange:YES];
   
   [self setNeedsDisplay:YES];
+
+  if (collectsRenderStatistics)
+    renderStatistics.reloadTime = currentTime () - startTime;
+  TRACE (CSIconViewTraceEndReload);
 }
 
 - (void)reloadQuadTree
 {
-  unsigned n, count = [items count];
+  unsigned n, count = itemStore->count;
+  NSRect *rects;
   
   [quadTree removeAllObjects];
+
+  if (!count)
+    return;
+
+  rects = (NSRect *)malloc (sizeof (NSRect) * count);
+
+  if (!rects) {
+    [NSException raise:@"CSOutOfMemory"
+		format:@"%@",
+      NSLocalizedString (@"Not enough memory.",
+                         @"Not enough memory.")];
+  }
+
   for (n = 0; n < count; ++n) {
-    CSIconViewItem *item = [items objectAtIndex:n];
-    NSPoint pos = [item position];
-    NSRect itemFrame = NSMakeRect (pos.x, pos.y,
-				   gridSize.width, gridSize.height);
-    
-    if (allowsCustomSizes && ([item state] & kCSIVItemCustomSizeMask))
-      itemFrame.size = [item customSize];
-    
-    [quadTree addObject:item withBounds:itemFrame];
-  }  
+    rects[n] = CSIconViewItemStoreFrameAtIndex (itemStore, n, gridSize,
+                                                allowsCustomSizes);
+  }
+
+  @try {
+    [quadTree addObjects:itemStore->items withBounds:rects count:count];
+  } @finally {
+    free (rects);
+  }
+}
+
+struct arrange_context {
+  id	*keys;
+  Class	*kinds;
+  BOOL	keysAreStrings;
+  BOOL	kindsAreMixed;
+  BOOL	ascending;
+};
+
+/* Keys of the same kind can be sent -compare: with each other; class
+   clusters are folded to their public class so that, for instance, all
+   numbers share a kind. */
+static Class
+arrangeKeyKind (id key)
+{
+  static Class stringClass, numberClass, dateClass;
+
+  if (!stringClass) {
+    stringClass = [NSString class];
+    numberClass = [NSNumber class];
+    dateClass = [NSDate class];
+  }
+
+  if ([key isKindOfClass:stringClass])
+    return stringClass;
+  if ([key isKindOfClass:numberClass])
+    return numberClass;
+  if ([key isKindOfClass:dateClass])
+    return dateClass;
+  return [key class];
+}
+
+/* Called concurrently from CSParallelSortIndices(); the keys are immutable
+   by this point, so comparing them is thread-safe.  Nothing in here may
+   raise, so keys of different kinds (which -compare: would reject) are
+   ordered by class name instead. */
+static int
+compareArrangeKeys (unsigned a, unsigned b, void *contextPtr)
+{
+  const struct arrange_context *context = contextPtr;
+  id keyA = context->keys[a], keyB = context->keys[b];
+  NSComparisonResult result;
+
+  if (keyA == keyB)
+    result = NSOrderedSame;
+  else if (!keyA)
+    result = NSOrderedAscending;
+  else if (!keyB)
+    result = NSOrderedDescending;
+  else if (context->kindsAreMixed
+	   && context->kinds[a] != context->kinds[b]) {
+    int cmp = strcmp (class_getName (context->kinds[a]),
+		      class_getName (context->kinds[b]));
+    result = cmp < 0 ? NSOrderedAscending : NSOrderedDescending;
+  } else if (context->keysAreStrings)
+    result = [keyA compare:keyB options:NSLiteralSearch | NSNumericSearch];
+  else
+    result = [keyA compare:keyB];
+
+  return context->ascending ? result : -result;
+}
+
+- (NSString *)arrangeKey
+{
+  return arrangeKey;
+}
+
+- (BOOL)arrangesAscending
+{
+  return arrangesAscending;
+}
+
+- (void)arrangeItemsByKey:(NSString *)keyPath ascending:(BOOL)ascending
+{
+  if (keyPath != arrangeKey) {
+    [arrangeKey release];
+    arrangeKey = [keyPath copy];
+  }
+  arrangesAscending = ascending;
+  arrangeOrderIsValid = NO;
+
+  [self arrangeItems];
+  [self setNeedsDisplay:YES];
+}
+
+/* Returns the order in which -arrangeItems should place the items, or NULL
+   for index order.  The sort keys are fetched (and, for strings, folded)
+   once up front, so the sort itself never calls back into the items. */
+- (const unsigned *)arrangeOrder
+{
+  struct arrange_context context;
+  NSAutoreleasePool *pool = nil;
+  Class firstKind = Nil;
+  unsigned n, count = itemStore->count;
+  unsigned *newOrder;
+
+  if (!arrangeKey)
+    return NULL;
+
+  if (arrangeOrderIsValid)
+    return arrangeOrder;
+
+  newOrder = (unsigned *)realloc (arrangeOrder,
+				  sizeof (unsigned) * (count ? count : 1));
+  if (newOrder)
+    arrangeOrder = newOrder;
+  context.keys = (id *)malloc (sizeof (id) * (count ? count : 1));
+  context.kinds = (Class *)malloc (sizeof (Class) * (count ? count : 1));
+
+  if (!newOrder || !context.keys || !context.kinds) {
+    free (context.keys);
+    free (context.kinds);
+    [NSException raise:@"CSOutOfMemory"
+		format:@"%@",
+      NSLocalizedString (@"Not enough memory.",
+                         @"Not enough memory.")];
+  }
+
+  context.keysAreStrings = YES;
+  context.kindsAreMixed = NO;
+  context.ascending = arrangesAscending;
+
+  /* Everything that could raise happens here, on the calling thread, before
+     the sort starts; an exception from inside the sort's worker threads
+     would take the process down. */
+  for (n = 0; n < count; ++n) {
+    Class kind = Nil;
+    id key;
+
+    if (!(n % 1000)) {
+      [pool release];
+      pool = [[NSAutoreleasePool alloc] init];
+    }
+
+    key = [itemStore->items[n] valueForKeyPath:arrangeKey];
+
+    if ([key isKindOfClass:[NSString class]])
+      key = [CSTitleIndex foldedString:key];
+    else if (key)
+      context.keysAreStrings = NO;
+
+    if (key) {
+      if (![key respondsToSelector:@selector(compare:)]) {
+	NSString *className = NSStringFromClass ([key class]);
+	unsigned m;
+
+	for (m = 0; m < n; ++m)
+	  [context.keys[m] release];
+	free (context.keys);
+	free (context.kinds);
+	[NSException raise:NSInvalidArgumentException
+		    format:@"Cannot arrange by %@: %@ values do not "
+	  @"respond to -compare:", arrangeKey, className];
+      }
+
+      kind = arrangeKeyKind (key);
+      if (!firstKind)
+	firstKind = kind;
+      else if (kind != firstKind)
+	context.kindsAreMixed = YES;
+    }
+
+    context.keys[n] = [key copy];
+    context.kinds[n] = kind;
+    arrangeOrder[n] = n;
+  }
+
+  [pool release];
+
+  if (CSParallelSortIndices (arrangeOrder, count, compareArrangeKeys,
+			     &context) < 0) {
+    for (n = 0; n < count; ++n)
+      [context.keys[n] release];
+    free (context.keys);
+    free (context.kinds);
+    [NSException raise:@"CSOutOfMemory"
+		format:@"%@",
+      NSLocalizedString (@"Not enough memory.",
+                         @"Not enough memory.")];
+  }
+
+  for (n = 0; n < count; ++n)
+    [context.keys[n] release];
+  free (context.keys);
+  free (context.kinds);
+
+  arrangeOrderIsValid = YES;
+
+  return arrangeOrder;
 }
 
 - (void)arrangeItems
 {
-  unsigned n, count = [items count];
+  unsigned n, count = itemStore->count;
+  const unsigned *order;
   NSRect bounds = [self bounds];
   NSPoint pos = NSMakePoint (NSMinX (bounds), NSMinY (bounds));
+  NSTimeInterval startTime = 0.0;
+
+  TRACE (CSIconViewTraceBeginArrange);
+  if (collectsRenderStatistics)
+    startTime = currentTime ();
   
   doingArrange = YES;
   [self resetKeyboardMovement];
 
+  order = [self arrangeOrder];
+
   [quadTree removeAllObjects];
   for (n = 0; n < count; ++n) {
-    CSIconViewItem *item = [items objectAtIndex:n];
+    unsigned ndx = order ? order[n] : n;
+    NSSize itemSize = CSIconViewItemStoreSizeAtIndex (itemStore, ndx,
+						      gridSize,
+                                                      allowsCustomSizes);
     NSRect itemFrame = NSMakeRect (pos.x, pos.y,
-				   gridSize.width, gridSize.height);
-    NSSize itemSize = gridSize;
-    
-    if (allowsCustomSizes && ([item state] & kCSIVItemCustomSizeMask)) {
-      itemSize = [item customSize];
-      itemFrame = NSMakeRect (pos.x, pos.y,
-			      itemSize.width, itemSize.height);
-    }
+				   itemSize.width, itemSize.height);
     
     if (allowsCustomSizes) {
       NSAutoreleasePool *pool = nil;
@@ -1059,8 +1688,8 @@ static NSString * const kFont = @"kFont";
       [pool release];
     }
     
-    [item setPosition:pos];
-    [quadTree addObject:item withBounds:itemFrame];
+    itemStore->positions[ndx] = pos;
+    [quadTree addObject:itemStore->items[ndx] withBounds:itemFrame];
     
     do {
       pos.x += gridSize.width;
@@ -1076,6 +1705,10 @@ static NSString * const kFont = @"kFont";
   [self updateSize];
   
   doingArrange = NO;
+
+  if (collectsRenderStatistics)
+    renderStatistics.arrangeTime = currentTime () - startTime;
+  TRACE (CSIconViewTraceEndArrange);
 }
 
 - (NSSet *)itemsInRect:(NSRect)rect
@@ -1083,36 +1716,909 @@ static NSString * const kFont = @"kFont";
   return [quadTree objectsInRect:rect];
 }
 
-#pragma mark Selection Handling
-
-- (NSSet *)selectedItems
+- (CSRectQuadTreeSnapshot *)snapshotOfItems
 {
-  return selectedItems;
+  return [quadTree snapshot];
 }
 
-- (NSIndexSet *)selectedItemIndices
+#pragma mark Incremental Updates
+
+- (void)beginUpdates
 {
-  return selectedItemIndices;
+  ++updateDepth;
 }
 
-- (void)deselectItem:(CSIconViewItem *)item
+- (void)endUpdates
 {
-  NSPoint pos = [item position];
-  NSSize size;
-  NSRect itemRect;
-  
-  if (allowsCustomSizes && ([item state] & kCSIVItemCustomSizeMask))
-    size = [item customSize];
-  else
-    size = gridSize;
-  
-  itemRect = NSMakeRect (pos.x, pos.y, size.width, size.height);
-  
-  [selectedItemIndices removeIndex:[item index]];
-  [selectedItems removeObject:item];
-  [item deselect];
+  NSAssert (updateDepth, @"Unbalanced call to -endUpdates.");
 
-  [self resetKeyboardMovement];
+  if (!--updateDepth)
+    [self commitUpdates];
+}
+
+#if NS_BLOCKS_AVAILABLE
+- (void)performBatchUpdates:(void (^)(void))updates
+{
+  [self beginUpdates];
+  @try {
+    updates ();
+  } @finally {
+    [self endUpdates];
+  }
+}
+#endif
+
+/* Do the work we put off during a batch of updates: add the new items to
+   the quad tree in one go, then re-arrange or resize and redisplay */
+- (void)commitUpdates
+{
+  unsigned n = 0, count = [pendingInsertions count];
+
+  // The store leaves renumbering the items it has moved to us
+  CSIconViewItemStoreRenumberItems (itemStore);
+
+  if (needsReload) {
+    // The reload will take care of everything
+    [pendingInsertions removeAllObjects];
+    updateDirtyRect = NSZeroRect;
+    return;
+  }
+
+  if (count) {
+    NSEnumerator *itemEnum = [pendingInsertions objectEnumerator];
+    id *newItems = (id *)malloc (sizeof (id) * count);
+    NSRect *rects = (NSRect *)malloc (sizeof (NSRect) * count);
+    CSIconViewItem *item;
+
+    if (!newItems || !rects) {
+      free (newItems);
+      free (rects);
+      [NSException raise:@"CSOutOfMemory"
+		  format:@"%@",
+        NSLocalizedString (@"Not enough memory.",
+                           @"Not enough memory.")];
+    }
+
+    while ((item = [itemEnum nextObject])) {
+      unsigned ndx = [item index];
+
+      // Skip anything that is no longer in the view
+      if (!CSIconViewItemStoreHasItem (itemStore, item, ndx))
+	continue;
+
+      newItems[n] = item;
+      rects[n] = CSIconViewItemStoreFrameAtIndex (itemStore, ndx, gridSize,
+						  allowsCustomSizes);
+      updateDirtyRect = NSUnionRect (updateDirtyRect, rects[n]);
+      ++n;
+    }
+
+    @try {
+      [quadTree addObjects:newItems withBounds:rects count:n];
+    } @finally {
+      free (newItems);
+      free (rects);
+      [pendingInsertions removeAllObjects];
+    }
+  }
+
+  knowsSelectionBoundingRect = NO;
+  [self resetKeyboardMovement];
+
+  if ([self autoArrangesItems]) {
+    [self setNeedsArrange:YES];
+    [self setNeedsDisplay:YES];
+  } else {
+    [self updateSize];
+
+    if (!NSIsEmptyRect (updateDirtyRect))
+      [self setNeedsDisplayInRect:NSInsetRect (updateDirtyRect, -2.0, -2.0)];
+  }
+
+  updateDirtyRect = NSZeroRect;
+}
+
+- (void)insertItemsAtIndexes:(NSIndexSet *)indexes
+{
+  unsigned n, count = [indexes count];
+  NSMutableArray *newItems;
+  NSUInteger *indices;
+
+  if (!count || needsReload)
+    return;
+
+  indices = (NSUInteger *)malloc (sizeof (NSUInteger) * count);
+
+  if (indices)
+    [indexes getIndexes:indices maxCount:count inIndexRange:NULL];
+
+  if (!indices || !CSIconViewItemStoreInsertSlots (itemStore, indices, count)) {
+    free (indices);
+    [NSException raise:@"CSOutOfMemory"
+		format:@"%@",
+      NSLocalizedString (@"Not enough memory.",
+                         @"Not enough memory.")];
+  }
+
+  [self beginUpdates];
+
+  if (!pendingInsertions)
+    pendingInsertions = [[NSMutableSet alloc] init];
+
+  newItems = [NSMutableArray arrayWithCapacity:count];
+  for (n = 0; n < count; ++n) {
+    CSIconViewItem *item = [self sourceItemAtIndex:indices[n]];
+
+    [newItems addObject:item];
+    [item attachToStore:itemStore atIndex:indices[n]];
+    [item deselect];
+    [pendingInsertions addObject:item];
+  }
+
+  [items insertObjects:newItems atIndexes:indexes];
+
+  // Indices are ascending, so each shift accounts for the ones before it
+  for (n = 0; n < count; ++n)
+    [selectedItemIndices shiftIndexesStartingAtIndex:indices[n] by:1];
+
+  free (indices);
+
+  titleIndexIsValid = NO;
+  arrangeOrderIsValid = NO;
+
+  [self endUpdates];
+}
+
+- (void)removeItemsAtIndexes:(NSIndexSet *)indexes
+{
+  unsigned n, count = [indexes count];
+  NSUInteger *indices;
+
+  if (!count || needsReload)
+    return;
+
+  indices = (NSUInteger *)malloc (sizeof (NSUInteger) * count);
+
+  if (!indices) {
+    [NSException raise:@"CSOutOfMemory"
+		format:@"%@",
+      NSLocalizedString (@"Not enough memory.",
+                         @"Not enough memory.")];
+  }
+
+  [indexes getIndexes:indices maxCount:count inIndexRange:NULL];
+
+  [self beginUpdates];
+
+  for (n = 0; n < count; ++n) {
+    CSIconViewItem *item = itemStore->items[indices[n]];
+    NSRect itemRect = CSIconViewItemStoreFrameAtIndex (itemStore, indices[n],
+						       gridSize,
+						       allowsCustomSizes);
+
+    if (isEditing && item == editingItem)
+      [[self window] makeFirstResponder:self];
+    if (item == focusedItem)
+      [self setFocusedItem:nil];
+    if (item == editOnMouseUp) {
+      [editOnMouseUp release];
+      editOnMouseUp = nil;
+    }
+
+    [selectedItems removeObject:item];
+    [dragSelectedItems removeObject:item];
+    [deselectOnMouseUp removeObject:item];
+    [item deselect];
+
+    if ([pendingInsertions containsObject:item])
+      [pendingInsertions removeObject:item];
+    else
+      [quadTree removeObject:item withBounds:itemRect];
+
+    updateDirtyRect = NSUnionRect (updateDirtyRect, itemRect);
+  }
+
+  CSIconViewItemStoreRemoveSlots (itemStore, indices, count);
+  [items removeObjectsAtIndexes:indexes];
+
+  // Going backwards, so that the indices we haven't done yet stay valid
+  for (n = count; n-- > 0;)
+    [selectedItemIndices shiftIndexesStartingAtIndex:indices[n] + 1 by:-1];
+
+  free (indices);
+
+  titleIndexIsValid = NO;
+  arrangeOrderIsValid = NO;
+
+  [self endUpdates];
+}
+
+- (void)moveItemAtIndex:(unsigned)fromIndex toIndex:(unsigned)toIndex
+{
+  CSIconViewItem *item;
+  BOOL wasSelected;
+
+  if (needsReload || fromIndex == toIndex)
+    return;
+
+  NSAssert (fromIndex < itemStore->count && toIndex < itemStore->count,
+	    @"Item index out of range.");
+
+  [self beginUpdates];
+
+  item = [[items objectAtIndex:fromIndex] retain];
+  [items removeObjectAtIndex:fromIndex];
+  [items insertObject:item atIndex:toIndex];
+  [item release];
+
+  // The item keeps its position, so the quad tree doesn't need to change
+  CSIconViewItemStoreMoveSlot (itemStore, fromIndex, toIndex);
+
+  wasSelected = [selectedItemIndices containsIndex:fromIndex];
+  [selectedItemIndices shiftIndexesStartingAtIndex:fromIndex + 1 by:-1];
+  [selectedItemIndices shiftIndexesStartingAtIndex:toIndex by:1];
+  if (wasSelected)
+    [selectedItemIndices addIndex:toIndex];
+
+  titleIndexIsValid = NO;
+  arrangeOrderIsValid = NO;
+
+  [self endUpdates];
+}
+
+#pragma mark Asynchronous Rendering
+
+/* Tiles are rendered in chunks, one renderer per chunk, since renderers
+   can't be shared between threads.  Each entry in tiles is a retained
+   image, or nil if we couldn't render that one. */
+struct tile_job {
+  NSArray   *descriptions;
+  NSImage   **tiles;
+  size_t    count;
+  size_t    chunkSize;
+  CGFloat   scale;
+};
+
+/* Renders an item into a new (retained) image the size of its frame plus
+   TILE_MARGIN all round, at the given number of pixels per point */
+static NSImage *
+newTileImage (CSIconRenderer	    *tileRenderer,
+              CSIconDrawDescription *description,
+              CGFloat		    scale)
+{
+  NSSize frameSize = [description frameSize];
+  NSSize size = NSMakeSize (frameSize.width + 2.0 * TILE_MARGIN,
+                            frameSize.height + 2.0 * TILE_MARGIN);
+  NSInteger pixelsWide = ceil (size.width * scale);
+  NSInteger pixelsHigh = ceil (size.height * scale);
+  NSBitmapImageRep *rep;
+  NSGraphicsContext *context;
+  NSAffineTransform *transform;
+  NSImage *image;
+
+  if (pixelsWide < 1 || pixelsHigh < 1)
+    return nil;
+
+  rep = [NSBitmapImageRep premultipliedRGBARepWithPixelsWide:pixelsWide
+                                                  pixelsHigh:pixelsHigh];
+
+  if (!rep)
+    return nil;
+
+  // As for the drag image, the text needs a flipped context
+  context = [NSGraphicsContext graphicsContextWithBitmapImageRep:rep];
+  context = [NSGraphicsContext graphicsContextWithGraphicsPort:
+                                 [context graphicsPort]
+                                                     flipped:YES];
+
+  transform = [NSAffineTransform transform];
+  [transform translateXBy:0.0 yBy:pixelsHigh];
+  [transform scaleXBy:scale yBy:-scale];
+
+  [NSGraphicsContext saveGraphicsState];
+  [NSGraphicsContext setCurrentContext:context];
+  @try {
+    [transform concat];
+    [tileRenderer drawDescription:description
+                          atPoint:NSMakePoint (TILE_MARGIN, TILE_MARGIN)];
+  } @finally {
+    [NSGraphicsContext restoreGraphicsState];
+  }
+
+  [rep setSize:size];
+
+  image = [[NSImage alloc] initWithSize:size];
+  [image setFlipped:YES];
+  [image setCacheMode:NSImageCacheNever];
+  [image addRepresentation:rep];
+
+  return image;
+}
+
+static void
+renderTileChunk (void *jobPtr, size_t chunk)
+{
+  struct tile_job *job = (struct tile_job *)jobPtr;
+  NSAutoreleasePool *chunkPool = [[NSAutoreleasePool alloc] init];
+  CSIconRenderer *tileRenderer = [[CSIconRenderer alloc] init];
+  size_t n = chunk * job->chunkSize;
+  size_t end = n + job->chunkSize;
+
+  if (end > job->count)
+    end = job->count;
+
+  for (; n < end; ++n) {
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+
+    /* Nothing on this thread can deal with an exception, so anything that
+       fails is left for the main thread to draw, where any exception will
+       turn up again in the usual way */
+    @try {
+      job->tiles[n] = newTileImage (tileRenderer,
+                                    [job->descriptions objectAtIndex:n],
+                                    job->scale);
+    } @catch (NSException *exception) {
+      UNUSED (exception);
+      job->tiles[n] = nil;
+    }
+
+    [pool release];
+  }
+
+  [tileRenderer release];
+  [chunkPool release];
+}
+
+/* Throws away all the tiles, including any that are rendering right now */
+- (void)resetTiles
+{
+  ++tileGeneration;
+  [tileCache removeAllObjects];
+  [tileQueue removeAllObjects];
+  [pendingTiles removeAllObjects];
+  [visibleTiles removeAllObjects];
+  pendingTileRect = NSZeroRect;
+}
+
+/* Runs on a thread of its own.  The batch holds the descriptions to render,
+   the scale and the tile generation; we hand the results back to the main
+   thread together with the generation, so that it can ignore them if the
+   tiles were discarded in the meantime. */
+- (void)renderTiles:(NSArray *)batch
+{
+  NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+  NSArray *descriptions = [batch objectAtIndex:0];
+  NSUInteger n, count = [descriptions count];
+  NSMutableArray *tiles = [NSMutableArray arrayWithCapacity:count];
+  struct tile_job job;
+
+  TRACE (CSIconViewTraceBeginRenderTiles);
+
+  job.descriptions = descriptions;
+  job.count = count;
+  job.scale = [[batch objectAtIndex:1] doubleValue];
+  job.tiles = (NSImage **)calloc (count, sizeof (NSImage *));
+
+  if (job.tiles && count) {
+    size_t chunks = CSParallelCPUCount () * TILE_CHUNKS_PER_CPU;
+
+    job.chunkSize = (count + chunks - 1) / chunks;
+    CSParallelApply ((count + job.chunkSize - 1) / job.chunkSize,
+                     &job, renderTileChunk);
+  }
+
+  // NSNull marks the ones the main thread will have to draw itself
+  for (n = 0; n < count; ++n) {
+    NSImage *tile = job.tiles ? job.tiles[n] : nil;
+
+    [tiles addObject:tile ? (id)tile : (id)[NSNull null]];
+    [tile release];
+  }
+
+  free (job.tiles);
+
+  TRACE (CSIconViewTraceEndRenderTiles);
+
+  [self performSelectorOnMainThread:@selector(tilesDidRender:)
+                         withObject:[NSArray arrayWithObjects:
+                                               descriptions,
+                                               tiles,
+                                               [batch objectAtIndex:2],
+                                               nil]
+                      waitUntilDone:NO];
+
+  [pool release];
+}
+
+- (void)tilesDidRender:(NSArray *)result
+{
+  NSArray *descriptions = [result objectAtIndex:0];
+  NSArray *tiles = [result objectAtIndex:1];
+  unsigned generation = [[result objectAtIndex:2] unsignedIntValue];
+  NSUInteger n, count = [descriptions count];
+
+  isRenderingTiles = NO;
+
+  if (rendersAsynchronously && generation == tileGeneration) {
+    NSUInteger limit = MAX (MIN_CACHED_TILES,
+                            TILE_CACHE_SCREENS * [visibleTiles count]);
+
+    /* If the cache is full, keep just the tiles we drew last time; the
+       batch came from those too, so they will all fit */
+    if ([tileCache count] + count > limit) {
+      NSMutableDictionary *keep
+        = [NSMutableDictionary dictionaryWithCapacity:[visibleTiles count]];
+      NSEnumerator *descEnum = [visibleTiles objectEnumerator];
+      CSIconDrawDescription *description;
+
+      while ((description = [descEnum nextObject])) {
+        id tile = [tileCache objectForKey:description];
+
+        if (tile)
+          [keep setObject:tile forKey:description];
+      }
+
+      [tileCache setDictionary:keep];
+    }
+
+    for (n = 0; n < count; ++n) {
+      CSIconDrawDescription *description = [descriptions objectAtIndex:n];
+
+      [tileCache setObject:[tiles objectAtIndex:n] forKey:description];
+      [pendingTiles removeObject:description];
+    }
+
+    [self setNeedsDisplayInRect:pendingTileRect];
+    pendingTileRect = NSZeroRect;
+  }
+
+  [self startRenderingTiles];
+}
+
+- (void)startRenderingTiles
+{
+  NSArray *batch;
+
+  if (isRenderingTiles || ![tileQueue count])
+    return;
+
+  batch = [NSArray arrayWithObjects:
+                     [NSArray arrayWithArray:tileQueue],
+                     [NSNumber numberWithDouble:tileScale],
+                     [NSNumber numberWithUnsignedInt:tileGeneration],
+                     nil];
+
+  [tileQueue removeAllObjects];
+  isRenderingTiles = YES;
+
+  [NSThread detachNewThreadSelector:@selector(renderTiles:)
+                           toTarget:self
+                         withObject:batch];
+}
+
+- (void)drawPlaceholderForDescription:(CSIconDrawDescription *)description
+                              atPoint:(NSPoint)origin
+{
+  NSRect frame = NSMakeRect (origin.x, origin.y,
+                             [description frameSize].width,
+                             [description frameSize].height);
+
+  [renderer setDetailLevel:CSIconDetailReduced];
+  [renderer drawDescription:description atPoint:origin];
+  [renderer setDetailLevel:CSIconDetailFull];
+
+  pendingTileRect = NSUnionRect (pendingTileRect,
+                                 NSInsetRect (frame, -TILE_MARGIN,
+                                              -TILE_MARGIN));
+  ++renderStatistics.itemsPending;
+}
+
+/* Draws the items from rendered tiles where we have them.  If a lot of
+   tiles are missing, we queue them up for rendering and draw placeholders
+   in the meantime; otherwise we just draw the items. */
+- (void)drawTiledItems:(NSSet *)renderItems inKeyView:(BOOL)isKeyView
+{
+  NSUInteger count = [renderItems count];
+  NSEnumerator *itemEnum = [renderItems objectEnumerator];
+  NSMutableArray *misses = [NSMutableArray array];
+  NSPoint *missOrigins;
+  CSIconViewItem *item;
+  NSUInteger n, missCount;
+  NSSize unitSize = [self convertSize:NSMakeSize (1.0, 1.0) toView:nil];
+  CGFloat scale = fabs (unitSize.width);
+
+  // Tiles rendered at the wrong scale are no use to us
+  if (scale != tileScale) {
+    [self resetTiles];
+    tileScale = scale;
+  }
+
+  missOrigins = (NSPoint *)malloc (sizeof (NSPoint) * (count + 1));
+
+  if (!missOrigins) {
+    [NSException raise:@"CSOutOfMemory"
+		format:@"%@",
+      NSLocalizedString (@"Not enough memory.",
+                         @"Not enough memory.")];
+  }
+
+  [visibleTiles removeAllObjects];
+
+  @try {
+    while ((item = [itemEnum nextObject])) {
+      unsigned ndx = [item index];
+      NSPoint origin = itemStore->positions[ndx];
+      CSIconDrawDescription *description
+        = [self drawDescriptionOfItemAtIndex:ndx
+                                 highlighted:[self isItemAtIndexHighlighted:ndx]
+                                   inKeyView:isKeyView];
+      id tile = [tileCache objectForKey:description];
+
+      [visibleTiles addObject:description];
+
+      if ([tile isKindOfClass:[NSImage class]]) {
+        NSSize tileSize = [tile size];
+
+        [tile drawInRect:NSMakeRect (origin.x - TILE_MARGIN,
+                                     origin.y - TILE_MARGIN,
+                                     tileSize.width, tileSize.height)
+                fromRect:NSZeroRect
+               operation:NSCompositeSourceOver
+                fraction:1.0];
+        ++renderStatistics.itemsFromTiles;
+      } else if (tile) {
+        // We couldn't render this one in the background
+        [renderer drawDescription:description atPoint:origin];
+      } else if ([pendingTiles containsObject:description]) {
+        [self drawPlaceholderForDescription:description atPoint:origin];
+      } else {
+        missOrigins[[misses count]] = origin;
+        [misses addObject:description];
+      }
+
+      ++renderStatistics.itemsDrawn;
+    }
+
+    missCount = [misses count];
+
+    /* While rubber banding, the highlights change under the mouse, and
+       placeholders would just flicker */
+    if (missCount < ASYNC_TILE_THRESHOLD || dragging) {
+      for (n = 0; n < missCount; ++n) {
+        [renderer drawDescription:[misses objectAtIndex:n]
+                          atPoint:missOrigins[n]];
+      }
+    } else {
+      for (n = 0; n < missCount; ++n) {
+        [self drawPlaceholderForDescription:[misses objectAtIndex:n]
+                                    atPoint:missOrigins[n]];
+      }
+
+      [pendingTiles addObjectsFromArray:misses];
+      [tileQueue addObjectsFromArray:misses];
+      [self startRenderingTiles];
+    }
+  } @finally {
+    free (missOrigins);
+  }
+}
+
+- (BOOL)rendersAsynchronously
+{
+  return rendersAsynchronously;
+}
+
+- (void)setRendersAsynchronously:(BOOL)async
+{
+  if (rendersAsynchronously == async)
+    return;
+
+  rendersAsynchronously = async;
+
+  if (async) {
+    tileCache = [[NSMutableDictionary alloc] init];
+    tileQueue = [[NSMutableArray alloc] init];
+    pendingTiles = [[NSMutableSet alloc] init];
+    visibleTiles = [[NSMutableSet alloc] init];
+    tileScale = 0.0;
+  } else {
+    // Anything still rendering will be ignored when it turns up
+    ++tileGeneration;
+    [tileCache release];
+    [tileQueue release];
+    [pendingTiles release];
+    [visibleTiles release];
+    tileCache = nil;
+    tileQueue = nil;
+    pendingTiles = nil;
+    visibleTiles = nil;
+  }
+
+  [self setNeedsDisplay:YES];
+}
+
+- (void)discardRenderedTiles
+{
+  [self resetTiles];
+  [self setNeedsDisplay:YES];
+}
+
+#pragma mark Layout Snapshots
+
+/* A layout snapshot is a fixed-size header followed by one record per item.
+   Every field is big-endian; co-ordinates are IEEE double precision, so
+   that large ones come back exactly as they were saved, and everything
+   else is 32-bit.  The checksum is an Adler-32 of the header (with the
+   checksum field zeroed) followed by the records, and the object bounds
+   let us size the quad tree in one go when restoring.  Version 1 used
+   single precision and didn't checksum the header. */
+#define LAYOUT_SNAPSHOT_MAGIC	0x43534c53	// 'CSLS'
+#define LAYOUT_SNAPSHOT_VERSION	2
+
+/* Selection and drop highlighting don't survive a relaunch, and the label
+   colour isn't part of the snapshot, so we leave those bits alone */
+#define LAYOUT_STATE_MASK	(kCSIVItemCustomSizeMask	\
+				 | kCSIVItemOpenMask		\
+				 | kCSIVItemDisabledMask)
+
+struct layout_snapshot_header {
+  uint32_t	magic;
+  uint32_t	version;
+  uint32_t	headerSize;
+  uint32_t	recordSize;
+  uint32_t	count;
+  uint32_t	checksum;
+  uint64_t	objectBounds[4];	// x, y, width, height
+};
+
+struct layout_snapshot_record {
+  uint32_t	index;
+  uint32_t	state;
+  uint64_t	position[2];
+  uint64_t	customSize[2];
+};
+
+static inline uint64_t
+bigEndianDouble (CGFloat value)
+{
+  union { double d; uint64_t u; } v;
+
+  v.d = value;
+  return NSSwapHostLongLongToBig (v.u);
+}
+
+static inline CGFloat
+hostDouble (uint64_t value)
+{
+  union { double d; uint64_t u; } v;
+
+  v.u = NSSwapBigLongLongToHost (value);
+  return v.d;
+}
+
+/* Carries on an Adler-32 from a previous value; start with 1 */
+static uint32_t
+adler32 (uint32_t adler, const void *bytes, size_t length)
+{
+  const uint8_t *ptr = (const uint8_t *)bytes;
+  uint32_t a = adler & 0xffff, b = adler >> 16;
+
+  while (length) {
+    // 5552 is the most bytes we can sum before b might overflow
+    size_t chunk = length < 5552 ? length : 5552;
+
+    length -= chunk;
+    while (chunk--) {
+      a += *ptr++;
+      b += a;
+    }
+
+    a %= 65521;
+    b %= 65521;
+  }
+
+  return (b << 16) | a;
+}
+
+/* The checksum covers the header too, apart from the checksum itself */
+static uint32_t
+layoutSnapshotChecksum (const struct layout_snapshot_header *header,
+			const struct layout_snapshot_record *records,
+			unsigned			    count)
+{
+  struct layout_snapshot_header zeroed = *header;
+
+  zeroed.checksum = 0;
+
+  return adler32 (adler32 (1, &zeroed, sizeof (zeroed)),
+		  records, sizeof (*records) * count);
+}
+
+- (NSData *)layoutSnapshot
+{
+  struct layout_snapshot_header *header;
+  struct layout_snapshot_record *records;
+  NSMutableData *data;
+  NSRect objectBounds;
+  unsigned n, count;
+
+  if (needsReload) {
+    needsReload = NO;
+    [self reloadItems];
+  }
+
+  count = itemStore->count;
+  data = [NSMutableData dataWithLength:
+	  sizeof (*header) + sizeof (*records) * count];
+
+  if (!data) {
+    [NSException raise:@"CSOutOfMemory"
+		format:@"%@",
+      NSLocalizedString (@"Not enough memory.",
+                         @"Not enough memory.")];
+  }
+
+  header = (struct layout_snapshot_header *)[data mutableBytes];
+  records = (struct layout_snapshot_record *)(header + 1);
+
+  for (n = 0; n < count; ++n) {
+    records[n].index = NSSwapHostIntToBig (n);
+    records[n].state = NSSwapHostIntToBig (itemStore->states[n]
+					   & LAYOUT_STATE_MASK);
+    records[n].position[0] = bigEndianDouble (itemStore->positions[n].x);
+    records[n].position[1] = bigEndianDouble (itemStore->positions[n].y);
+    records[n].customSize[0]
+      = bigEndianDouble (itemStore->customSizes[n].width);
+    records[n].customSize[1]
+      = bigEndianDouble (itemStore->customSizes[n].height);
+  }
+
+  objectBounds = [quadTree objectBounds];
+
+  header->magic = NSSwapHostIntToBig (LAYOUT_SNAPSHOT_MAGIC);
+  header->version = NSSwapHostIntToBig (LAYOUT_SNAPSHOT_VERSION);
+  header->headerSize = NSSwapHostIntToBig (sizeof (*header));
+  header->recordSize = NSSwapHostIntToBig (sizeof (*records));
+  header->count = NSSwapHostIntToBig (count);
+  header->objectBounds[0] = bigEndianDouble (NSMinX (objectBounds));
+  header->objectBounds[1] = bigEndianDouble (NSMinY (objectBounds));
+  header->objectBounds[2] = bigEndianDouble (NSWidth (objectBounds));
+  header->objectBounds[3] = bigEndianDouble (NSHeight (objectBounds));
+  header->checksum 
+    = NSSwapHostIntToBig (layoutSnapshotChecksum (header, records, count));
+
+  return data;
+}
+
+- (BOOL)restoreLayoutFromSnapshot:(NSData *)snapshot
+{
+  const struct layout_snapshot_header *header
+    = (const struct layout_snapshot_header *)[snapshot bytes];
+  const struct layout_snapshot_record *records;
+  NSUInteger length = [snapshot length];
+  NSRect objectBounds;
+  unsigned n, recordCount, count;
+
+  if (length < sizeof (*header)
+      || NSSwapBigIntToHost (header->magic) != LAYOUT_SNAPSHOT_MAGIC
+      || NSSwapBigIntToHost (header->version) != LAYOUT_SNAPSHOT_VERSION
+      || NSSwapBigIntToHost (header->headerSize) != sizeof (*header)
+      || NSSwapBigIntToHost (header->recordSize) != sizeof (*records))
+    return NO;
+
+  recordCount = NSSwapBigIntToHost (header->count);
+  records = (const struct layout_snapshot_record *)(header + 1);
+
+  if ((length - sizeof (*header)) / sizeof (*records) < recordCount
+      || (layoutSnapshotChecksum (header, records, recordCount)
+	  != NSSwapBigIntToHost (header->checksum)))
+    return NO;
+
+  if (needsReload) {
+    needsReload = NO;
+    [self reloadItems];
+  }
+
+  count = itemStore->count;
+  for (n = 0; n < recordCount; ++n) {
+    unsigned ndx = NSSwapBigIntToHost (records[n].index);
+    unsigned state;
+
+    if (ndx >= count)
+      continue;
+
+    state = NSSwapBigIntToHost (records[n].state) & LAYOUT_STATE_MASK;
+    itemStore->states[ndx] = ((itemStore->states[ndx] & ~LAYOUT_STATE_MASK)
+			      | state);
+    itemStore->positions[ndx]
+      = NSMakePoint (hostDouble (records[n].position[0]),
+		     hostDouble (records[n].position[1]));
+    itemStore->customSizes[ndx]
+      = NSMakeSize (hostDouble (records[n].customSize[0]),
+		    hostDouble (records[n].customSize[1]));
+    CSIconViewItemStoreInvalidateHitRegion (itemStore, ndx);
+  }
+
+  objectBounds = NSMakeRect (hostDouble (header->objectBounds[0]),
+			     hostDouble (header->objectBounds[1]),
+			     hostDouble (header->objectBounds[2]),
+			     hostDouble (header->objectBounds[3]));
+
+  // Size the (empty) quad tree up front, then bulk load it
+  [quadTree removeAllObjects];
+  if (!NSIsEmptyRect (objectBounds))
+    [quadTree setBounds:objectBounds];
+  [self reloadQuadTree];
+
+  knowsSelectionBoundingRect = NO;
+  [self resetKeyboardMovement];
+  [self updateSize];
+  [self setNeedsDisplay:YES];
+
+  return YES;
+}
+
+- (BOOL)writeLayoutSnapshotToFile:(NSString *)path error:(NSError **)error
+{
+  return [[self layoutSnapshot] writeToFile:path
+				    options:NSAtomicWrite
+				      error:error];
+}
+
+- (BOOL)restoreLayoutFromSnapshotFile:(NSString *)path
+				error:(NSError **)error
+{
+  NSData *snapshot = [NSData dataWithContentsOfFile:path
+					    options:NSMappedRead
+					      error:error];
+
+  if (!snapshot)
+    return NO;
+
+  if (![self restoreLayoutFromSnapshot:snapshot]) {
+    if (error) {
+      *error = [NSError errorWithDomain:NSCocoaErrorDomain
+				   code:NSFileReadCorruptFileError
+			       userInfo:[NSDictionary
+					  dictionaryWithObject:path
+							forKey:NSFilePathErrorKey]];
+    }
+    return NO;
+  }
+
+  return YES;
+}
+
+#pragma mark Selection Handling
+
+- (NSSet *)selectedItems
+{
+  return selectedItems;
+}
+
+- (NSIndexSet *)selectedItemIndices
+{
+  return selectedItemIndices;
+}
+
+- (void)deselectItem:(CSIconViewItem *)item
+{
+  NSPoint pos = [item position];
+  NSSize size;
+  NSRect itemRect;
+  
+  if (allowsCustomSizes && ([item state] & kCSIVItemCustomSizeMask))
+    size = [item customSize];
+  else
+    size = gridSize;
+  
+  itemRect = NSMakeRect (pos.x, pos.y, size.width, size.height);
+  
+  [selectedItemIndices removeIndex:[item index]];
+  [selectedItems removeObject:item];
+  [item deselect];
+
+  [self resetKeyboardMovement];
   
   [self setNeedsDisplayInRect:itemRect];
 }
@@ -1352,7 +2858,6 @@ static NSString * const kFont = @"kFont";
   if ([event type] == NSLeftMouseDown) {
     NSPoint pos = [self convertPoint:[event locationInWindow]
 			    fromView:nil];
-    NSPoint itemPos;
     NSRect frame;
     NSSet *itemsAtPoint = [quadTree objectsAtPoint:pos];
     NSEnumerator *itemEnum = [itemsAtPoint objectEnumerator];
@@ -1366,29 +2871,17 @@ static NSString * const kFont = @"kFont";
     [self setFocusedItem:nil];
     
     while (!foundItem && (item = [itemEnum nextObject])) {
-      unsigned state = [item state];
+      unsigned ndx = [item index];
+      unsigned state = itemStore->states[ndx];
 
       if (state & kCSIVItemDisabledMask)
         continue;
       
-      itemPos = [item position];
-      frame = NSMakeRect (itemPos.x, itemPos.y, gridSize.width, gridSize.height);
-    
-      if (allowsCustomSizes && (state & kCSIVItemCustomSizeMask)) {
-        [renderer setIconSize:[item customIconSize]];
-        frame.size = [item customSize];
-      } else {
-        [renderer setIconSize:iconSize];
-      }
-    
-      [renderer setIcon:[item icon]];
-      [renderer setTitle:[item title]];
-    
-      if ([renderer intersectsWithRect:NSMakeRect (pos.x, pos.y, 1, 1)
-                      ifDrawnWithFrame:frame
-                           highlighted:state & kCSIVItemSelectedMask
-                           textOnRight:([self labelPosition]
-                                        == CSLabelPositionRight)]) {
+      frame = CSIconViewItemStoreFrameAtIndex (itemStore, ndx, gridSize,
+                                               allowsCustomSizes);
+
+      if ([self itemAtIndex:ndx
+             intersectsRect:NSMakeRect (pos.x, pos.y, 1, 1)]) {
         if ([event modifierFlags] & (NSShiftKeyMask | NSCommandKeyMask)) {
           if (state & kCSIVItemSelectedMask) {
             /* If we're deselecting something, we need to do it on mouse up,
@@ -1419,10 +2912,10 @@ static NSString * const kFont = @"kFont";
             NSRect selectionRect = [self boundingRectOfSelectedItems];
             [self deselectAll];
             [self setNeedsDisplayInRect:selectionRect];
-          } else if ([renderer isPoint:pos
-                     inTextIfDrawnWithFrame:frame
-                     textOnRight:([self labelPosition]
-                                  == CSLabelPositionRight)]
+          } else if (CSIconHitRegionTitleContainsPoint
+                     ([self hitRegionOfItemAtIndex:ndx],
+                      NSMakePoint (pos.x - frame.origin.x,
+                                   pos.y - frame.origin.y))
                      && [[self window] isKeyWindow]
                      && [[self window] firstResponder] == self) {
             [editOnMouseUp release];
@@ -1498,31 +2991,15 @@ static NSString * const kFont = @"kFont";
   [dragSelectedItems unionSet:itemsInside];
   
   while ((item = [itemEnum nextObject])) {
-    NSPoint itemPos;
+    unsigned ndx = [item index];
     NSRect frame;
-    unsigned state = [item state];
     
-    if (state & kCSIVItemDisabledMask)
+    if (itemStore->states[ndx] & kCSIVItemDisabledMask)
       continue;
     
-    itemPos = [item position];
-    frame = NSMakeRect (itemPos.x, itemPos.y, gridSize.width, gridSize.height);
-    
-    if (allowsCustomSizes && ([item state] & kCSIVItemCustomSizeMask)) {
-      [renderer setIconSize:[item customIconSize]];
-      frame.size = [item customSize];
-    } else {
-      [renderer setIconSize:iconSize];
-    }
-    
-    [renderer setIcon:[item icon]];
-    [renderer setTitle:[item title]];
-    
-    if ([renderer intersectsWithRect:newRect
-                    ifDrawnWithFrame:frame
-                         highlighted:state & kCSIVItemSelectedMask
-                         textOnRight:([self labelPosition]
-                                      == CSLabelPositionRight)]) {  
+    if ([self itemAtIndex:ndx intersectsRect:newRect]) {
+      frame = CSIconViewItemStoreFrameAtIndex (itemStore, ndx, gridSize,
+                                               allowsCustomSizes);
       [dragSelectedItems addObject:item];
       newSelRect = NSUnionRect (newSelRect, frame);
     }
@@ -1548,6 +3025,52 @@ static NSString * const kFont = @"kFont";
   }
 }
 
+- (BOOL)collectsRenderStatistics
+{
+  return collectsRenderStatistics;
+}
+
+- (void)setCollectsRenderStatistics:(BOOL)collects
+{
+  collectsRenderStatistics = collects;
+  memset (&renderStatistics, 0, sizeof (renderStatistics));
+}
+
+- (CSIconViewRenderStatistics)renderStatistics
+{
+  return renderStatistics;
+}
+
+- (BOOL)usesReducedDetail
+{
+  return usesReducedDetail;
+}
+
+- (void)setUsesReducedDetail:(BOOL)reduce
+{
+  if (usesReducedDetail == reduce)
+    return;
+
+  usesReducedDetail = reduce;
+
+  if (!reduce && isLiveScrolling) {
+    [NSObject cancelPreviousPerformRequestsWithTarget:self
+                                             selector:@selector(liveScrollDidEnd)
+                                               object:nil];
+    [self liveScrollDidEnd];
+  }
+}
+
+- (unsigned)reducedDetailItemThreshold
+{
+  return reducedDetailItemThreshold;
+}
+
+- (void)setReducedDetailItemThreshold:(unsigned)threshold
+{
+  reducedDetailItemThreshold = threshold;
+}
+
 - (NSString *)iconViewUniqueID
 {
   return [NSString stringWithFormat:@"%d-%p", getpid(), self];
@@ -1649,13 +3172,13 @@ static NSString * const kFont = @"kFont";
       NSMutableArray *types = [NSMutableArray arrayWithObjects:
                                 CSIconViewInternalDragData,
                                 nil];
-      NSDictionary *iconViewItemInfo =
-        [NSDictionary dictionaryWithObjectsAndKeys:
-          [self iconViewUniqueID], kCSIconView,
-          [self selectedItemIndices], kCSIconViewItems,
-          nil];
-      NSData *iconViewItemData = 
-        [NSKeyedArchiver archivedDataWithRootObject:iconViewItemInfo];
+      NSData *iconViewItemData;
+
+      [dragItemIndices release];
+      dragItemIndices = [selectedItemIndices copy];
+      providedDragItemData = NO;
+      iconViewItemData = CSIconViewEncodeDragData ([self iconViewUniqueID],
+                                                   dragItemIndices);
 
       if ([dataSource respondsToSelector:
 @selector(iconViewPasteboardTypesForDrag:)]) {
@@ -1844,9 +3367,20 @@ static NSString * const kFont = @"kFont";
 {
   NSTextView *fieldEditor = (NSTextView *)[notification object];
   NSRect fieldEditorFrame = [fieldEditor frame];
+  NSString *newTitle = nil;
+  unsigned editedIndex = 0;
   
-  if (didEdit)
+  if (didEdit) {
     [editingItem setTitle:[fieldEditor string]];
+    newTitle = [[[editingItem title] retain] autorelease];
+    editedIndex = [editingItem index];
+
+    if (titleIndexIsValid)
+      [titleIndex setTitle:[editingItem title] 
+            forItemAtIndex:[editingItem index]];
+
+    arrangeOrderIsValid = NO;
+  }
   
   // Notify others that we're done editing
   [[NSNotificationCenter defaultCenter]
@@ -1865,10 +3399,192 @@ static NSString * const kFont = @"kFont";
   [self setKeyboardFocusRingNeedsDisplayInRect:fieldEditorFrame];
   [[self window] makeFirstResponder:self];
   [self setFrame:frameBeforeEditing];
+
+  /* Other views on the same model (and this one) pick up the new title
+     when the model tells them about it */
+  if (model && newTitle)
+    [model setTitle:newTitle forItemAtIndex:editedIndex];
 }
 
 #pragma mark Drag & Drop
 
+/* Internal drag data is a header, the view ID in UTF-8 (padded with zeroes
+   to a multiple of four bytes), then (location, length) pairs of index
+   ranges.  Every field is a big-endian 32-bit integer. */
+#define DRAG_DATA_MAGIC		0x43534444	// 'CSDD'
+#define DRAG_DATA_VERSION	1
+
+/* How many indices we fetch from the index set at a time */
+#define DRAG_DATA_CHUNK		1024
+
+/* If at least this fraction of the items move, we rebuild the quad tree
+   rather than removing and re-adding them one at a time */
+#define BULK_MOVE_REBUILD_FRACTION  4
+
+struct drag_data_header {
+  uint32_t	magic;
+  uint32_t	version;
+  uint32_t	idLength;	// Excluding padding
+  uint32_t	rangeCount;
+};
+
+static void
+appendRange (NSMutableData *data, NSUInteger start, NSUInteger length)
+{
+  uint32_t range[2];
+
+  range[0] = NSSwapHostIntToBig ((uint32_t)start);
+  range[1] = NSSwapHostIntToBig ((uint32_t)length);
+
+  [data appendBytes:range length:sizeof (range)];
+}
+
+NSData *
+CSIconViewEncodeDragData (NSString *viewID, NSIndexSet *indices)
+{
+  NSData *idData = [viewID dataUsingEncoding:NSUTF8StringEncoding];
+  NSUInteger idLength = [idData length];
+  NSMutableData *data 
+    = [NSMutableData dataWithLength:(sizeof (struct drag_data_header)
+                                     + ((idLength + 3) & ~3))];
+  struct drag_data_header *header;
+  NSUInteger buffer[DRAG_DATA_CHUNK];
+  NSUInteger runStart = 0, runLength = 0, got, n;
+  uint32_t rangeCount = 0;
+  NSRange range;
+
+  if ([indices count]) {
+    range = NSMakeRange ([indices firstIndex],
+                         [indices lastIndex] - [indices firstIndex] + 1);
+
+    while ((got = [indices getIndexes:buffer
+                             maxCount:DRAG_DATA_CHUNK
+                         inIndexRange:&range])) {
+      for (n = 0; n < got; ++n) {
+        if (runLength && buffer[n] == runStart + runLength)
+          ++runLength;
+        else {
+          if (runLength) {
+            appendRange (data, runStart, runLength);
+            ++rangeCount;
+          }
+          runStart = buffer[n];
+          runLength = 1;
+        }
+      }
+    }
+
+    if (runLength) {
+      appendRange (data, runStart, runLength);
+      ++rangeCount;
+    }
+  }
+
+  // Appending may have moved the bytes, so we fill in the header last
+  header = (struct drag_data_header *)[data mutableBytes];
+  header->magic = NSSwapHostIntToBig (DRAG_DATA_MAGIC);
+  header->version = NSSwapHostIntToBig (DRAG_DATA_VERSION);
+  header->idLength = NSSwapHostIntToBig ((uint32_t)idLength);
+  header->rangeCount = NSSwapHostIntToBig (rangeCount);
+  memcpy (header + 1, [idData bytes], idLength);
+
+  return data;
+}
+
+BOOL
+/* The drag data comes from the pasteboard, so we trust none of it.  Ranges
+   that wrap around are rejected, and the indices are clipped to
+   indexLimit before they go anywhere near an NSIndexSet. */
+static BOOL
+decodeDragData (NSData	   *data,
+		NSString   **viewID,
+		NSIndexSet **indices,
+		NSUInteger indexLimit)
+{
+  const struct drag_data_header *header 
+    = (const struct drag_data_header *)[data bytes];
+  NSUInteger length = [data length];
+  NSUInteger idLength, paddedLength, rangeCount, n;
+  const uint32_t *ranges;
+
+  if (length < sizeof (*header)
+      || NSSwapBigIntToHost (header->magic) != DRAG_DATA_MAGIC
+      || NSSwapBigIntToHost (header->version) != DRAG_DATA_VERSION)
+    return NO;
+
+  idLength = NSSwapBigIntToHost (header->idLength);
+  paddedLength = (idLength + 3) & ~3;
+  rangeCount = NSSwapBigIntToHost (header->rangeCount);
+  length -= sizeof (*header);
+
+  if (length < paddedLength
+      || (length - paddedLength) / (2 * sizeof (uint32_t)) < rangeCount)
+    return NO;
+
+  if (viewID) {
+    *viewID = [[[NSString alloc] initWithBytes:header + 1
+                                        length:idLength
+                                      encoding:NSUTF8StringEncoding]
+                autorelease];
+  }
+
+  if (indices) {
+    NSMutableIndexSet *result = [NSMutableIndexSet indexSet];
+
+    ranges = (const uint32_t *)((const char *)(header + 1) + paddedLength);
+    for (n = 0; n < rangeCount; ++n) {
+      uint32_t location = NSSwapBigIntToHost (ranges[2 * n]);
+      uint32_t rangeLength = NSSwapBigIntToHost (ranges[2 * n + 1]);
+
+      if (rangeLength > UINT32_MAX - location)
+        return NO;
+
+      if (location >= indexLimit)
+        continue;
+      if (rangeLength > indexLimit - location)
+        rangeLength = indexLimit - location;
+
+      [result addIndexesInRange:NSMakeRange (location, rangeLength)];
+    }
+
+    *indices = result;
+  }
+
+  return YES;
+}
+
+BOOL
+CSIconViewDecodeDragData (NSData     *data,
+                          NSString   **viewID,
+                          NSIndexSet **indices)
+{
+  return decodeDragData (data, viewID, indices, (NSUInteger)UINT32_MAX);
+}
+
+/* The data source's own pasteboard types are promised when the drag
+   starts, and only written if a drop target asks for them.  The data
+   source writes all of its types in one go, so we only ask it once. */
+- (void)pasteboard:(NSPasteboard *)sender provideDataForType:(NSString *)type
+{
+  UNUSED (type);
+
+  if (dragItemIndices && !providedDragItemData
+      && [dataSource respondsToSelector:
+                       @selector(iconView:writeItemData:toPasteboard:)]) {
+    providedDragItemData = YES;
+    [dataSource iconView:self writeItemData:dragItemIndices toPasteboard:sender];
+  }
+}
+
+- (void)pasteboardChangedOwner:(NSPasteboard *)sender
+{
+  UNUSED (sender);
+
+  [dragItemIndices release];
+  dragItemIndices = nil;
+  providedDragItemData = NO;
+}
+
 - (void)setDraggingSourceOperationMask:(unsigned)mask forLocal:(BOOL)isLocal
 {
   if (isLocal)
@@ -1891,38 +3607,91 @@ static NSString * const kFont = @"kFont";
   CSIconViewItem *item;
 
   while ((item = [itemEnum nextObject])) {
-    unsigned state = [item state];
-    NSPoint itemPos;
-    NSRect frame;
+    unsigned ndx = [item index];
 
-    if (state & kCSIVItemDisabledMask)
+    if (itemStore->states[ndx] & kCSIVItemDisabledMask)
       continue;
 
-    itemPos = [item position];
-    frame = NSMakeRect (itemPos.x, itemPos.y, gridSize.width, gridSize.height);
-    
-    if (allowsCustomSizes && (state & kCSIVItemCustomSizeMask)) {
-      [renderer setIconSize:[item customIconSize]];
-      frame.size = [item customSize];
-    } else {
-      [renderer setIconSize:iconSize];
-    }
-    
-    [renderer setIcon:[item icon]];
-    [renderer setTitle:[item title]];
-
-    if ([renderer intersectsWithRect:NSMakeRect (point.x, point.y, 1, 1)
-                    ifDrawnWithFrame:frame
-                         highlighted:state & kCSIVItemSelectedMask
-                         textOnRight:([self labelPosition]
-                                      == CSLabelPositionRight)]) {
+    if ([self itemAtIndex:ndx
+           intersectsRect:NSMakeRect (point.x, point.y, 1, 1)])
       break;
-    }      
   }
 
   return item;
 }
 
+- (void)invalidateHitRegions
+{
+  if (itemStore)
+    CSIconViewItemStoreInvalidateHitRegions (itemStore);
+}
+
+/* Hit regions are worked out by the renderer the first time we need them
+   and then kept in the item store until something that affects them
+   changes; that way, clicks and rubber-band selection are purely
+   geometric.  The title is laid out with the attributes it has when the
+   item isn't selected, so that selecting an item doesn't throw its region
+   away. */
+- (const CSIconHitRegion *)hitRegionOfItemAtIndex:(unsigned)ndx
+{
+  CSIconHitRegion *region = itemStore->hitRegions[ndx];
+  CSIconViewItem *item;
+  unsigned state;
+  NSSize frameSize;
+
+  if (region)
+    return region;
+
+  item = itemStore->items[ndx];
+  state = itemStore->states[ndx];
+
+  if (allowsCustomSizes && (state & kCSIVItemCustomSizeMask))
+    [renderer setIconSize:itemStore->customIconSizes[ndx]];
+  else
+    [renderer setIconSize:iconSize];
+  
+  [renderer setIcon:[item icon]];
+  [renderer setTitle:[item title]];
+  [renderer setVariant:((state & kCSIVItemOpenMask)
+                        ? kCSOpenIconVariant : kCSNormalIconVariant)];
+
+  if (state & kCSIVItemDisabledMask)
+    [renderer setTitleAttributes:mediumTextAttributes];
+  else if ((state & kCSIVItemLabelledMask) && ![item labelColorIsLight])
+    [renderer setTitleAttributes:lightTextAttributes];
+  else
+    [renderer setTitleAttributes:darkTextAttributes];
+
+  frameSize = CSIconViewItemStoreSizeAtIndex (itemStore, ndx, gridSize,
+                                              allowsCustomSizes);
+  region = [renderer newHitRegionForFrameSize:frameSize
+                                  textOnRight:(labelPosition
+                                               == CSLabelPositionRight)];
+
+  if (!region) {
+    [NSException raise:@"CSOutOfMemory"
+		format:@"%@",
+      NSLocalizedString (@"Not enough memory.",
+                         @"Not enough memory.")];
+  }
+
+  itemStore->hitRegions[ndx] = region;
+
+  return region;
+}
+
+- (BOOL)itemAtIndex:(unsigned)ndx intersectsRect:(NSRect)rect
+{
+  const CSIconHitRegion *region = [self hitRegionOfItemAtIndex:ndx];
+  NSPoint origin = itemStore->positions[ndx];
+
+  return CSIconHitRegionIntersectsRect (region,
+                                        NSOffsetRect (rect,
+                                                      -origin.x, -origin.y),
+                                        (itemStore->states[ndx]
+                                         & kCSIVItemSelectedMask) != 0);
+}
+
 - (NSDragOperation)draggingEntered:(id <NSDraggingInfo>)sender
 {
   NSPasteboard *pboard;
@@ -1951,11 +3720,12 @@ static NSString * const kFont = @"kFont";
   if (op == NSDragOperationNone
       && [[pboard types] containsObject:CSIconViewInternalDragData]) {
     NSData *data = [pboard dataForType:CSIconViewInternalDragData];
-    NSDictionary *result = [NSKeyedUnarchiver unarchiveObjectWithData:data];
+    NSString *viewID = nil;
 
     isDraggingBackToSelf = YES;
 
-    if ([[result objectForKey:kCSIconView] isEqualTo:[self iconViewUniqueID]]) {
+    if (CSIconViewDecodeDragData (data, &viewID, NULL)
+        && [viewID isEqualToString:[self iconViewUniqueID]]) {
       if (sourceDragMask & NSDragOperationMove)
         return NSDragOperationMove;
     }
@@ -2004,12 +3774,15 @@ static NSString * const kFont = @"kFont";
   NSPasteboard *pboard = [sender draggingPasteboard];
   NSDragOperation sourceDragMask = [sender draggingSourceOperationMask];
   NSData *data = [pboard dataForType:CSIconViewInternalDragData];
-  NSDictionary *result = [NSKeyedUnarchiver unarchiveObjectWithData:data];
+  NSString *viewID = nil;
+  NSIndexSet *indices = nil;
 
-  if (!data || autoArrangesItems || !(sourceDragMask & NSDragOperationMove))
+  // Only ever move our own items, and only ones we actually have
+  if (!data || autoArrangesItems || !(sourceDragMask & NSDragOperationMove)
+      || !decodeDragData (data, &viewID, &indices, itemStore->count)
+      || ![viewID isEqualToString:[self iconViewUniqueID]])
     return NO;
 
-  NSIndexSet *indices = [result objectForKey:kCSIconViewItems];
   NSRect selectedItemRect = [self boundingRectOfSelectedItems];
   NSPoint location = [self convertPoint:[sender draggedImageLocation]
                                fromView:nil];
@@ -2019,23 +3792,32 @@ static NSString * const kFont = @"kFont";
                                 location.y - origLocation.y);
   NSRect newSelectedItemRect = NSOffsetRect (selectedItemRect,
                                              offset.x, offset.y);
-  NSUInteger ndx;
   NSPoint globalOffset = NSZeroPoint;
-  
-  for (ndx = [indices firstIndex]; ndx != NSNotFound;
-       ndx = [indices indexGreaterThanIndex:ndx]) {
-    CSIconViewItem *item = [items objectAtIndex:ndx];
-    NSRect itemFrame;
-        
-    itemFrame.origin = [item position];
-    
-    if (allowsCustomSizes && ([item state] & kCSIVItemCustomSizeMask))
-      itemFrame.size = [item customSize];
-    else
-      itemFrame.size = gridSize;
+  NSUInteger total = [indices count];
+  NSUInteger *ndxs = (NSUInteger *)malloc (sizeof (NSUInteger) * (total + 1));
+  id *movedItems = (id *)malloc (sizeof (id) * (total + 1));
+  NSRect *rects = (NSRect *)malloc (sizeof (NSRect) * (total + 1));
+  NSUInteger n, count;
+
+  if (!ndxs || !movedItems || !rects) {
+    free (ndxs);
+    free (movedItems);
+    free (rects);
+    [NSException raise:@"CSOutOfMemory"
+		format:@"%@",
+      NSLocalizedString (@"Not enough memory.",
+                         @"Not enough memory.")];
+  }
 
-    [quadTree removeObject:item];
+  /* Work out all of the new frames first, so that we can update the quad
+     tree in one go rather than an item at a time */
+  total = [indices getIndexes:ndxs maxCount:total inIndexRange:NULL];
+  for (n = 0, count = 0; n < total; ++n) {
+    NSUInteger ndx = ndxs[n];
+    NSRect itemFrame;
 
+    itemFrame = CSIconViewItemStoreFrameAtIndex (itemStore, ndx, gridSize,
+                                                 allowsCustomSizes);
     itemFrame.origin.x += offset.x;
     itemFrame.origin.y += offset.y;
         
@@ -2052,33 +3834,51 @@ static NSString * const kFont = @"kFont";
       globalOffset.x = -itemFrame.origin.x;
     if (itemFrame.origin.y < -globalOffset.y)
       globalOffset.y = -itemFrame.origin.y;
-    
-    [item setPosition:itemFrame.origin];
-    [quadTree addObject:item withBounds:itemFrame];
+
+    movedItems[count] = itemStore->items[ndx];
+    rects[count] = itemFrame;
+    ndxs[count++] = ndx;
+  }
+
+  @try {
+    BOOL rebuild = (globalOffset.x != 0.0 || globalOffset.y != 0.0
+                    || (count * BULK_MOVE_REBUILD_FRACTION 
+                        >= itemStore->count));
+
+    if (!rebuild) {
+      for (n = 0; n < count; ++n) {
+        NSRect oldFrame = CSIconViewItemStoreFrameAtIndex (itemStore, ndxs[n],
+                                                           gridSize,
+                                                           allowsCustomSizes);
+
+        [quadTree removeObject:movedItems[n] inRect:oldFrame];
+      }
+    }
+
+    for (n = 0; n < count; ++n)
+      itemStore->positions[ndxs[n]] = rects[n].origin;
+
+    if (!rebuild)
+      [quadTree addObjects:movedItems withBounds:rects count:count];
+    else if (globalOffset.x == 0.0 && globalOffset.y == 0.0)
+      [self reloadQuadTree];
+  } @finally {
+    free (ndxs);
+    free (movedItems);
+    free (rects);
   }
 
   /* If we tried to move items off the top or left of the view, offset all
      the other items instead */
   if (globalOffset.x != 0.0 || globalOffset.y != 0.0) {
-    NSEnumerator *itemEnum = [items objectEnumerator];
-    CSIconViewItem  *item;
+    unsigned n, count = itemStore->count;
     
-    [quadTree removeAllObjects];
-    
-    while ((item = [itemEnum nextObject])) {
-      NSRect itemFrame;
-      itemFrame.origin = [item position];
-      if (allowsCustomSizes && ([item state] & kCSIVItemCustomSizeMask))
-        itemFrame.size = [item customSize];
-      else
-        itemFrame.size = gridSize;
-      
-      itemFrame.origin.x += globalOffset.x;
-      itemFrame.origin.y += globalOffset.y;
-      
-      [item setPosition:itemFrame.origin];
-      [quadTree addObject:item withBounds:itemFrame];
+    for (n = 0; n < count; ++n) {
+      itemStore->positions[n].x += globalOffset.x;
+      itemStore->positions[n].y += globalOffset.y;
     }
+
+    [self reloadQuadTree];
     
     newSelectedItemRect = [self boundingRectOfSelectedItems];
     
@@ -2138,10 +3938,19 @@ static NSString * const kFont = @"kFont";
 
 - (NSRect)boundingRectOfItem:(CSIconViewItem *)item
 {
-  unsigned state = [item state];
-  NSPoint pos = [item position];
+  unsigned ndx = [item index];
+  unsigned state;
+  NSPoint pos;
   NSSize size;
   
+  if (CSIconViewItemStoreHasItem (itemStore, item, ndx)) {
+    return CSIconViewItemStoreFrameAtIndex (itemStore, ndx, gridSize,
+                                            allowsCustomSizes);
+  }
+
+  state = [item state];
+  pos = [item position];
+
   if (allowsCustomSizes && (state & kCSIVItemCustomSizeMask))
     size = [item customSize];
   else
@@ -2150,55 +3959,83 @@ static NSString * const kFont = @"kFont";
   return NSMakeRect (pos.x, pos.y, size.width, size.height);
 }
 
+/* The indices of our items are gathered up and handed to the item store in
+   one go, so that it can compute the bounding rectangle in parallel when
+   there are a lot of them; if the collection is every item, it needn't
+   even look at indices */
 - (NSRect)boundingRectOfItems:(id)collection
 {
+  unsigned storeCount = itemStore->count;
   NSRect itemRect = NSZeroRect;
-  
-  if ([collection respondsToSelector:@selector(objectEnumerator)]) {
-    NSEnumerator *itemEnum = [collection objectEnumerator];
-    CSIconViewItem *item;
-    
-    /* Compute a rectangle that surrounds all of the selected items
-       in this view. */
-    while ((item = [itemEnum nextObject])) {
-      unsigned state = [item state];
-      NSPoint pos = [item position];
-      NSSize size;
-      
-      if (allowsCustomSizes && (state & kCSIVItemCustomSizeMask))
-        size = [item customSize];
-      else
-        size = gridSize;
-      
-      itemRect = NSUnionRect (itemRect,
-                                   NSMakeRect (pos.x, pos.y,
-                                               size.width, size.height));
+  NSUInteger *indices;
+  NSUInteger count = 0;
+
+  if (collection == items
+      || (collection == selectedItems && storeCount
+          && [selectedItems count] == storeCount)
+      || ([collection isKindOfClass:[NSIndexSet class]]
+          && storeCount
+          && [collection count] == storeCount
+          && [collection containsIndexesInRange:NSMakeRange (0, storeCount)]))
+    return CSIconViewItemStoreBoundingRect (itemStore, NULL, 0, gridSize,
+                                            allowsCustomSizes);
+
+  if (![collection respondsToSelector:@selector(objectEnumerator)]
+      && ![collection isKindOfClass:[NSIndexSet class]]) {
+    [NSException raise:@"CSBadArgumentException"
+                format:@"Object passed into -boundingRectOfItems: must be a collection."];
+  }
+
+  if (![collection count])
+    return NSZeroRect;
+
+  indices = (NSUInteger *)malloc (sizeof (NSUInteger) * [collection count]);
+
+  if (!indices) {
+    [NSException raise:@"CSOutOfMemory"
+		format:@"%@",
+      NSLocalizedString (@"Not enough memory.",
+                         @"Not enough memory.")];
+  }
+
+  @try {
+    if ([collection respondsToSelector:@selector(objectEnumerator)]) {
+      NSEnumerator *itemEnum = [collection objectEnumerator];
+      CSIconViewItem *item;
+
+      /* Compute a rectangle that surrounds all of the selected items
+         in this view. */
+      while ((item = [itemEnum nextObject])) {
+        unsigned ndx = [item index];
+
+        if (!CSIconViewItemStoreHasItem (itemStore, item, ndx)) {
+          // Not one of ours, so ask the item
+          itemRect = NSUnionRect (itemRect, [self boundingRectOfItem:item]);
+          continue;
+        }
+
+        indices[count++] = ndx;
+      }
+    } else {
+      NSRange range = NSMakeRange (0, storeCount);
+
+      count = [collection getIndexes:indices
+                            maxCount:[collection count]
+                        inIndexRange:&range];
     }
-  } else if ([collection isKindOfClass:[NSIndexSet class]]) {
-    NSUInteger ndx;
-    
-    for (ndx = [collection firstIndex]; ndx != NSNotFound;
-         ndx = [collection indexGreaterThanIndex:ndx]) {
-      CSIconViewItem *item = [items objectAtIndex:ndx];
-      
-      unsigned state = [item state];
-      NSPoint pos = [item position];
-      NSSize size;
-      
-      if (allowsCustomSizes && (state & kCSIVItemCustomSizeMask))
-        size = [item customSize];
-      else
-        size = gridSize;
-      
+
+    if (count) {
       itemRect = NSUnionRect (itemRect,
-                              NSMakeRect (pos.x, pos.y,
-                                          size.width, size.height));
+                              CSIconViewItemStoreBoundingRect (itemStore,
+                                                               indices,
+                                                               count,
+                                                               gridSize,
+                                                               allowsCustomSizes));
     }
-  } else {
-    [NSException raise:@"CSBadArgumentException"
-                format:@"Object passed into -boundingRectOfItems: must be a collection."];
+  } @finally {
+    free (indices);
   }
-  
+
   return itemRect;
 }
 
@@ -2212,30 +4049,78 @@ static NSString * const kFont = @"kFont";
   return [self imageOfSelectedItemsInRect:[self boundingRectOfSelectedItems]];
 }
 
+/* Only the selected items are drawn, so this costs the same however many
+   unselected items there are around them.  The bitmap is never more than
+   maxDragImageSize pixels; larger rects are scaled down to fit. */
 - (NSImage *)imageOfSelectedItemsInRect:(NSRect)selectionRect
 {
   NSImage *image;
+  NSBitmapImageRep *rep;
+  NSGraphicsContext *context;
   NSAffineTransform *transform;
-  NSColor *realBackground = [self backgroundColor];
-  
-  transform = [NSAffineTransform transform];
-  [transform translateXBy:-selectionRect.origin.x yBy:-selectionRect.origin.y];
+  BOOL isKeyView = ([[self window] isKeyWindow]
+                    && [[self window] firstResponder] == self);
+  CGFloat scale = 1.0;
+  NSInteger pixelsWide, pixelsHigh;
+  NSUInteger ndx;
   
+  if (maxDragImageSize.width > 0 && maxDragImageSize.height > 0) {
+    if (selectionRect.size.width * scale > maxDragImageSize.width)
+      scale = maxDragImageSize.width / selectionRect.size.width;
+    if (selectionRect.size.height * scale > maxDragImageSize.height)
+      scale = maxDragImageSize.height / selectionRect.size.height;
+  }
+
+  pixelsWide = ceil (selectionRect.size.width * scale);
+  pixelsHigh = ceil (selectionRect.size.height * scale);
+
   image = [[[NSImage alloc] initWithSize:selectionRect.size] autorelease];
+
+  if (pixelsWide < 1 || pixelsHigh < 1)
+    return image;
   
-  [image setFlipped:YES];
-  [image lockFocus];
-  
-  backgroundColor = [NSColor clearColor];
-  drawOnlySelected = YES;
-  [transform concat];
-  [self drawRect:selectionRect];
+  rep = [NSBitmapImageRep premultipliedRGBARepWithPixelsWide:pixelsWide
+                                                  pixelsHigh:pixelsHigh];
+
+  if (!rep) {
+    [NSException raise:@"CSOutOfMemory"
+		format:@"%@",
+      NSLocalizedString (@"Not enough memory.",
+                         @"Not enough memory.")];
+  }
+
+  // Our co-ordinates are flipped, so the text needs a flipped context
+  context = [NSGraphicsContext graphicsContextWithBitmapImageRep:rep];
+  context = [NSGraphicsContext graphicsContextWithGraphicsPort:
+                                 [context graphicsPort]
+                                                     flipped:YES];
+
+  transform = [NSAffineTransform transform];
+  [transform translateXBy:0.0 yBy:pixelsHigh];
+  [transform scaleXBy:scale yBy:-scale];
+  [transform translateXBy:-selectionRect.origin.x
+                      yBy:-selectionRect.origin.y];
   
-  [image unlockFocus];
-  [image setFlipped:NO];
+  [NSGraphicsContext saveGraphicsState];
+  [NSGraphicsContext setCurrentContext:context];
+  @try {
+    [transform concat];
+
+    for (ndx = [selectedItemIndices firstIndex]; ndx != NSNotFound;
+         ndx = [selectedItemIndices indexGreaterThanIndex:ndx]) {
+      NSRect frame = CSIconViewItemStoreFrameAtIndex (itemStore, ndx,
+                                                      gridSize,
+                                                      allowsCustomSizes);
+
+      if (NSIntersectsRect (frame, selectionRect))
+        [self drawItemAtIndex:ndx highlighted:YES inKeyView:isKeyView];
+    }
+  } @finally {
+    [NSGraphicsContext restoreGraphicsState];
+  }
 
-  backgroundColor = realBackground;
-  drawOnlySelected = NO;
+  [rep setSize:selectionRect.size];
+  [image addRepresentation:rep];
   
   return image;
 }
@@ -2449,6 +4334,90 @@ static NSString * const kFont = @"kFont";
   keyboardMovementDirection = CSNoKeyboardMovement;
 }
 
+/* Returns YES if the key event is plain text, for type-select */
+static BOOL
+isTypeSelectEvent (NSEvent *evt)
+{
+  NSString *chars = [evt characters];
+  NSUInteger n, length = [chars length];
+
+  if (!length || ([evt modifierFlags] & (NSCommandKeyMask | NSControlKeyMask)))
+    return NO;
+
+  for (n = 0; n < length; ++n) {
+    unichar ch = [chars characterAtIndex:n];
+
+    // Control characters, delete and the function key range
+    if (ch < 0x20 || ch == 0x7f || (ch >= 0xf700 && ch <= 0xf8ff))
+      return NO;
+  }
+
+  return YES;
+}
+
+/* Arrow keys go to our -moveUp: and friends; typing goes to type-select.
+   Everything else (Escape, Delete, Return, Tab and so on) carries on up
+   the responder chain as it would if we didn't implement -keyDown:. */
+- (void)keyDown:(NSEvent *)evt
+{
+  NSString *chars = [evt charactersIgnoringModifiers];
+  unichar ch = [chars length] == 1 ? [chars characterAtIndex:0] : 0;
+
+  if (ch == NSUpArrowFunctionKey || ch == NSDownArrowFunctionKey
+      || ch == NSLeftArrowFunctionKey || ch == NSRightArrowFunctionKey
+      || isTypeSelectEvent (evt))
+    [self interpretKeyEvents:[NSArray arrayWithObject:evt]];
+  else
+    [super keyDown:evt];
+}
+
+- (void)insertText:(id)string
+{
+  NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+
+  if ([string isKindOfClass:[NSAttributedString class]])
+    string = [string string];
+
+  if (!typeSelectString)
+    typeSelectString = [[NSMutableString alloc] init];
+
+  if (now - lastTypeSelectTime > TYPE_SELECT_TIMEOUT)
+    [typeSelectString setString:@""];
+
+  [typeSelectString appendString:string];
+  lastTypeSelectTime = now;
+
+  [self selectItemWithTitlePrefix:typeSelectString];
+}
+
+- (BOOL)selectItemWithTitlePrefix:(NSString *)prefix
+{
+  CSIconViewItem *item;
+  NSUInteger ndx;
+
+  if (!titleIndex)
+    titleIndex = [[CSTitleIndex alloc] init];
+
+  if (!titleIndexIsValid) {
+    [titleIndex setTitlesOfItems:itemStore->items count:itemStore->count];
+    titleIndexIsValid = YES;
+  }
+
+  ndx = [titleIndex indexOfFirstItemWithPrefix:prefix];
+
+  if (ndx == NSNotFound)
+    return NO;
+
+  item = itemStore->items[ndx];
+
+  [self deselectAll];
+  [self selectItem:item];
+  [self setFocusedItem:item];
+  [self scrollRectToVisible:[self boundingRectOfItem:item]];
+
+  return YES;
+}
+
 - (BOOL)performKeyEquivalent:(NSEvent *)evt
 {
   NSString *chars = [evt charactersIgnoringModifiers];
@@ -2559,103 +4528,55 @@ findItemAtEdge (id collection, RelativePosition pos)
   return bestItem;
 }
 
+/* The same, but for every item in the view.  The quad tree caches the extent
+   of each of its nodes, so this doesn't need to look at every item. */
+static CSIconViewItem *
+findItemAtEdgeOfTree (CSRectQuadTree *quadTree, RelativePosition pos)
+{
+  static const CSQuadTreeDirection treeDirections[] = {
+    CSQuadTreeMinYDirection,	// kTopmost
+    CSQuadTreeMinXDirection,	// kLeftmost
+    CSQuadTreeMaxYDirection,	// kBottommost
+    CSQuadTreeMaxXDirection	// kRightmost
+  };
+
+  return [quadTree extremeObjectInDirection:treeDirections[pos]
+                                     filter:NULL
+                                    context:NULL];
+}
+
 /* Given a rectangle and a direction, find the next item in that direction */
 typedef enum {
   kLeft, kRight, kUp, kDown
 } Direction;
 
+/* Used to skip disabled items during the quad tree search */
+static BOOL
+isEnabledItem (id item, void *context)
+{
+  UNUSED (context);
+  return !([item state] & kCSIVItemDisabledMask);
+}
+
 static CSIconViewItem *
 findItemInDirectionFromRect (CSRectQuadTree *quadTree,
                              NSRect rect,
                              Direction direction)
 {
-  NSRect bounds = [quadTree bounds];
-  NSPoint origPos = rect.origin;
-  
-  switch (direction) {
-  case kUp:
-    rect.size.height = NSMinY (rect) - NSMinY (bounds);
-    rect.origin.y = NSMinY (bounds);
-    break;
-  case kDown:
-    rect.size.height = NSMaxY (bounds) - rect.origin.y;
-    break;
-  case kLeft:
-    rect.size.width = NSMinX (rect) - NSMinX (bounds);
-    rect.origin.x = NSMinX (bounds);
-    break;
-  case kRight:
-    rect.size.width = NSMaxY (bounds) - rect.origin.x;
-    break; 
-  }
-  
-  NSSet *possibleItems = [quadTree objectsIntersectingRect:rect];
-  NSEnumerator *itemEnum = [possibleItems objectEnumerator];
-  CSIconViewItem *bestItem = nil, *item;
-  NSPoint bestPos = NSZeroPoint;
-  
-  /* Find the item closest to being next to the selected item.  We break
-     ties in the upward/leftward direction. */
-  while ((item = [itemEnum nextObject])) {
-    NSPoint itemPos = [item position];
-    
-    // Ignore disabled items
-    if ([item state] & kCSIVItemDisabledMask)
-      continue;
-    
-    // Make sure we actually move
-    switch (direction) {
-    case kUp:
-      if (itemPos.y >= origPos.y)
-        continue;
-      break;
-    case kDown:
-      if (itemPos.y <= origPos.y)
-        continue;
-      break;
-    case kLeft:
-      if (itemPos.x >= origPos.x)
-        continue;
-      break;
-    case kRight:
-      if (itemPos.x <= origPos.x)
-        continue;
-      break;
-    }
-    
-    if (!bestItem) {
-      bestPos = itemPos;
-      bestItem = item;
-    } else {
-      BOOL isBest = NO;
-      
-      switch (direction) {
-      case kUp:
-        isBest = itemPos.y > bestPos.y || (itemPos.y == bestPos.y
-                                           && itemPos.x < bestPos.x);
-        break;
-      case kDown:
-        isBest = itemPos.y < bestPos.y || (itemPos.y == bestPos.y
-                                           && itemPos.x < bestPos.x);
-        break;
-      case kLeft:
-        isBest = itemPos.x > bestPos.x || (itemPos.x == bestPos.x
-                                           && itemPos.y < bestPos.y);
-        break;
-      case kRight:
-        isBest = itemPos.x < bestPos.x || (itemPos.x == bestPos.x
-                                           && itemPos.y < bestPos.y);
-        break;
-      }
-      
-      if (isBest) {
-        bestPos = itemPos;
-        bestItem = item;
-      }
-    }
-  }
-  
-  return bestItem;
+  /* The view is flipped, so "up" is towards smaller y.  The quad tree breaks
+     ties in favour of the smaller co-ordinate on the other axis, i.e. in the
+     upward/leftward direction. */
+  static const CSQuadTreeDirection treeDirections[] = {
+    CSQuadTreeMinXDirection,	// kLeft
+    CSQuadTreeMaxXDirection,	// kRight
+    CSQuadTreeMinYDirection,	// kUp
+    CSQuadTreeMaxYDirection	// kDown
+  };
+
+  return [quadTree nearestObjectInDirection:treeDirections[direction]
+                                   fromRect:rect
+                                     filter:isEnabledItem
+                                    context:NULL];
 }
 
 - (void)moveDown:(id)sender
@@ -2688,7 +4609,7 @@ findItemInDirectionFromRect (CSRectQuadTree *quadTree,
       nextItem = findItemInDirectionFromRect (quadTree, rect, kDown);
     }
   } else {
-    nextItem = findItemAtEdge (items, kTopmost);
+    nextItem = findItemAtEdgeOfTree (quadTree, kTopmost);
   }
   
   if (!nextItem) {
@@ -2742,7 +4663,7 @@ findItemInDirectionFromRect (CSRectQuadTree *quadTree,
     
     nextItem = findItemInDirectionFromRect (quadTree, rect, kDown);
   } else {
-    nextItem = findItemAtEdge (items, kTopmost);
+    nextItem = findItemAtEdgeOfTree (quadTree, kTopmost);
   }
   
   if (!nextItem) {
@@ -2794,7 +4715,7 @@ findItemInDirectionFromRect (CSRectQuadTree *quadTree,
       nextItem = findItemInDirectionFromRect (quadTree, rect, kUp);     
     }
   } else {
-    nextItem = findItemAtEdge (items, kBottommost);
+    nextItem = findItemAtEdgeOfTree (quadTree, kBottommost);
   }
   
   if (!nextItem) {
@@ -2848,7 +4769,7 @@ findItemInDirectionFromRect (CSRectQuadTree *quadTree,
     
     nextItem = findItemInDirectionFromRect (quadTree, rect, kUp);
   } else {
-    nextItem = findItemAtEdge (items, kBottommost);
+    nextItem = findItemAtEdgeOfTree (quadTree, kBottommost);
   }
   
   if (!nextItem) {
@@ -2900,7 +4821,7 @@ findItemInDirectionFromRect (CSRectQuadTree *quadTree,
       nextItem = findItemInDirectionFromRect (quadTree, rect, kLeft);      
     }
   } else {
-    nextItem = findItemAtEdge (items, kRightmost);
+    nextItem = findItemAtEdgeOfTree (quadTree, kRightmost);
   }
   
   if (!nextItem) {
@@ -2954,7 +4875,7 @@ findItemInDirectionFromRect (CSRectQuadTree *quadTree,
     
     nextItem = findItemInDirectionFromRect (quadTree, rect, kLeft);
   } else {
-    nextItem = findItemAtEdge (items, kRightmost);
+    nextItem = findItemAtEdgeOfTree (quadTree, kRightmost);
   }
   
   if (!nextItem) {
@@ -3006,7 +4927,7 @@ findItemInDirectionFromRect (CSRectQuadTree *quadTree,
       nextItem = findItemInDirectionFromRect (quadTree, rect, kRight);      
     }
   } else {
-    nextItem = findItemAtEdge (items, kLeftmost);
+    nextItem = findItemAtEdgeOfTree (quadTree, kLeftmost);
   }
   
   if (!nextItem) {
@@ -3060,7 +4981,7 @@ findItemInDirectionFromRect (CSRectQuadTree *quadTree,
     
     nextItem = findItemInDirectionFromRect (quadTree, rect, kRight);
   } else {
-    nextItem = findItemAtEdge (items, kLeftmost);
+    nextItem = findItemAtEdgeOfTree (quadTree, kLeftmost);
   }
   
   if (!nextItem) {
@@ -0,0 +1,491 @@
+//
+//  CSIconViewBench.m
+//  CSIconView
+//
+//  Created by Alastair Houghton on 16/03/2010.
+//  Copyright (c) 2005-2010 Coriolis Systems Limited
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+//
+
+/* A headless benchmark driver for CSIconView's hot paths.
+
+   Each benchmark writes a single line of JSON to stdout, e.g.
+
+     {"benchmark":"quadtree.query","items":10000,"ops":1000,
+      "ns_per_op":1234.5,"allocs_per_op":12.00,"peak_rss_bytes":12345678}
+
+   so that runs can be saved and compared.  Options are read via
+   NSUserDefaults, so you can pass e.g.
+
+     CSIconViewBench -sizes 1000,100000 -only quadtree -icon /path/to.icns
+
+   This doesn't need a window server; nothing here is put into a window.
+
+   The quad tree's consistency checks live in CSRectQuadTreeTest and
+   CSRectQuadTreeSnapshotTest rather than here. */
+
+#import <Cocoa/Cocoa.h>
+#import <CSIconView/CSIconView.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#if __APPLE__
+#include <mach/mach_time.h>
+#endif
+
+#define DEFAULT_SIZES	    @"1000,10000,100000,1000000"
+#define DEFAULT_ICON	    @"/System/Library/CoreServices/CoreTypes.bundle/" \
+			    @"Contents/Resources/GenericFolderIcon.icns"
+
+#define GRID_SIZE	    100.0f
+#define VIEWPORT_WIDTH	    1024.0f
+#define VIEWPORT_HEIGHT	    768.0f
+
+#define QUERY_COUNT	    1000
+#define RUBBER_BAND_COUNT   200
+#define RUBBER_BAND_STEPS   8
+#define ICON_DECODE_COUNT   100
+#define HIT_TEST_COUNT	    10000
+
+#pragma mark Measurement
+
+/* We count allocations using the malloc logger hook that malloc stack
+   logging uses; it's called for every allocation in every zone.  It isn't
+   available elsewhere, in which case we report null. */
+#if __APPLE__
+typedef void (malloc_logger_t)(uint32_t type, uintptr_t arg1, uintptr_t arg2,
+			       uintptr_t arg3, uintptr_t result,
+			       uint32_t num_hot_frames_to_skip);
+extern malloc_logger_t *malloc_logger;
+
+#define MALLOC_LOG_TYPE_ALLOCATE  2
+
+static volatile uint64_t allocationCount;
+
+static void
+countAllocations (uint32_t type, uintptr_t arg1, uintptr_t arg2,
+		  uintptr_t arg3, uintptr_t result,
+		  uint32_t num_hot_frames_to_skip)
+{
+  (void)arg1; (void)arg2; (void)arg3; (void)result;
+  (void)num_hot_frames_to_skip;
+
+  if (type & MALLOC_LOG_TYPE_ALLOCATE)
+    __sync_add_and_fetch (&allocationCount, 1);
+}
+
+#define HAVE_ALLOCATION_COUNTS 1
+#else
+#define HAVE_ALLOCATION_COUNTS 0
+#endif
+
+struct measurement {
+  uint64_t  startTime;
+  uint64_t  startAllocations;
+};
+
+static uint64_t
+currentNanoseconds (void)
+{
+#if __APPLE__
+  static mach_timebase_info_data_t timebase;
+
+  if (!timebase.denom)
+    mach_timebase_info (&timebase);
+
+  return mach_absolute_time () * timebase.numer / timebase.denom;
+#else
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+static unsigned long long
+peakResidentBytes (void)
+{
+  struct rusage usage;
+
+  getrusage (RUSAGE_SELF, &usage);
+
+#if __APPLE__
+  return usage.ru_maxrss;
+#else
+  return (unsigned long long)usage.ru_maxrss * 1024;
+#endif
+}
+
+static void
+beginMeasurement (struct measurement *m)
+{
+#if HAVE_ALLOCATION_COUNTS
+  m->startAllocations = allocationCount;
+#else
+  m->startAllocations = 0;
+#endif
+  m->startTime = currentNanoseconds ();
+}
+
+static void
+endMeasurement (struct measurement *m, const char *name,
+		unsigned items, unsigned ops)
+{
+  uint64_t elapsed = currentNanoseconds () - m->startTime;
+#if HAVE_ALLOCATION_COUNTS
+  uint64_t allocations = allocationCount - m->startAllocations;
+#endif
+
+  if (!ops)
+    ops = 1;
+
+#if HAVE_ALLOCATION_COUNTS
+  printf ("{\"benchmark\":\"%s\",\"items\":%u,\"ops\":%u,"
+	  "\"ns_per_op\":%.1f,\"allocs_per_op\":%.2f,"
+	  "\"peak_rss_bytes\":%llu}\n",
+	  name, items, ops, (double)elapsed / ops,
+	  (double)allocations / ops, peakResidentBytes ());
+#else
+  printf ("{\"benchmark\":\"%s\",\"items\":%u,\"ops\":%u,"
+	  "\"ns_per_op\":%.1f,\"allocs_per_op\":null,"
+	  "\"peak_rss_bytes\":%llu}\n",
+	  name, items, ops, (double)elapsed / ops, peakResidentBytes ());
+#endif
+
+  fflush (stdout);
+}
+
+#pragma mark Synthetic data
+
+/* Lay items out on a square-ish grid, as arrangeItems would */
+static NSRect
+itemRect (unsigned ndx, unsigned count)
+{
+  unsigned columns = (unsigned)ceil (sqrt ((double)count));
+
+  if (!columns)
+    columns = 1;
+
+  return NSMakeRect ((ndx % columns) * GRID_SIZE, (ndx / columns) * GRID_SIZE,
+		     GRID_SIZE, GRID_SIZE);
+}
+
+/* A simple deterministic generator, so that runs are comparable */
+static uint32_t randomState = 12345;
+
+static double
+nextRandom (void)
+{
+  randomState = randomState * 1103515245u + 12345u;
+  return (double)(randomState >> 8) / (double)(1u << 24);
+}
+
+static NSRect
+randomRectIn (NSRect bounds, NSSize size)
+{
+  return NSMakeRect (NSMinX (bounds) + nextRandom () * NSWidth (bounds),
+		     NSMinY (bounds) + nextRandom () * NSHeight (bounds),
+		     size.width, size.height);
+}
+
+@interface CSBenchDataSource : NSObject
+{
+  unsigned count;
+}
+
+- (id)initWithCount:(unsigned)count;
+
+@end
+
+@implementation CSBenchDataSource
+
+- (id)initWithCount:(unsigned)theCount
+{
+  if ((self = [super init]))
+    count = theCount;
+
+  return self;
+}
+
+- (unsigned)numberOfItemsInIconView:(CSIconView *)view
+{
+  (void)view;
+  return count;
+}
+
+- (CSIconViewItem *)iconView:(CSIconView *)view
+		 itemAtIndex:(unsigned)index
+{
+  (void)view;
+  return [CSIconViewItem iconViewItemWithIcon:nil
+					title:[NSString stringWithFormat:
+						 @"Item %u", index]];
+}
+
+- (NSArray *)iconViewAcceptedPasteboardTypesForDrop:(CSIconView *)view
+{
+  (void)view;
+  return [NSArray array];
+}
+
+- (NSArray *)iconViewPasteboardTypesForDrag:(CSIconView *)view
+{
+  (void)view;
+  return [NSArray array];
+}
+
+@end
+
+/* A mouse event at a point in the view's co-ordinates.  The view isn't in
+   a window, so "window" co-ordinates are those of the top of its view
+   hierarchy. */
+static NSEvent *
+mouseEvent (NSEventType type, CSIconView *view, NSPoint pos)
+{
+  return [NSEvent mouseEventWithType:type
+			    location:[view convertPoint:pos toView:nil]
+		       modifierFlags:0
+			   timestamp:0
+			windowNumber:0
+			     context:nil
+			 eventNumber:0
+			  clickCount:1
+			    pressure:1.0f];
+}
+
+#pragma mark Benchmarks
+
+static void
+benchmarkQuadTree (unsigned count)
+{
+  NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+  NSRect bounds = NSUnionRect (itemRect (0, count), itemRect (count - 1, count));
+  CSRectQuadTree *tree = [[CSRectQuadTree alloc] initWithBounds:bounds];
+  NSMutableArray *objects = [[NSMutableArray alloc] initWithCapacity:count];
+  struct measurement m;
+  unsigned n;
+
+  for (n = 0; n < count; ++n) {
+    NSObject *object = [[NSObject alloc] init];
+    [objects addObject:object];
+    [object release];
+  }
+
+  beginMeasurement (&m);
+  for (n = 0; n < count; ++n)
+    [tree addObject:[objects objectAtIndex:n] withBounds:itemRect (n, count)];
+  endMeasurement (&m, "quadtree.insert", count, count);
+
+  beginMeasurement (&m);
+  for (n = 0; n < QUERY_COUNT; ++n) {
+    NSAutoreleasePool *innerPool = [[NSAutoreleasePool alloc] init];
+    NSRect rect = randomRectIn (bounds, NSMakeSize (VIEWPORT_WIDTH,
+						    VIEWPORT_HEIGHT));
+
+    [tree objectsIntersectingRect:rect];
+    [innerPool release];
+  }
+  endMeasurement (&m, "quadtree.query", count, QUERY_COUNT);
+
+  beginMeasurement (&m);
+  for (n = 0; n < QUERY_COUNT; ++n) {
+    NSRect rect = randomRectIn (bounds, NSMakeSize (GRID_SIZE, GRID_SIZE));
+
+    [tree nearestObjectInDirection:CSQuadTreeMaxXDirection
+			  fromRect:rect
+			    filter:NULL
+			   context:NULL];
+  }
+  endMeasurement (&m, "quadtree.nearest", count, QUERY_COUNT);
+
+  beginMeasurement (&m);
+  for (n = 0; n < count; ++n)
+    [tree removeObject:[objects objectAtIndex:n] inRect:itemRect (n, count)];
+  endMeasurement (&m, "quadtree.remove", count, count);
+
+  [tree release];
+  [objects release];
+  [pool release];
+}
+
+static void
+benchmarkIconView (unsigned count)
+{
+  NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+  CSBenchDataSource *dataSource 
+    = [[CSBenchDataSource alloc] initWithCount:count];
+  CSIconView *view 
+    = [[CSIconView alloc] initWithFrame:NSMakeRect (0.0f, 0.0f, 
+						    VIEWPORT_WIDTH,
+						    VIEWPORT_HEIGHT)];
+  struct measurement m;
+  NSRect bounds;
+  unsigned n;
+
+  [view setAutoArrangesItems:NO];
+  [view setDataSource:dataSource];
+
+  beginMeasurement (&m);
+  [view reloadItems];
+  endMeasurement (&m, "view.reload", count, count);
+
+  beginMeasurement (&m);
+  [view arrangeItems];
+  endMeasurement (&m, "view.arrange", count, count);
+
+  bounds = [view bounds];
+
+  /* Rubber banding goes through the real mouse handling, which hit tests
+     each item on the edge of the band every time the mouse moves.  Bands
+     start from the corner of a grid cell, where there's no icon, so that
+     the mouse down doesn't start an icon drag instead. */
+  beginMeasurement (&m);
+  for (n = 0; n < RUBBER_BAND_COUNT; ++n) {
+    NSAutoreleasePool *innerPool = [[NSAutoreleasePool alloc] init];
+    NSRect rect = randomRectIn (bounds, NSMakeSize (VIEWPORT_WIDTH / 2,
+						    VIEWPORT_HEIGHT / 2));
+    NSPoint start = NSMakePoint (floor (NSMinX (rect) / GRID_SIZE)
+				 * GRID_SIZE + 1.0f,
+				 floor (NSMinY (rect) / GRID_SIZE)
+				 * GRID_SIZE + 1.0f);
+    unsigned step;
+
+    [view mouseDown:mouseEvent (NSLeftMouseDown, view, start)];
+
+    if (![[view selectedItems] count]) {
+      for (step = 1; step <= RUBBER_BAND_STEPS; ++step) {
+	NSPoint pos = NSMakePoint (start.x + (NSMaxX (rect) - start.x)
+				   * step / RUBBER_BAND_STEPS,
+				   start.y + (NSMaxY (rect) - start.y)
+				   * step / RUBBER_BAND_STEPS);
+
+	[view mouseDragged:mouseEvent (NSLeftMouseDragged, view, pos)];
+      }
+    }
+
+    [view mouseUp:mouseEvent (NSLeftMouseUp, view, start)];
+    [view deselectAll];
+    [innerPool release];
+  }
+  endMeasurement (&m, "view.rubberband", count, RUBBER_BAND_COUNT);
+
+  [view setDataSource:nil];
+  [view release];
+  [dataSource release];
+  [pool release];
+}
+
+static void
+benchmarkIcons (NSString *path)
+{
+  NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+  NSRect drawRect = NSMakeRect (0.0f, 0.0f, 64.0f, 64.0f);
+  struct measurement m;
+  CSIcon *icon;
+  unsigned n;
+
+  if (![[NSFileManager defaultManager] fileExistsAtPath:path]) {
+    fprintf (stderr, "CSIconViewBench: no icon at %s; skipping icon "
+	     "benchmarks\n", [path fileSystemRepresentation]);
+    [pool release];
+    return;
+  }
+
+  beginMeasurement (&m);
+  for (n = 0; n < ICON_DECODE_COUNT; ++n) {
+    NSAutoreleasePool *innerPool = [[NSAutoreleasePool alloc] init];
+
+    icon = [[CSIcon alloc] initWithContentsOfFile:path];
+    [icon variant:kCSNormalIconVariant wouldIntersectRect:drawRect
+    ifDrawnInRect:drawRect];
+    [icon release];
+    [innerPool release];
+  }
+  endMeasurement (&m, "icon.decode", 1, ICON_DECODE_COUNT);
+
+  icon = [[CSIcon alloc] initWithContentsOfFile:path];
+
+  beginMeasurement (&m);
+  for (n = 0; n < HIT_TEST_COUNT; ++n) {
+    NSRect rect = randomRectIn (drawRect, NSMakeSize (4.0f, 4.0f));
+
+    [icon variant:kCSNormalIconVariant wouldIntersectRect:rect
+    ifDrawnInRect:drawRect];
+  }
+  endMeasurement (&m, "icon.hittest", 1, HIT_TEST_COUNT);
+
+  [icon release];
+  [pool release];
+}
+
+static BOOL
+shouldRun (NSString *only, NSString *group)
+{
+  return !only || [only isEqualToString:group];
+}
+
+int
+main (int argc, const char **argv)
+{
+  NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+  NSUserDefaults *defaults = [NSUserDefaults standardUserDefaults];
+  NSString *sizes = [defaults stringForKey:@"sizes"];
+  NSString *iconPath = [defaults stringForKey:@"icon"];
+  NSString *only = [defaults stringForKey:@"only"];
+  NSEnumerator *sizeEnum;
+  NSString *size;
+
+  (void)argc; (void)argv;
+
+#if HAVE_ALLOCATION_COUNTS
+  malloc_logger = countAllocations;
+#endif
+
+  if (!sizes)
+    sizes = DEFAULT_SIZES;
+  if (!iconPath)
+    iconPath = DEFAULT_ICON;
+
+
+  sizeEnum = [[sizes componentsSeparatedByString:@","] objectEnumerator];
+  while ((size = [sizeEnum nextObject])) {
+    unsigned count = (unsigned)[size intValue];
+
+    if (!count)
+      continue;
+
+    if (shouldRun (only, @"quadtree"))
+      benchmarkQuadTree (count);
+    if (shouldRun (only, @"view"))
+      benchmarkIconView (count);
+  }
+
+  if (shouldRun (only, @"icon"))
+    benchmarkIcons (iconPath);
+
+#if HAVE_ALLOCATION_COUNTS
+  malloc_logger = NULL;
+#endif
+
+  [pool release];
+
+  return 0;
+}
@@ -36,7 +36,7 @@ enum {
   kCSIVItemDisabledMask	     = 0x0020,
 };
 
-@interface CSIconViewItem : NSObject
+@interface CSIconViewItem : NSObject <NSCopying>
 {
   unsigned     index;
   CSIcon       *icon;
@@ -53,6 +53,11 @@ enum {
   
   NSSize       customSize;
   NSSize       customIconSize;
+
+  /* If the item is in a view, its position, state and custom sizes live in
+     the view's item store (see CSIconViewItemStore.h), and the ivars above
+     are only used when it isn't. */
+  struct CSIconViewItemStore *store;
 }
 
 + (CSIconViewItem *)iconViewItem;
@@ -62,6 +67,10 @@ enum {
 - (id)initWithIcon:(CSIcon *)icon title:(NSString *)title;
 
 - (unsigned)index;
+
+/* An item that belongs to a view can only be moved to an empty slot; it
+   raises CSBadArgumentException otherwise.  To rearrange a view's items,
+   go through the view. */
 - (void)setIndex:(unsigned)ndx;
 
 - (CSIcon *)icon;
@@ -25,10 +25,20 @@
 //
 
 #import "CSIconViewItem.h"
+#import "CSIconViewItemStore.h"
 #import "NSColor+CSIconViewExtras.h"
 
 @implementation CSIconViewItem
 
+/* The store renumbers the items it has moved lazily, so check that our
+   index is current before using it to look into the store */
+static inline unsigned
+storeIndex (CSIconViewItem *item)
+{
+  CSIconViewItemStoreValidateIndex (item->store, item, item->index);
+  return item->index;
+}
+
 + (CSIconViewItem *)iconViewItem
 {
   return [[[CSIconViewItem alloc] init] autorelease];
@@ -52,8 +62,28 @@
   return self;
 }
 
+/* Copies share the icon, title and represented object, and start out
+   detached, with the same position, state and sizes as this item */
+- (id)copyWithZone:(NSZone *)zone
+{
+  CSIconViewItem *item = [[[self class] allocWithZone:zone]
+			   initWithIcon:icon title:title];
+
+  [item setRepresentedObject:representedObject];
+  [item setLabelColor:labelColor];
+  [item setLabelShadeColor:labelShadeColor];
+  [item setPosition:[self position]];
+  [item setState:[self state]];
+  [item setCustomSize:[self customSize]];
+  [item setCustomIconSize:[self customIconSize]];
+  item->index = [self index];
+
+  return item;
+}
+
 - (void)dealloc
 {
+  [self detachFromStore];
   [icon release];
   [title release];
   [labelColor release];
@@ -63,12 +93,29 @@
 
 - (unsigned)index
 {
+  if (store)
+    return storeIndex (self);
   return index;
 }
 
 - (void)setIndex:(unsigned)ndx
 {
-  index = ndx;
+  if (store && ndx != storeIndex (self)) {
+    CSIconViewItemStore *theStore = store;
+
+    /* Two items sharing a slot would write through to the same position,
+       state and sizes, so we only move into an empty one */
+    if (ndx >= theStore->count || theStore->items[ndx]) {
+      [NSException raise:@"CSBadArgumentException"
+		  format:@"Slot %u of the item store is out of range or "
+	@"belongs to another item.", ndx];
+    }
+
+    [self detachFromStore];
+    [self attachToStore:theStore atIndex:ndx];
+  } else {
+    index = ndx;
+  }
 }
 
 - (CSIcon *)icon
@@ -82,6 +129,9 @@
     CSIcon *oldIcon = icon;
     icon = [newIcon retain];
     [oldIcon release];
+
+    if (store)
+      CSIconViewItemStoreInvalidateHitRegion (store, storeIndex (self));
   }
 }
 
@@ -95,6 +145,9 @@
   NSString *oldTitle = title;
   title = [newTitle copy];
   [oldTitle release];
+
+  if (store)
+    CSIconViewItemStoreInvalidateHitRegion (store, storeIndex (self));
 }
 
 - (id)representedObject
@@ -113,40 +166,55 @@
 
 - (NSPoint)position
 {
+  if (store)
+    return store->positions[storeIndex (self)];
   return position;
 }
 
 - (void)setPosition:(NSPoint)newPos
 {
-  position = newPos;
+  if (store)
+    store->positions[storeIndex (self)] = newPos;
+  else
+    position = newPos;
 }
 
 - (unsigned)state
 {
+  if (store)
+    return store->states[storeIndex (self)];
   return state;
 }
 
 - (void)setState:(unsigned)newState
 {
-  state = newState;
+  if (store) {
+    unsigned ndx = storeIndex (self);
+
+    /* Selection doesn't change our hit region, but these do */
+    if ((store->states[ndx] ^ newState) & HIT_REGION_STATE_MASK)
+      CSIconViewItemStoreInvalidateHitRegion (store, ndx);
+    store->states[ndx] = newState;
+  } else
+    state = newState;
 }
 
 - (void)select
 {
-  state |= kCSIVItemSelectedMask;
+  [self setState:[self state] | kCSIVItemSelectedMask];
 }
 - (void)deselect
 {
-  state &= ~kCSIVItemSelectedMask;
+  [self setState:[self state] & ~kCSIVItemSelectedMask];
 }
 - (void)toggle
 {
-  state ^= kCSIVItemSelectedMask;
+  [self setState:[self state] ^ kCSIVItemSelectedMask];
 }
 
 - (void)removeFromCollectionIfDisabled:(id)collection
 {
-  if (state & kCSIVItemDisabledMask)
+  if ([self state] & kCSIVItemDisabledMask)
     [collection removeObject:self];
 }
 
@@ -158,8 +226,6 @@
 - (void)setLabelColor:(NSColor *)newColor
 {
   if (labelColor != newColor) {
-    CGFloat L, a, b, alpha;
-    
     NSColor *oldColor = labelColor;
     labelColor = [newColor retain];
     [oldColor release];
@@ -169,9 +235,10 @@
        colour.  If not, it isn't.  Note that this isn't the same as e.g.
        converting to HLS and looking at L; for instance, 100% yellow is a
        light colour, whereas 100% magenta or 100% blue are not. */
-    [labelColor getL:&L a:&a b:&b alpha:&alpha];
-    
-    labelColorIsLight = L > 50;
+    labelColorIsLight = labelColor && [labelColor lightness] > 50;
+
+    if (store)
+      CSIconViewItemStoreInvalidateHitRegion (store, storeIndex (self));
   }
 }
 
@@ -196,22 +263,96 @@
 
 - (NSSize)customSize
 {
+  if (store)
+    return store->customSizes[storeIndex (self)];
   return customSize;
 }
 
 - (void)setCustomSize:(NSSize)size
 {
-  customSize = size;
+  if (store) {
+    unsigned ndx = storeIndex (self);
+
+    store->customSizes[ndx] = size;
+    CSIconViewItemStoreInvalidateHitRegion (store, ndx);
+  } else
+    customSize = size;
 }
 
 - (NSSize)customIconSize
 {
+  if (store)
+    return store->customIconSizes[storeIndex (self)];
   return customIconSize;
 }
 
 - (void)setCustomIconSize:(NSSize)size
 {
-  customIconSize = size;
+  if (store) {
+    unsigned ndx = storeIndex (self);
+
+    store->customIconSizes[ndx] = size;
+    CSIconViewItemStoreInvalidateHitRegion (store, ndx);
+  } else
+    customIconSize = size;
+}
+
+@end
+
+@implementation CSIconViewItem (CSIconViewItemStore)
+
+- (CSIconViewItemStore *)store
+{
+  return store;
+}
+
+/* Move our geometry and state into the specified slot in a view's item
+   store; from now on, our accessors will use that instead. */
+- (void)attachToStore:(CSIconViewItemStore *)newStore atIndex:(unsigned)ndx
+{
+  if (store == newStore && index == ndx)
+    return;
+
+  [self detachFromStore];
+
+  store = newStore;
+  index = ndx;
+  CSIconViewItemStoreInvalidateHitRegion (store, ndx);
+  store->items[ndx] = self;
+  store->positions[ndx] = position;
+  store->customSizes[ndx] = customSize;
+  store->customIconSizes[ndx] = customIconSize;
+  store->states[ndx] = state;
+}
+
+/* Take a copy of our values from the store and stop using it */
+- (void)detachFromStore
+{
+  unsigned ndx;
+
+  if (!store)
+    return;
+
+  ndx = storeIndex (self);
+  position = store->positions[ndx];
+  customSize = store->customSizes[ndx];
+  customIconSize = store->customIconSizes[ndx];
+  state = store->states[ndx];
+
+  if (store->items[ndx] == self) {
+    store->items[ndx] = nil;
+    CSIconViewItemStoreInvalidateHitRegion (store, ndx);
+  }
+
+  store = NULL;
+}
+
+- (void)setIndexInStore:(unsigned)ndx
+{
+  NSAssert (store && store->items[ndx] == self,
+	    @"Item has not been moved to that slot.");
+
+  index = ndx;
 }
 
 @end
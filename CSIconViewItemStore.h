@@ -0,0 +1,171 @@
+//
+//  CSIconViewItemStore.h
+//  CSIconView
+//
+//  Created by Alastair Houghton on 14/03/2010.
+//  Copyright (c) 2005-2010 Coriolis Systems Limited
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+//
+
+#import <Cocoa/Cocoa.h>
+#import "CSIconViewItem.h"
+#import "CSIconRenderer.h"
+
+/* CSIconView keeps the geometry and state of its items in contiguous arrays,
+   indexed by item index, rather than asking each item for them.  Items that
+   belong to a view are "attached" to its store, at which point their
+   position, state and size accessors read and write the store directly;
+   when they are removed from the view they are detached again and take a
+   copy of their values with them.
+
+   The items array holds unretained back-pointers; the view's NSArray owns
+   the items.  The hit regions are computed lazily by the view and are
+   owned by the store; a NULL entry means the region needs recomputing.
+
+   Moving slots doesn't tell the items where they have gone; instead, the
+   items in slots from firstStaleSlot upwards may have out of date indices,
+   and are renumbered in a single pass when one of them next needs its
+   index (or when the view commits a batch of updates). */
+typedef struct CSIconViewItemStore {
+  unsigned	count, capacity;
+  unsigned	firstStaleSlot;
+  id		*items;
+  NSPoint	*positions;
+  NSSize	*customSizes;
+  NSSize	*customIconSizes;
+  unsigned	*states;
+  CSIconHitRegion **hitRegions;
+} CSIconViewItemStore;
+
+CSIconViewItemStore *CSIconViewItemStoreCreate (void);
+void CSIconViewItemStoreDestroy (CSIconViewItemStore *store);
+
+/* Detaches all of the items and empties the store */
+void CSIconViewItemStoreRemoveAllItems (CSIconViewItemStore *store);
+
+/* Sets the number of slots; new slots are zeroed.  Returns NO if we ran
+   out of memory. */
+BOOL CSIconViewItemStoreSetCount (CSIconViewItemStore *store,
+				  unsigned	      count);
+
+/* Opens up empty slots at the specified indices, which must be sorted and
+   are in terms of the store after the insertion.  Existing slots are
+   shifted up in blocks and their items marked for renumbering.  Returns NO if we ran
+   out of memory, in which case the store is unchanged. */
+BOOL CSIconViewItemStoreInsertSlots (CSIconViewItemStore *store,
+				     const NSUInteger	 *indices,
+				     unsigned		 count);
+
+/* Detaches the items in the specified slots (sorted, and in terms of the
+   store before the removal) and closes up the gaps. */
+void CSIconViewItemStoreRemoveSlots (CSIconViewItemStore *store,
+				     const NSUInteger	 *indices,
+				     unsigned		 count);
+
+/* Moves a slot, shifting the slots in between */
+void CSIconViewItemStoreMoveSlot (CSIconViewItemStore *store,
+				  unsigned	      fromIndex,
+				  unsigned	      toIndex);
+
+/* Tells the items in any stale slots their new indices */
+void CSIconViewItemStoreRenumberItems (CSIconViewItemStore *store);
+
+/* Makes sure an item that thinks it is at ndx knows its real index.  An
+   item that is still where it thinks it is needn't wait for the rest. */
+static inline void
+CSIconViewItemStoreValidateIndex (CSIconViewItemStore *store,
+				  id		      item,
+				  unsigned	      ndx)
+{
+  if (ndx >= store->firstStaleSlot
+      && (ndx >= store->count || store->items[ndx] != item))
+    CSIconViewItemStoreRenumberItems (store);
+}
+
+/* Changes to these state bits alter an item's hit region */
+#define HIT_REGION_STATE_MASK	(kCSIVItemCustomSizeMask | kCSIVItemOpenMask \
+				 | kCSIVItemDisabledMask		\
+				 | kCSIVItemLabelledMask)
+
+/* Throw away the cached hit region for a slot, or for every slot */
+void CSIconViewItemStoreInvalidateHitRegion (CSIconViewItemStore *store,
+					     unsigned		 ndx);
+void CSIconViewItemStoreInvalidateHitRegions (CSIconViewItemStore *store);
+
+/* Compute the union of the frames of the specified items.  If indices is
+   NULL, all of the items in the store are used. */
+NSRect CSIconViewItemStoreBoundingRect (const CSIconViewItemStore *store,
+					const NSUInteger	  *indices,
+					NSUInteger		  count,
+					NSSize			  gridSize,
+					BOOL			  allowsCustomSizes);
+
+/* Returns YES if the item is attached to the store at the specified index */
+static inline BOOL
+CSIconViewItemStoreHasItem (const CSIconViewItemStore *store,
+			    id			      item,
+			    unsigned		      ndx)
+{
+  return ndx < store->count && store->items[ndx] == item;
+}
+
+static inline NSSize
+CSIconViewItemStoreSizeAtIndex (const CSIconViewItemStore *store,
+				unsigned		  ndx,
+				NSSize			  gridSize,
+				BOOL			  allowsCustomSizes)
+{
+  if (allowsCustomSizes && (store->states[ndx] & kCSIVItemCustomSizeMask))
+    return store->customSizes[ndx];
+  return gridSize;
+}
+
+static inline NSRect
+CSIconViewItemStoreFrameAtIndex (const CSIconViewItemStore *store,
+				 unsigned		   ndx,
+				 NSSize			   gridSize,
+				 BOOL			   allowsCustomSizes)
+{
+  NSRect frame;
+
+  frame.origin = store->positions[ndx];
+  frame.size = CSIconViewItemStoreSizeAtIndex (store, ndx, gridSize,
+					       allowsCustomSizes);
+
+  return frame;
+}
+
+@interface CSIconViewItem (CSIconViewItemStore)
+
+- (CSIconViewItemStore *)store;
+- (void)attachToStore:(CSIconViewItemStore *)store atIndex:(unsigned)ndx;
+- (void)detachFromStore;
+
+/* Called when the store has moved our slot */
+- (void)setIndexInStore:(unsigned)ndx;
+
+@end
+
+/*
+ * Local Variables:
+ * mode: ObjC
+ * End:
+ *
+ */
@@ -0,0 +1,427 @@
+//
+//  CSIconViewItemStore.m
+//  CSIconView
+//
+//  Created by Alastair Houghton on 14/03/2010.
+//  Copyright (c) 2005-2010 Coriolis Systems Limited
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+//
+
+#import "CSIconViewItemStore.h"
+#import "CSParallel.h"
+
+/* Bounding rectangles of at least this many items are computed in
+   parallel, in chunks of at least this size */
+#define PARALLEL_BOUNDS_THRESHOLD   65536
+
+CSIconViewItemStore *
+CSIconViewItemStoreCreate (void)
+{
+  CSIconViewItemStore *store 
+    = (CSIconViewItemStore *)malloc (sizeof (CSIconViewItemStore));
+
+  if (store) {
+    memset (store, 0, sizeof (CSIconViewItemStore));
+    store->firstStaleSlot = UINT_MAX;
+  }
+
+  return store;
+}
+
+void
+CSIconViewItemStoreDestroy (CSIconViewItemStore *store)
+{
+  if (!store)
+    return;
+
+  CSIconViewItemStoreRemoveAllItems (store);
+
+  free (store->items);
+  free (store->positions);
+  free (store->customSizes);
+  free (store->customIconSizes);
+  free (store->states);
+  free (store->hitRegions);
+  free (store);
+}
+
+void
+CSIconViewItemStoreRemoveAllItems (CSIconViewItemStore *store)
+{
+  CSIconViewItemStoreSetCount (store, 0);
+}
+
+/* Grow one of the arrays in the store */
+static BOOL
+growArray (void **array, size_t elementSize, unsigned newCapacity)
+{
+  void *newArray = realloc (*array, elementSize * newCapacity);
+
+  if (!newArray)
+    return NO;
+
+  *array = newArray;
+  return YES;
+}
+
+BOOL
+CSIconViewItemStoreSetCount (CSIconViewItemStore *store,
+			     unsigned		 count)
+{
+  unsigned n;
+
+  // Detach any items that are falling off the end
+  for (n = count; n < store->count; ++n) {
+    if (store->items[n]) {
+      [store->items[n] setIndexInStore:n];
+      [store->items[n] detachFromStore];
+    }
+    CSIconViewItemStoreInvalidateHitRegion (store, n);
+  }
+
+  if (count > store->capacity) {
+    unsigned newCapacity = store->capacity ? store->capacity : 64;
+
+    while (newCapacity < count)
+      newCapacity *= 2;
+
+    if (!growArray ((void **)&store->items, sizeof (id), newCapacity)
+	|| !growArray ((void **)&store->positions, sizeof (NSPoint),
+		       newCapacity)
+	|| !growArray ((void **)&store->customSizes, sizeof (NSSize),
+		       newCapacity)
+	|| !growArray ((void **)&store->customIconSizes, sizeof (NSSize),
+		       newCapacity)
+	|| !growArray ((void **)&store->states, sizeof (unsigned),
+		       newCapacity)
+	|| !growArray ((void **)&store->hitRegions,
+		       sizeof (CSIconHitRegion *), newCapacity))
+      return NO;
+
+    store->capacity = newCapacity;
+  }
+
+  if (count > store->count) {
+    unsigned added = count - store->count;
+
+    memset (&store->items[store->count], 0, sizeof (id) * added);
+    memset (&store->positions[store->count], 0, sizeof (NSPoint) * added);
+    memset (&store->customSizes[store->count], 0, sizeof (NSSize) * added);
+    memset (&store->customIconSizes[store->count], 0,
+	    sizeof (NSSize) * added);
+    memset (&store->states[store->count], 0, sizeof (unsigned) * added);
+    memset (&store->hitRegions[store->count], 0,
+	    sizeof (CSIconHitRegion *) * added);
+  }
+
+  store->count = count;
+
+  return YES;
+}
+
+/* Move count slots from src to dst (which may overlap).  The items that
+   have moved are renumbered later, by CSIconViewItemStoreRenumberItems(),
+   so that a batch of insertions or removals near the start of a large
+   store costs one pass over the items rather than one per change. */
+static void
+moveSlots (CSIconViewItemStore *store, unsigned dst, unsigned src,
+	   unsigned count)
+{
+  if (!count || dst == src)
+    return;
+
+  memmove (&store->items[dst], &store->items[src], sizeof (id) * count);
+  memmove (&store->positions[dst], &store->positions[src],
+	   sizeof (NSPoint) * count);
+  memmove (&store->customSizes[dst], &store->customSizes[src],
+	   sizeof (NSSize) * count);
+  memmove (&store->customIconSizes[dst], &store->customIconSizes[src],
+	   sizeof (NSSize) * count);
+  memmove (&store->states[dst], &store->states[src],
+	   sizeof (unsigned) * count);
+  memmove (&store->hitRegions[dst], &store->hitRegions[src],
+	   sizeof (CSIconHitRegion *) * count);
+
+  if (MIN (dst, src) < store->firstStaleSlot)
+    store->firstStaleSlot = MIN (dst, src);
+}
+
+void
+CSIconViewItemStoreRenumberItems (CSIconViewItemStore *store)
+{
+  unsigned n, start = store->firstStaleSlot;
+
+  if (start == UINT_MAX)
+    return;
+
+  for (n = start; n < store->count; ++n) {
+    if (store->items[n])
+      [store->items[n] setIndexInStore:n];
+  }
+
+  store->firstStaleSlot = UINT_MAX;
+}
+
+static void
+clearSlot (CSIconViewItemStore *store, unsigned ndx)
+{
+  store->items[ndx] = nil;
+  store->positions[ndx] = NSZeroPoint;
+  store->customSizes[ndx] = NSZeroSize;
+  store->customIconSizes[ndx] = NSZeroSize;
+  store->states[ndx] = 0;
+  store->hitRegions[ndx] = NULL;
+}
+
+BOOL
+CSIconViewItemStoreInsertSlots (CSIconViewItemStore *store,
+				const NSUInteger    *indices,
+				unsigned	    count)
+{
+  unsigned oldCount = store->count, newCount = oldCount + count;
+  unsigned end = newCount;
+  int n;
+
+  if (!count)
+    return YES;
+
+  NSCAssert (indices[count - 1] < newCount, @"Insertion index out of range.");
+
+  if (!CSIconViewItemStoreSetCount (store, newCount))
+    return NO;
+
+  /* Working backwards, the slots after the nth insertion point each move
+     up by n + 1 */
+  for (n = count - 1; n >= 0; --n) {
+    unsigned ndx = indices[n];
+
+    moveSlots (store, ndx + 1, ndx - n, end - ndx - 1);
+    clearSlot (store, ndx);
+    end = ndx;
+  }
+
+  return YES;
+}
+
+void
+CSIconViewItemStoreRemoveSlots (CSIconViewItemStore *store,
+				const NSUInteger    *indices,
+				unsigned	    count)
+{
+  unsigned oldCount = store->count, n;
+
+  if (!count)
+    return;
+
+  NSCAssert (indices[count - 1] < oldCount, @"Removal index out of range.");
+
+  for (n = 0; n < count; ++n) {
+    id item = store->items[indices[n]];
+
+    if (item) {
+      // Saves renumbering everything just to detach this item
+      [item setIndexInStore:indices[n]];
+      [item detachFromStore];
+    }
+    CSIconViewItemStoreInvalidateHitRegion (store, indices[n]);
+  }
+
+  // Likewise, the slots after the nth removed slot each move down by n + 1
+  for (n = 0; n < count; ++n) {
+    unsigned start = indices[n] + 1;
+    unsigned end = n + 1 < count ? indices[n + 1] : oldCount;
+
+    moveSlots (store, start - n - 1, start, end - start);
+  }
+
+  // The slots at the end are now stale copies, so mustn't be detached
+  memset (&store->items[oldCount - count], 0, sizeof (id) * count);
+  memset (&store->hitRegions[oldCount - count], 0,
+	  sizeof (CSIconHitRegion *) * count);
+  store->count = oldCount - count;
+}
+
+void
+CSIconViewItemStoreMoveSlot (CSIconViewItemStore *store,
+			     unsigned		 fromIndex,
+			     unsigned		 toIndex)
+{
+  id item;
+  NSPoint position;
+  NSSize customSize, customIconSize;
+  unsigned state;
+  CSIconHitRegion *hitRegion;
+
+  NSCAssert (fromIndex < store->count && toIndex < store->count,
+	     @"Move index out of range.");
+
+  if (fromIndex == toIndex)
+    return;
+
+  item = store->items[fromIndex];
+  position = store->positions[fromIndex];
+  customSize = store->customSizes[fromIndex];
+  customIconSize = store->customIconSizes[fromIndex];
+  state = store->states[fromIndex];
+  hitRegion = store->hitRegions[fromIndex];
+
+  if (fromIndex < toIndex)
+    moveSlots (store, fromIndex, fromIndex + 1, toIndex - fromIndex);
+  else
+    moveSlots (store, toIndex + 1, toIndex, fromIndex - toIndex);
+
+  store->items[toIndex] = item;
+  store->positions[toIndex] = position;
+  store->customSizes[toIndex] = customSize;
+  store->customIconSizes[toIndex] = customIconSize;
+  store->states[toIndex] = state;
+  store->hitRegions[toIndex] = hitRegion;
+}
+
+void
+CSIconViewItemStoreInvalidateHitRegion (CSIconViewItemStore *store,
+					unsigned	    ndx)
+{
+  CSIconHitRegionFree (store->hitRegions[ndx]);
+  store->hitRegions[ndx] = NULL;
+}
+
+void
+CSIconViewItemStoreInvalidateHitRegions (CSIconViewItemStore *store)
+{
+  unsigned n;
+
+  for (n = 0; n < store->count; ++n)
+    CSIconViewItemStoreInvalidateHitRegion (store, n);
+}
+
+struct bounds_job {
+  const CSIconViewItemStore *store;
+  const NSUInteger	    *indices;
+  NSUInteger		    count, chunkSize;
+  NSSize		    gridSize;
+  unsigned		    sizeMask;
+  NSRect		    *results;
+};
+
+/* This is written as a straight min/max reduction over the arrays so that
+   the compiler can vectorise it when we're looking at every item.  Like
+   NSUnionRect(), we ignore empty rectangles. */
+static NSRect
+boundingRectOfRange (const CSIconViewItemStore *store,
+		     const NSUInteger	       *indices,
+		     NSUInteger		       start,
+		     NSUInteger		       end,
+		     NSSize		       gridSize,
+		     unsigned		       sizeMask)
+{
+  const NSPoint *positions = store->positions;
+  const NSSize *customSizes = store->customSizes;
+  const unsigned *states = store->states;
+  CGFloat minX = 0, minY = 0, maxX = 0, maxY = 0;
+  BOOL found = NO;
+  NSUInteger n;
+
+  for (n = start; n < end; ++n) {
+    NSUInteger ndx = indices ? indices[n] : n;
+    NSSize size = (states[ndx] & sizeMask) ? customSizes[ndx] : gridSize;
+    CGFloat x = positions[ndx].x, y = positions[ndx].y;
+
+    if (size.width <= 0 || size.height <= 0)
+      continue;
+
+    if (!found) {
+      minX = x;
+      minY = y;
+      maxX = x + size.width;
+      maxY = y + size.height;
+      found = YES;
+    } else {
+      minX = x < minX ? x : minX;
+      minY = y < minY ? y : minY;
+      maxX = x + size.width > maxX ? x + size.width : maxX;
+      maxY = y + size.height > maxY ? y + size.height : maxY;
+    }
+  }
+
+  if (!found)
+    return NSZeroRect;
+
+  return NSMakeRect (minX, minY, maxX - minX, maxY - minY);
+}
+
+static void
+boundingRectOfChunk (void *context, size_t chunk)
+{
+  struct bounds_job *job = (struct bounds_job *)context;
+  NSUInteger start = chunk * job->chunkSize;
+  NSUInteger end = start + job->chunkSize;
+
+  if (end > job->count)
+    end = job->count;
+
+  job->results[chunk] = boundingRectOfRange (job->store, job->indices,
+					     start, end, job->gridSize,
+					     job->sizeMask);
+}
+
+/* Large item counts are split into one chunk per CPU, each reduced
+   concurrently, and the partial results combined at the end */
+NSRect
+CSIconViewItemStoreBoundingRect (const CSIconViewItemStore *store,
+				 const NSUInteger	   *indices,
+				 NSUInteger		   count,
+				 NSSize			   gridSize,
+				 BOOL			   allowsCustomSizes)
+{
+  unsigned sizeMask = allowsCustomSizes ? kCSIVItemCustomSizeMask : 0;
+  unsigned cpus = CSParallelCPUCount ();
+  struct bounds_job job;
+  NSRect result = NSZeroRect;
+  NSUInteger chunks, n;
+
+  if (!indices)
+    count = store->count;
+
+  if (count < PARALLEL_BOUNDS_THRESHOLD || cpus <= 1)
+    return boundingRectOfRange (store, indices, 0, count, gridSize, sizeMask);
+
+  chunks = cpus;
+  job.store = store;
+  job.indices = indices;
+  job.count = count;
+  job.chunkSize = (count + chunks - 1) / chunks;
+  job.gridSize = gridSize;
+  job.sizeMask = sizeMask;
+  job.results = (NSRect *)malloc (sizeof (NSRect) * chunks);
+
+  if (!job.results)
+    return boundingRectOfRange (store, indices, 0, count, gridSize, sizeMask);
+
+  CSParallelApply (chunks, &job, boundingRectOfChunk);
+
+  // NSUnionRect() ignores the empty results from chunks with no items
+  for (n = 0; n < chunks; ++n)
+    result = NSUnionRect (result, job.results[n]);
+
+  free (job.results);
+
+  return result;
+}
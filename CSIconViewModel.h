@@ -0,0 +1,110 @@
+//
+//  CSIconViewModel.h
+//  CSIconView
+//
+//  Created by Alastair Houghton on 20/03/2010.
+//  Copyright (c) 2005-2010 Coriolis Systems Limited
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+//
+
+#import <Cocoa/Cocoa.h>
+#import "CSIconViewItem.h"
+
+@class CSIconViewModel;
+
+@interface NSObject (CSIconViewModelDataSource)
+
+- (unsigned)numberOfItemsInIconViewModel:(CSIconViewModel *)model;
+- (CSIconViewItem *)iconViewModel:(CSIconViewModel *)model
+		      itemAtIndex:(unsigned)index;
+
+- (void)iconViewModel:(CSIconViewModel *)model
+	 setItemTitle:(NSString *)title
+	      atIndex:(unsigned)index;
+
+@end
+
+extern NSString * const CSIconViewModelDidReloadNotification;
+extern NSString * const CSIconViewModelItemDidChangeNotification;
+extern NSString * const CSIconViewModelDidInsertItemsNotification;
+extern NSString * const CSIconViewModelDidRemoveItemsNotification;
+
+/* userInfo keys; the index is an NSNumber, the indexes an NSIndexSet */
+extern NSString * const kCSIconViewModelItemIndex;
+extern NSString * const kCSIconViewModelItemIndexes;
+
+/* A CSIconViewModel holds the items for a collection that is shown in
+   more than one CSIconView at once.  It asks its data source for the items
+   once, and each view attached to it (with -[CSIconView setModel:]) takes
+   a copy of every item, so the views share the items' icons (and hence
+   their cached bitmaps), titles and represented objects, as well as a
+   single title layout cache, while keeping their own positions, sizes and
+   selection.
+
+   Changes should be made through the model, which notifies the attached
+   views; they then update themselves as if their own -reloadItems,
+   -reloadItemAtIndex:, -insertItemsAtIndexes: or -removeItemsAtIndexes:
+   had been called.  Like CSIconView, the model should only be used from
+   the main thread.
+
+   Sharing isn't free: each attached view still costs, per item, the item
+   copy itself (around 128 bytes in a 64-bit process), its slot in the
+   view's item store (68 bytes, with up to twice that reserved as the store
+   grows), its entry in the view's quad tree (40 bytes) and a pointer in
+   the view's item array, so roughly 250 to 300 bytes per item per view,
+   plus a hit region for each item that has been hit tested. */
+@interface CSIconViewModel : NSObject
+{
+  id			dataSource;
+  NSMutableArray	*items;
+  BOOL			needsReload;
+  NSMutableDictionary	*titleLayoutCache;
+}
+
+- (id)initWithDataSource:(id)dataSource;
+
+- (id)dataSource;
+- (void)setDataSource:(id)newSource;
+
+- (unsigned)numberOfItems;
+- (CSIconViewItem *)itemAtIndex:(unsigned)ndx;
+
+/* Shared by the renderers of the attached views */
+- (NSMutableDictionary *)titleLayoutCache;
+
+/* Call these after changing the data source.  As with CSIconView,
+   insertion indices are in terms of the data source after the change and
+   removal indices in terms of the model before it. */
+- (void)reloadItems;
+- (void)reloadItemAtIndex:(unsigned)ndx;
+- (void)insertItemsAtIndexes:(NSIndexSet *)indexes;
+- (void)removeItemsAtIndexes:(NSIndexSet *)indexes;
+
+/* Called by the views when the user renames an item */
+- (void)setTitle:(NSString *)title forItemAtIndex:(unsigned)ndx;
+
+@end
+
+/*
+ * Local Variables:
+ * mode: ObjC
+ * End:
+ *
+ */
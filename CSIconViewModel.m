@@ -0,0 +1,200 @@
+//
+//  CSIconViewModel.m
+//  CSIconView
+//
+//  Created by Alastair Houghton on 20/03/2010.
+//  Copyright (c) 2005-2010 Coriolis Systems Limited
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+//
+
+#import "CSIconViewModel.h"
+
+NSString * const CSIconViewModelDidReloadNotification
+  = @"CSIconViewModelDidReloadNotification";
+NSString * const CSIconViewModelItemDidChangeNotification
+  = @"CSIconViewModelItemDidChangeNotification";
+NSString * const CSIconViewModelDidInsertItemsNotification
+  = @"CSIconViewModelDidInsertItemsNotification";
+NSString * const CSIconViewModelDidRemoveItemsNotification
+  = @"CSIconViewModelDidRemoveItemsNotification";
+NSString * const kCSIconViewModelItemIndex = @"kCSIconViewModelItemIndex";
+NSString * const kCSIconViewModelItemIndexes = @"kCSIconViewModelItemIndexes";
+
+@interface CSIconViewModel (Internal)
+
+- (void)loadItemsIfNecessary;
+- (void)postNotificationName:(NSString *)name userInfo:(NSDictionary *)info;
+
+@end
+
+@implementation CSIconViewModel
+
+- (id)init
+{
+  return [self initWithDataSource:nil];
+}
+
+- (id)initWithDataSource:(id)theDataSource
+{
+  if ((self = [super init])) {
+    dataSource = theDataSource;
+    items = [[NSMutableArray alloc] init];
+    titleLayoutCache = [[NSMutableDictionary alloc] init];
+    needsReload = YES;
+  }
+
+  return self;
+}
+
+- (void)dealloc
+{
+  [items release];
+  [titleLayoutCache release];
+  [super dealloc];
+}
+
+- (id)dataSource
+{
+  return dataSource;
+}
+
+- (void)setDataSource:(id)newSource
+{
+  // NO RETAIN!
+  dataSource = newSource;
+  [self reloadItems];
+}
+
+- (NSMutableDictionary *)titleLayoutCache
+{
+  return titleLayoutCache;
+}
+
+- (unsigned)numberOfItems
+{
+  [self loadItemsIfNecessary];
+  return [items count];
+}
+
+- (CSIconViewItem *)itemAtIndex:(unsigned)ndx
+{
+  [self loadItemsIfNecessary];
+  return [items objectAtIndex:ndx];
+}
+
+/* The first view to ask for the items pays for loading them; the rest
+   share the result */
+- (void)loadItemsIfNecessary
+{
+  unsigned n, count;
+
+  if (!needsReload)
+    return;
+
+  needsReload = NO;
+  [items removeAllObjects];
+
+  count = [dataSource numberOfItemsInIconViewModel:self];
+  for (n = 0; n < count; ++n)
+    [items addObject:[dataSource iconViewModel:self itemAtIndex:n]];
+}
+
+- (void)postNotificationName:(NSString *)name userInfo:(NSDictionary *)info
+{
+  [[NSNotificationCenter defaultCenter] postNotificationName:name
+						      object:self
+						    userInfo:info];
+}
+
+- (void)reloadItems
+{
+  needsReload = YES;
+  [titleLayoutCache removeAllObjects];
+  [self postNotificationName:CSIconViewModelDidReloadNotification
+		    userInfo:nil];
+}
+
+- (void)reloadItemAtIndex:(unsigned)ndx
+{
+  if (needsReload)
+    return;
+
+  [items replaceObjectAtIndex:ndx
+		   withObject:[dataSource iconViewModel:self itemAtIndex:ndx]];
+
+  [self postNotificationName:CSIconViewModelItemDidChangeNotification
+		    userInfo:[NSDictionary dictionaryWithObject:
+				 [NSNumber numberWithUnsignedInt:ndx]
+							 forKey:
+				   kCSIconViewModelItemIndex]];
+}
+
+- (void)insertItemsAtIndexes:(NSIndexSet *)indexes
+{
+  NSMutableArray *newItems;
+  NSUInteger ndx;
+
+  if (![indexes count] || needsReload)
+    return;
+
+  newItems = [NSMutableArray arrayWithCapacity:[indexes count]];
+  for (ndx = [indexes firstIndex]; ndx != NSNotFound;
+       ndx = [indexes indexGreaterThanIndex:ndx])
+    [newItems addObject:[dataSource iconViewModel:self itemAtIndex:ndx]];
+
+  [items insertObjects:newItems atIndexes:indexes];
+
+  [self postNotificationName:CSIconViewModelDidInsertItemsNotification
+		    userInfo:[NSDictionary dictionaryWithObject:indexes
+							 forKey:
+				   kCSIconViewModelItemIndexes]];
+}
+
+- (void)removeItemsAtIndexes:(NSIndexSet *)indexes
+{
+  if (![indexes count] || needsReload)
+    return;
+
+  [items removeObjectsAtIndexes:indexes];
+
+  [self postNotificationName:CSIconViewModelDidRemoveItemsNotification
+		    userInfo:[NSDictionary dictionaryWithObject:indexes
+							 forKey:
+				   kCSIconViewModelItemIndexes]];
+}
+
+- (void)setTitle:(NSString *)title forItemAtIndex:(unsigned)ndx
+{
+  [self loadItemsIfNecessary];
+
+  [[items objectAtIndex:ndx] setTitle:title];
+
+  if ([dataSource respondsToSelector:
+	 @selector(iconViewModel:setItemTitle:atIndex:)])
+    [dataSource iconViewModel:self setItemTitle:title atIndex:ndx];
+
+  [self postNotificationName:CSIconViewModelItemDidChangeNotification
+		    userInfo:[NSDictionary dictionaryWithObject:
+				 [NSNumber numberWithUnsignedInt:ndx]
+							 forKey:
+				   kCSIconViewModelItemIndex]];
+}
+
+@end
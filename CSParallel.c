@@ -0,0 +1,262 @@
+//
+//  CSParallel.c
+//  CSIconView
+//
+//  Created by Alastair Houghton on 18/03/2010.
+//  Copyright (c) 2005-2010 Coriolis Systems Limited
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "CSParallel.h"
+
+#if __APPLE__
+#include <AvailabilityMacros.h>
+#endif
+
+#if defined(MAC_OS_X_VERSION_10_6) \
+  && MAC_OS_X_VERSION_MAX_ALLOWED >= MAC_OS_X_VERSION_10_6
+#include <dispatch/dispatch.h>
+#define HAVE_DISPATCH 1
+#else
+#define HAVE_DISPATCH 0
+#endif
+
+/* Runs shorter than this are insertion sorted */
+#define INSERTION_SORT_THRESHOLD  16
+
+/* Don't bother going parallel for fewer items than this */
+#define PARALLEL_THRESHOLD	  4096
+
+struct sort_job {
+  unsigned	    *src;
+  unsigned	    *dst;
+  size_t	    count;
+  size_t	    width;
+  CSIndexComparator compare;
+  void		    *context;
+};
+
+static void
+insertionSort (unsigned *indices, size_t count,
+	       CSIndexComparator compare, void *context)
+{
+  size_t n, m;
+
+  for (n = 1; n < count; ++n) {
+    unsigned ndx = indices[n];
+
+    for (m = n; m > 0 && compare (indices[m - 1], ndx, context) > 0; --m)
+      indices[m] = indices[m - 1];
+
+    indices[m] = ndx;
+  }
+}
+
+/* Merge src[lo, mid) and src[mid, hi) into dst[lo, hi); stable, because
+   ties are taken from the left run */
+static void
+mergeRuns (const unsigned *src, unsigned *dst, size_t lo, size_t mid,
+	   size_t hi, CSIndexComparator compare, void *context)
+{
+  size_t i = lo, j = mid, k = lo;
+
+  while (i < mid && j < hi) {
+    if (compare (src[j], src[i], context) < 0)
+      dst[k++] = src[j++];
+    else
+      dst[k++] = src[i++];
+  }
+
+  if (i < mid)
+    memcpy (&dst[k], &src[i], sizeof (unsigned) * (mid - i));
+  else if (j < hi)
+    memcpy (&dst[k], &src[j], sizeof (unsigned) * (hi - j));
+}
+
+/* Merge adjacent runs of the given width, from src to dst */
+static void
+mergePass (const unsigned *src, unsigned *dst, size_t count, size_t width,
+	   CSIndexComparator compare, void *context)
+{
+  size_t lo;
+
+  for (lo = 0; lo < count; lo += 2 * width) {
+    size_t mid = lo + width < count ? lo + width : count;
+    size_t hi = lo + 2 * width < count ? lo + 2 * width : count;
+
+    mergeRuns (src, dst, lo, mid, hi, compare, context);
+  }
+}
+
+/* Sort indices[0, count), using scratch as temporary space */
+static void
+mergeSort (unsigned *indices, unsigned *scratch, size_t count,
+	   CSIndexComparator compare, void *context)
+{
+  unsigned *src = indices, *dst = scratch, *tmp;
+  size_t lo, width;
+
+  for (lo = 0; lo < count; lo += INSERTION_SORT_THRESHOLD) {
+    size_t len = count - lo;
+
+    if (len > INSERTION_SORT_THRESHOLD)
+      len = INSERTION_SORT_THRESHOLD;
+
+    insertionSort (&indices[lo], len, compare, context);
+  }
+
+  for (width = INSERTION_SORT_THRESHOLD; width < count; width *= 2) {
+    mergePass (src, dst, count, width, compare, context);
+    tmp = src; src = dst; dst = tmp;
+  }
+
+  if (src != indices)
+    memcpy (indices, src, sizeof (unsigned) * count);
+}
+
+/* Job functions; each is applied to a chunk number */
+static void
+sortChunk (void *jobPtr, size_t chunk)
+{
+  struct sort_job *job = (struct sort_job *)jobPtr;
+  size_t lo = chunk * job->width;
+  size_t len = job->count - lo;
+
+  if (len > job->width)
+    len = job->width;
+
+  mergeSort (&job->src[lo], &job->dst[lo], len, job->compare, job->context);
+}
+
+static void
+mergeChunks (void *jobPtr, size_t pair)
+{
+  struct sort_job *job = (struct sort_job *)jobPtr;
+  size_t lo = pair * 2 * job->width;
+  size_t mid = lo + job->width < job->count ? lo + job->width : job->count;
+  size_t hi = (lo + 2 * job->width < job->count
+	       ? lo + 2 * job->width : job->count);
+
+  mergeRuns (job->src, job->dst, lo, mid, hi, job->compare, job->context);
+}
+
+static size_t
+numberOfChunks (size_t count)
+{
+  unsigned cpus = CSParallelCPUCount ();
+  size_t chunks = 1;
+
+  if (count < PARALLEL_THRESHOLD || cpus <= 1)
+    return 1;
+
+  // A power of two means the merge tree is balanced
+  while (chunks < cpus)
+    chunks *= 2;
+
+  return chunks;
+}
+
+unsigned
+CSParallelCPUCount (void)
+{
+  static unsigned cpus;
+
+  if (!cpus) {
+    long online = sysconf (_SC_NPROCESSORS_ONLN);
+
+    cpus = online > 0 ? (unsigned)online : 1;
+  }
+
+  return cpus;
+}
+
+void
+CSParallelApply (size_t iterations,
+		 void	*context,
+		 void	(*function)(void *context, size_t iteration))
+{
+  size_t n;
+
+#if HAVE_DISPATCH
+  /* We may be weakly linked against libdispatch when running on 10.5 */
+  if (dispatch_apply_f != NULL && iterations > 1) {
+    dispatch_apply_f (iterations,
+		      dispatch_get_global_queue (DISPATCH_QUEUE_PRIORITY_DEFAULT,
+						 0),
+		      context, function);
+    return;
+  }
+#endif
+
+  for (n = 0; n < iterations; ++n)
+    function (context, n);
+}
+
+int
+CSParallelSortIndices (unsigned		 *indices,
+		       size_t		 count,
+		       CSIndexComparator compare,
+		       void		 *context)
+{
+  unsigned *scratch;
+  struct sort_job job;
+  size_t chunks;
+
+  if (count < 2)
+    return 0;
+
+  scratch = (unsigned *) malloc (sizeof (unsigned) * count);
+
+  if (!scratch)
+    return -1;
+
+  chunks = numberOfChunks (count);
+
+  job.src = indices;
+  job.dst = scratch;
+  job.count = count;
+  job.width = (count + chunks - 1) / chunks;
+  job.compare = compare;
+  job.context = context;
+
+  // Sort each chunk in place
+  CSParallelApply (chunks, &job, sortChunk);
+
+  // Then merge them, ping-ponging between the two arrays
+  while (job.width < count) {
+    unsigned *tmp;
+    size_t pairs = (count + 2 * job.width - 1) / (2 * job.width);
+
+    CSParallelApply (pairs, &job, mergeChunks);
+
+    tmp = job.src; job.src = job.dst; job.dst = tmp;
+    job.width *= 2;
+  }
+
+  if (job.src != indices)
+    memcpy (indices, job.src, sizeof (unsigned) * count);
+
+  free (scratch);
+
+  return 0;
+}
@@ -0,0 +1,72 @@
+//
+//  CSParallel.h
+//  CSIconView
+//
+//  Created by Alastair Houghton on 18/03/2010.
+//  Copyright (c) 2005-2010 Coriolis Systems Limited
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+//
+
+#ifndef CSPARALLEL_H_
+#define CSPARALLEL_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The number of CPUs it's worth spreading work across */
+unsigned CSParallelCPUCount (void);
+
+/* Calls function (context, n) for each n in [0, iterations), concurrently
+   using Grand Central Dispatch where it's available (otherwise in a plain
+   loop), and returns once they've all finished. */
+void CSParallelApply (size_t iterations,
+		      void   *context,
+		      void   (*function)(void *context, size_t iteration));
+
+/* Return <0, 0 or >0 as item a sorts before, with or after item b */
+typedef int (*CSIndexComparator)(unsigned a, unsigned b, void *context);
+
+/* Stable merge sort of an array of item indices.  Large arrays are split
+   into one run per CPU; the runs, and then the merges between them, are
+   done concurrently using Grand Central Dispatch where it's available, so
+   the comparator must be safe to call from several threads at once.
+
+   Returns 0 on success, or -1 if we couldn't allocate the scratch space
+   (in which case the indices are left untouched). */
+int CSParallelSortIndices (unsigned	     *indices,
+			   size_t	     count,
+			   CSIndexComparator compare,
+			   void		     *context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CSPARALLEL_H_ */
+
+/*
+ * Local Variables:
+ * mode: C
+ * End:
+ *
+ */
@@ -26,10 +26,32 @@
 
 #import <Cocoa/Cocoa.h>
 
+/* Directions for -nearestObjectInDirection:fromRect:filter:context:.  These
+   are in terms of the quad tree's own co-ordinates, so in a flipped view
+   "up" is CSQuadTreeMinYDirection. */
+typedef enum {
+  CSQuadTreeMinXDirection,
+  CSQuadTreeMaxXDirection,
+  CSQuadTreeMinYDirection,
+  CSQuadTreeMaxYDirection
+} CSQuadTreeDirection;
+
+/* Return NO to exclude an object from a search */
+typedef BOOL (*CSQuadTreeFilter)(id object, void *context);
+
+@class CSRectQuadTreeSnapshot;
+
+/* CSRectQuadTree is not thread-safe; if you need to query it from another
+   thread, take a -snapshot on the thread that owns the tree and hand that
+   over instead. */
 @interface CSRectQuadTree : NSObject
 {
   NSRect bounds;
   struct quad_tree_node *head;
+
+  unsigned long		  version;
+  CSRectQuadTreeSnapshot  *snapshot;
+  unsigned long		  snapshotVersion;
 }
 
 + (CSRectQuadTree *)quadTreeWithBounds:(NSRect)bounds;
@@ -41,14 +63,26 @@
 - (void)resizeBoundsForRect:(NSRect)size;
 
 - (NSRect)objectBounds;
+- (unsigned)count;
 
 - (void)addObject:(id)obj withBounds:(NSRect)rect;
+- (void)addObjects:(const id *)objects
+	withBounds:(const NSRect *)rects
+	     count:(unsigned)count;
 - (id)objectAtPoint:(NSPoint)point;
 - (NSMutableSet *)objectsAtPoint:(NSPoint)point;
 - (NSMutableSet *)objectsInRect:(NSRect)rect;
 - (NSMutableSet *)objectsIntersectingRect:(NSRect)rect;
 - (NSMutableSet *)objectsIntersectingRectBoundary:(NSRect)rect;
 
+- (id)nearestObjectInDirection:(CSQuadTreeDirection)direction
+		      fromRect:(NSRect)rect
+			filter:(CSQuadTreeFilter)filter
+		       context:(void *)context;
+- (id)extremeObjectInDirection:(CSQuadTreeDirection)direction
+			filter:(CSQuadTreeFilter)filter
+		       context:(void *)context;
+
 - (void)removeObject:(id)object;
 - (void)removeObject:(id)object inRect:(NSRect)rectHint;
 - (void)removeObject:(id)object withBounds:(NSRect)bounds;
@@ -59,6 +93,44 @@
 
 - (NSMutableSet *)allObjects;
 
+/* Incremented by every mutation */
+- (unsigned long)version;
+
+/* Returns an immutable copy of the tree as it is now.  Snapshots are
+   cached until the tree next changes, so asking repeatedly is cheap.  The
+   first snapshot copies every node; after that, only the nodes on the path
+   from each changed node up to the root are copied again, and everything
+   else is shared with earlier snapshots.  The tree keeps its most recent
+   copy of each node, so once you've taken a snapshot it uses roughly twice
+   the memory it otherwise would. */
+- (CSRectQuadTreeSnapshot *)snapshot;
+
+@end
+
+/* An immutable copy of a quad tree.  Any number of threads may query a
+   snapshot at the same time, while the tree it was taken from carries on
+   changing.  Snapshot nodes are reference counted and retain their
+   objects, which may therefore be released on whichever thread lets go of
+   the last snapshot that shares them. */
+@interface CSRectQuadTreeSnapshot : NSObject
+{
+  NSRect		    bounds;
+  unsigned long		    version;
+  struct snapshot_node	    *root;
+}
+
+- (unsigned long)version;
+- (NSRect)bounds;
+- (NSRect)objectBounds;
+- (unsigned)count;
+
+- (id)objectAtPoint:(NSPoint)point;
+- (NSMutableSet *)objectsAtPoint:(NSPoint)point;
+- (NSMutableSet *)objectsInRect:(NSRect)rect;
+- (NSMutableSet *)objectsIntersectingRect:(NSRect)rect;
+- (NSMutableSet *)objectsIntersectingRectBoundary:(NSRect)rect;
+- (NSMutableSet *)allObjects;
+
 @end
 
 /*
@@ -26,9 +26,22 @@
 
 #import "CSRectQuadTree.h"
 #import "CSRectUtils.h"
+#import "CSParallel.h"
 
 #define DEBUG_NODE_ALLOCATION 0
 #define DEBUG_NODE_ZOMBIES 0
+#define DEBUG_NEAREST_SEARCH 0
+
+/* Queries that look like returning at least this many objects are split
+   into subtrees and run in parallel.  The estimate comes from the counts of
+   the nodes the query would visit, down to ESTIMATE_LEVELS deep. */
+#define PARALLEL_QUERY_THRESHOLD  32768
+#define ESTIMATE_LEVELS		  3
+
+/* We aim for this many subtrees per CPU, so that the dispatch queue can
+   balance the load, but won't split more than MAX_SPLIT_LEVELS deep */
+#define TASKS_PER_CPU		  4
+#define MAX_SPLIT_LEVELS	  5
 
 #if DEBUG_NODE_ZOMBIES
 # define CHECK_NODE(x) NSCAssert (x->used <= x->total, @"Oops!")
@@ -78,6 +91,23 @@ struct quad_tree_node {
     struct quad_tree_node *boxes[4];
   };
 
+  /* The union of the bounds of every object in this node and its children,
+     and the number of such objects.  These are kept up to date as objects
+     are added and removed, so that we can answer extent queries without
+     walking the tree. */
+  NSRect		  extent;
+  unsigned		  count;
+
+  /* Only used during -addObjects:withBounds:count:, to count the objects
+     that are about to be added to this node */
+  unsigned		  pending;
+
+  /* Our most recent snapshot copy, or NULL if we've changed since it was
+     taken (or if there isn't one).  A node can only be frozen if all of
+     its children are, so as soon as we find a node that isn't, we know
+     that its ancestors aren't either. */
+  struct snapshot_node	  *frozen;
+
   unsigned		  total, used;
   struct quad_tree_object objects[0];
 };
@@ -90,6 +120,43 @@ static void releaseNode (struct quad_tree_node *node, BOOL recurse);
 static struct quad_tree_node *splitForRect (struct quad_tree_node *head,
 					    NSRect		  bounds,
 					    NSRect		  objectRect);
+static BOOL reserveNodeSlots (struct quad_tree_node **nodePtr);
+static BOOL shouldQueryInParallel (struct quad_tree_node *head,
+				   NSRect		 bounds,
+				   NSRect		 rect,
+				   BOOL			 includeIntersect,
+				   BOOL			 includeContained,
+				   BOOL			 allObjects);
+static NSMutableSet *parallelQuery (struct quad_tree_node *head,
+				    NSRect		  bounds,
+				    NSRect		  rect,
+				    BOOL		  includeIntersect,
+				    BOOL		  includeContained,
+				    BOOL		  allObjects);
+static void recomputeExtents (struct quad_tree_node *node);
+
+/* A snapshot node.  These are immutable once made, and are shared between
+   the live tree and any number of snapshots, so they're reference counted
+   (atomically, since snapshots may be released on any thread). */
+struct snapshot_node {
+  int32_t		  refCount;
+  NSRect		  extent;
+  unsigned		  count;	// Objects in this node and its children
+  unsigned		  used;		// Objects in this node
+  struct snapshot_node	  *children[4];	// Same order as boxes[]
+  struct quad_tree_object objects[0];
+};
+
+static void releaseSnapshotNode (struct snapshot_node *node);
+static void thawNode (struct quad_tree_node *node);
+
+@interface CSRectQuadTreeSnapshot (Private)
+
+- (id)initWithQuadTree:(struct quad_tree_node *)head
+		bounds:(NSRect)bounds
+	       version:(unsigned long)version;
+
+@end
 static void addObjectsInRectToSet (NSMutableSet *set,
 				   struct quad_tree_node *node,
 				   NSRect bounds,
@@ -113,10 +180,32 @@ removeObjectFromNode (struct quad_tree_node *node,
 		      unsigned		    index);
 static void strokeQuadTreeNodes (struct quad_tree_node *node,
 				 NSRect		       bounds);
-static void unionRectForAllNodes (struct quad_tree_node *node,
-                                  NSRect                bounds,
-                                  NSRect                *unionRect,
-                                  BOOL                  *foundRect);
+static void updateExtentsAfterRemoval (struct quad_tree_node *node,
+				       NSRect		     removedRect);
+
+
+/* State for a directional search.  Positions are mapped to a key (the
+   coordinate on the search axis, multiplied by sign) and a tie-break value
+   (the coordinate on the other axis, multiplied by tieSign); smaller is
+   better for both. */
+struct nearest_search {
+  unsigned	      axis;
+  CGFloat	      sign, tieSign;
+  BOOL		      hasOrigin, hasStrip;
+  NSPoint	      origin;
+  NSRect	      strip;
+  CSQuadTreeFilter    filter;
+  void		      *context;
+  id		      best;
+  CGFloat	      bestKey, bestTieBreak;
+};
+
+static BOOL findNearestObject (struct quad_tree_node *head,
+			       struct nearest_search *search);
+#if DEBUG_NEAREST_SEARCH
+static void bruteForceNearestObject (struct quad_tree_node *node,
+				     struct nearest_search *search);
+#endif
 
 static NSRect boundsForBox (NSRect larger, QuadTreeBox box) __attribute__ ((__const__));
 static int whichBox (NSRect larger, NSRect smaller) __attribute__ ((__const__));
@@ -175,6 +264,7 @@ static int whichBox (NSRect larger, NSRect smaller)
 - (void)dealloc
 {
   releaseNode (head, TRUE);
+  [snapshot release];
   [super dealloc];
 }
 
@@ -186,20 +276,26 @@ static int whichBox (NSRect larger, NSRect smaller)
 - (void)setBounds:(NSRect)newBounds
 {
   bounds = newBounds;
+  ++version;
 }
 
 - (NSRect)objectBounds
 {
-  BOOL foundRect = NO;
-  NSRect unionRect = NSZeroRect;
+  if (!head->count)
+    return NSZeroRect;
 
-  unionRectForAllNodes (head, bounds, &unionRect, &foundRect);
+  return head->extent;
+}
 
-  return unionRect;
+- (unsigned)count
+{
+  return head->count;
 }
 
 - (void)resizeBoundsForRect:(NSRect)rect
 {
+  ++version;
+
   if (bounds.size.width <= 0)
     bounds.size.width = 1.0;
   if (bounds.size.height <= 0)
@@ -218,6 +314,8 @@ static int whichBox (NSRect larger, NSRect smaller)
       }
       
       head->parent = node;
+      node->extent = head->extent;
+      node->count = head->count;
 
       if (NSMinX (rect) >= NSMinX (bounds)) {
         if (NSMinY (rect) >= NSMinY (bounds))
@@ -282,6 +380,8 @@ static int whichBox (NSRect larger, NSRect smaller)
   struct quad_tree_node *node;
   BOOL isHead;
 
+  ++version;
+
   if (!CSContainsRect (bounds, objectRect)) {
     NSRect uRect = NSUnionRect (bounds, objectRect);
     
@@ -306,6 +406,61 @@ static int whichBox (NSRect larger, NSRect smaller)
   }
 }
 
+/* Adds a batch of objects in three passes: first we create any nodes we
+   need and count the objects destined for each, then we grow each node
+   once, and finally we drop the objects in and recompute the extents with
+   a single walk of the tree.  This avoids the repeated reallocations and
+   per-object extent updates of calling -addObject:withBounds: in a loop. */
+- (void)addObjects:(const id *)objects
+	withBounds:(const NSRect *)rects
+	     count:(unsigned)count
+{
+  struct quad_tree_node *node;
+  NSRect unionRect;
+  unsigned n;
+
+  if (!count)
+    return;
+
+  ++version;
+
+  unionRect = rects[0];
+  for (n = 1; n < count; ++n)
+    unionRect = CSUnionRect (unionRect, rects[n]);
+
+  if (!CSContainsRect (bounds, unionRect))
+    [self resizeBoundsForRect:NSUnionRect (bounds, unionRect)];
+
+  for (n = 0; n < count; ++n) {
+    node = splitForRect (head, bounds, rects[n]);
+
+    if (!node)
+      break;
+
+    ++node->pending;
+  }
+
+  // This clears all of the pending counts, even if it fails
+  if (!reserveNodeSlots (&head) || n < count) {
+    [NSException raise:@"CSOutOfMemory"
+		format:@"%@",
+      NSLocalizedString (@"Not enough memory.",
+                         @"Not enough memory.")];
+  }
+
+  for (n = 0; n < count; ++n) {
+    node = splitForRect (head, bounds, rects[n]);
+
+    CHECK_NODE (node);
+
+    thawNode (node);
+    node->objects[node->used].object = [objects[n] retain];
+    node->objects[node->used++].bounds = rects[n];
+  }
+
+  recomputeExtents (head);
+}
+
 - (id)objectAtPoint:(NSPoint)point
 {
   struct quad_tree_node *node = head;
@@ -367,8 +522,12 @@ static int whichBox (NSRect larger, NSRect smaller)
 
 - (NSMutableSet *)objectsInRect:(NSRect)rect
 {
-  NSMutableSet *set = [NSMutableSet set];
-  
+  NSMutableSet *set;
+
+  if (shouldQueryInParallel (head, bounds, rect, NO, YES, NO))
+    return parallelQuery (head, bounds, rect, NO, YES, NO);
+
+  set = [NSMutableSet set];
   addObjectsInRectToSet (set, head, bounds, rect, NO, YES);
   
   return set;
@@ -376,8 +535,12 @@ static int whichBox (NSRect larger, NSRect smaller)
 
 - (NSMutableSet *)objectsIntersectingRect:(NSRect)rect
 {
-  NSMutableSet *set = [NSMutableSet set];
-  
+  NSMutableSet *set;
+
+  if (shouldQueryInParallel (head, bounds, rect, YES, YES, NO))
+    return parallelQuery (head, bounds, rect, YES, YES, NO);
+
+  set = [NSMutableSet set];
   addObjectsInRectToSet (set, head, bounds, rect, YES, YES);
 
   return set;
@@ -385,13 +548,120 @@ static int whichBox (NSRect larger, NSRect smaller)
 
 - (NSMutableSet *)objectsIntersectingRectBoundary:(NSRect)rect
 {
-  NSMutableSet *set = [NSMutableSet set];
-  
+  NSMutableSet *set;
+
+  if (shouldQueryInParallel (head, bounds, rect, YES, NO, NO))
+    return parallelQuery (head, bounds, rect, YES, NO, NO);
+
+  set = [NSMutableSet set];
   addObjectsInRectToSet (set, head, bounds, rect, YES, NO);
   
   return set;
 }
 
+/* Find the object whose origin is nearest to that of rect in the specified
+   direction, considering only objects that overlap the strip swept out by
+   rect as it moves that way, and that pass the (optional) filter.  Ties are
+   broken in favour of the smaller co-ordinate on the other axis.
+
+   Nodes are visited best-first, and any node that can't contain anything
+   better than the best object found so far is pruned, so this doesn't need
+   to look at every object in the strip. */
+- (id)nearestObjectInDirection:(CSQuadTreeDirection)direction
+		      fromRect:(NSRect)rect
+			filter:(CSQuadTreeFilter)filter
+		       context:(void *)context
+{
+  struct nearest_search search;
+  NSRect strip = rect;
+
+  search.axis = (direction == CSQuadTreeMinXDirection
+		 || direction == CSQuadTreeMaxXDirection) ? 0 : 1;
+  search.sign = (direction == CSQuadTreeMinXDirection
+		 || direction == CSQuadTreeMinYDirection) ? -1.0 : 1.0;
+  search.tieSign = 1.0;
+  search.hasOrigin = YES;
+  search.hasStrip = YES;
+
+  switch (direction) {
+  case CSQuadTreeMinXDirection:
+    strip.size.width = NSMinX (rect) - NSMinX (bounds);
+    strip.origin.x = NSMinX (bounds);
+    break;
+  case CSQuadTreeMaxXDirection:
+    strip.size.width = NSMaxX (bounds) - NSMinX (rect);
+    break;
+  case CSQuadTreeMinYDirection:
+    strip.size.height = NSMinY (rect) - NSMinY (bounds);
+    strip.origin.y = NSMinY (bounds);
+    break;
+  case CSQuadTreeMaxYDirection:
+    strip.size.height = NSMaxY (bounds) - NSMinY (rect);
+    break;
+  }
+
+  search.origin = rect.origin;
+  search.strip = strip;
+  search.filter = filter;
+  search.context = context;
+
+  if (!findNearestObject (head, &search)) {
+    [NSException raise:@"CSOutOfMemory"
+		format:@"%@",
+      NSLocalizedString (@"Not enough memory.",
+                         @"Not enough memory.")];
+  }
+
+#if DEBUG_NEAREST_SEARCH
+  {
+    struct nearest_search check = search;
+
+    check.best = nil;
+    bruteForceNearestObject (head, &check);
+
+    NSAssert ((!check.best && !search.best)
+	      || (check.best && search.best
+		  && check.bestKey == search.bestKey
+		  && check.bestTieBreak == search.bestTieBreak),
+	      @"Nearest object search disagrees with brute force result.");
+  }
+#endif
+
+  return search.best;
+}
+
+/* Find the object that lies furthest in the specified direction (i.e. for
+   CSQuadTreeMinYDirection, the object with the smallest y co-ordinate).
+   Ties are broken in the same sense on the other axis, so for the "Min"
+   directions we prefer the smaller co-ordinate, and for the "Max" directions
+   the larger one.  This uses the cached node extents, so it only descends
+   into nodes that could hold a better object than the best so far. */
+- (id)extremeObjectInDirection:(CSQuadTreeDirection)direction
+			filter:(CSQuadTreeFilter)filter
+		       context:(void *)context
+{
+  struct nearest_search search;
+
+  search.axis = (direction == CSQuadTreeMinXDirection
+		 || direction == CSQuadTreeMaxXDirection) ? 0 : 1;
+  search.sign = (direction == CSQuadTreeMinXDirection
+		 || direction == CSQuadTreeMinYDirection) ? 1.0 : -1.0;
+  search.tieSign = search.sign;
+  search.hasOrigin = NO;
+  search.hasStrip = NO;
+  search.filter = filter;
+  search.context = context;
+
+  if (!findNearestObject (head, &search)) {
+    [NSException raise:@"CSOutOfMemory"
+		format:@"%@",
+      NSLocalizedString (@"Not enough memory.",
+                         @"Not enough memory.")];
+  }
+
+  return search.best;
+}
+
 - (void)removeObject:(id)object
 {
   unsigned index = ~0u;
@@ -400,6 +670,8 @@ static int whichBox (NSRect larger, NSRect smaller)
 						  [object hash],
 						  &index);
   BOOL isHead = node == head;
+
+  ++version;
   
   NSAssert (node, @"You can't remove an object that isn't in the tree.");
   
@@ -421,6 +693,8 @@ static int whichBox (NSRect larger, NSRect smaller)
 							   &index);
   BOOL isHead = node == head;
 
+  ++version;
+
   NSAssert (node, @"You can't remove an object that isn't in the tree.");
   
   node = removeObjectFromNode (node, index);
@@ -441,6 +715,8 @@ static int whichBox (NSRect larger, NSRect smaller)
 							   &index);
   BOOL isHead = node == head;
 
+  ++version;
+
   NSAssert (node, @"You can't remove an object that isn't in the tree.");
   
   node = removeObjectFromNode (node, index);
@@ -452,11 +728,15 @@ static int whichBox (NSRect larger, NSRect smaller)
 - (void)removeAllObjects
 {
   unsigned n;
+
+  ++version;
   
 #if DEBUG_NODE_ALLOCATION
   NSLog (@"Removing all objects, head is %p (%p, %p, %p, %p)", head,
 	 head->tl, head->tr, head->bl, head->br);
 #endif
+
+  thawNode (head);
   
   if (head->tl) releaseNode (head->tl, TRUE);
   if (head->tr) releaseNode (head->tr, TRUE);
@@ -467,6 +747,8 @@ static int whichBox (NSRect larger, NSRect smaller)
     [head->objects[n].object release];
   
   head->used = 0;
+  head->count = 0;
+  head->extent = NSZeroRect;
 }
 
 - (void)stroke
@@ -493,10 +775,32 @@ addObjectsInNodeToSet (NSMutableSet *set,
     addObjectsInNodeToSet (set, node->br);
 }  
 
+- (unsigned long)version
+{
+  return version;
+}
+
+- (CSRectQuadTreeSnapshot *)snapshot
+{
+  if (!snapshot || snapshotVersion != version) {
+    [snapshot release];
+    snapshot = [[CSRectQuadTreeSnapshot alloc] initWithQuadTree:head
+							  bounds:bounds
+							 version:version];
+    snapshotVersion = version;
+  }
+
+  return [[snapshot retain] autorelease];
+}
+
 - (NSMutableSet *)allObjects
 {
-  NSMutableSet *set = [NSMutableSet set];
-  
+  NSMutableSet *set;
+
+  if (shouldQueryInParallel (head, bounds, NSZeroRect, NO, NO, YES))
+    return parallelQuery (head, bounds, NSZeroRect, NO, NO, YES);
+
+  set = [NSMutableSet set];
   addObjectsInNodeToSet (set, head);
   
   return set;
@@ -593,9 +897,22 @@ addObjectToNode (struct quad_tree_node *node,
     if (!node)
       return NULL;
   }
-  
+
+  thawNode (node);
   node->objects[node->used].object = [object retain];
   node->objects[node->used++].bounds = bounds;
+
+  // Update the cached extents
+  {
+    struct quad_tree_node *ptr;
+
+    for (ptr = node; ptr; ptr = ptr->parent) {
+      if (ptr->count++)
+	ptr->extent = CSUnionRect (ptr->extent, bounds);
+      else
+	ptr->extent = bounds;
+    }
+  }
   
   return node;
 }
@@ -611,12 +928,18 @@ removeObjectFromNode (struct quad_tree_node *node,
               @"Can't remove a node after the last index (count %u, index %u)!",
               node->used, index);
 
+  NSRect removedRect = node->objects[index].bounds;
+
+  thawNode (node);
   [node->objects[index].object release];
   memmove (&node->objects[index], &node->objects[index + 1], 
-	   sizeof (node->objects[0]) * (node->used - index));
+	   sizeof (node->objects[0]) * (node->used - index - 1));
+
+  --node->used;
+  updateExtentsAfterRemoval (node, removedRect);
 
   struct quad_tree_node *parent = node->parent;
-  if (!--node->used && parent
+  if (!node->used && parent
       && !node->tl && !node->tr && !node->bl && !node->br) {
     do {
       releaseNode (node, NO);
@@ -633,6 +956,125 @@ removeObjectFromNode (struct quad_tree_node *node,
   return node;
 }
 
+/* Recalculate the extent of a single node from its objects and children */
+static NSRect
+extentOfNode (struct quad_tree_node *node)
+{
+  NSRect extent = NSZeroRect;
+  BOOL foundRect = NO;
+  unsigned n;
+  QuadTreeBox box;
+
+  for (n = 0; n < node->used; ++n) {
+    if (foundRect)
+      extent = CSUnionRect (extent, node->objects[n].bounds);
+    else {
+      extent = node->objects[n].bounds;
+      foundRect = YES;
+    }
+  }
+
+  for (box = 0; box < 4; ++box) {
+    struct quad_tree_node *child = node->boxes[box];
+
+    if (child && child->count) {
+      if (foundRect)
+	extent = CSUnionRect (extent, child->extent);
+      else {
+	extent = child->extent;
+	foundRect = YES;
+      }
+    }
+  }
+
+  return extent;
+}
+
+/* Update the cached counts and extents after removing an object from a
+   node.  A node's extent can only change if the object touched its edge,
+   and once we find a node whose extent hasn't changed, we know that none
+   of its ancestors' extents have either. */
+static void
+updateExtentsAfterRemoval (struct quad_tree_node *node,
+			   NSRect		 removedRect)
+{
+  BOOL recompute = YES;
+
+  for (; node; node = node->parent) {
+    --node->count;
+
+    if (!recompute)
+      continue;
+
+    if (!node->count) {
+      node->extent = NSZeroRect;
+    } else if (NSMinX (removedRect) > NSMinX (node->extent)
+	       && NSMaxX (removedRect) < NSMaxX (node->extent)
+	       && NSMinY (removedRect) > NSMinY (node->extent)
+	       && NSMaxY (removedRect) < NSMaxY (node->extent)) {
+      recompute = NO;
+    } else {
+      NSRect extent = extentOfNode (node);
+
+      if (NSEqualRects (extent, node->extent))
+	recompute = NO;
+      else
+	node->extent = extent;
+    }
+  }
+}
+
+/* Grow each node so that it has room for its pending objects, clearing the
+   pending counts as we go.  Children are done first, so that the node
+   pointers we're walking remain valid.  Returns NO if we ran out of
+   memory. */
+static BOOL
+reserveNodeSlots (struct quad_tree_node **nodePtr)
+{
+  struct quad_tree_node *node = *nodePtr;
+  unsigned needed = node->used + node->pending;
+  QuadTreeBox box;
+  BOOL ok = YES;
+
+  for (box = 0; box < 4; ++box) {
+    if (node->boxes[box] && !reserveNodeSlots (&node->boxes[box]))
+      ok = NO;
+  }
+
+  node->pending = 0;
+
+  if (ok && needed > node->total) {
+    node = resizeNode (node, (needed + 3) & ~3);
+
+    if (!node)
+      return NO;
+
+    *nodePtr = node;
+  }
+
+  return ok;
+}
+
+/* Recalculate the cached counts and extents of an entire subtree */
+static void
+recomputeExtents (struct quad_tree_node *node)
+{
+  QuadTreeBox box;
+
+  node->count = node->used;
+
+  for (box = 0; box < 4; ++box) {
+    struct quad_tree_node *child = node->boxes[box];
+
+    if (child) {
+      recomputeExtents (child);
+      node->count += child->count;
+    }
+  }
+
+  node->extent = node->count ? extentOfNode (node) : NSZeroRect;
+}
+
 /* Release a quad-tree node, optionally releasing all child nodes */
 static void
 releaseNode (struct quad_tree_node *node, BOOL recurse)
@@ -649,6 +1091,7 @@ releaseNode (struct quad_tree_node *node, BOOL recurse)
 #endif
   
   if (node->parent) {
+    thawNode (node->parent);
     if (node->parent->tl == node)
       node->parent->tl = NULL;
     if (node->parent->tr == node)
@@ -671,6 +1114,8 @@ releaseNode (struct quad_tree_node *node, BOOL recurse)
     for (n = 0; n < node->used; ++n)
       [node->objects[n].object release];
   }
+
+  releaseSnapshotNode (node->frozen);
   
 #if DEBUG_NODE_ALLOCATION
   NSLog (@"Freeing %p", node);
@@ -703,8 +1148,10 @@ splitForRect (struct quad_tree_node *head,
     if (box == kNoBox)
       return head;
     
-    if (!head->boxes[box])
+    if (!head->boxes[box]) {
+      thawNode (head);
       head->boxes[box] = newNode (head);
+    }
 	
     head = head->boxes[box];
     bounds = boundsForBox (bounds, box);
@@ -757,117 +1204,379 @@ addObjectsInRectToSet (NSMutableSet *set,
   }
 }
 
-/* Find the node for an object, without using information about its
-   rectangle. */
-static struct quad_tree_node *
-findNodeForObject (struct quad_tree_node *node,
-		   id			 object,
-		   unsigned		 hash,
-		   unsigned		 *ndx)
+/* Parallel queries.  We expand the top few levels of the tree on the
+   calling thread until we have enough subtrees to keep every CPU busy,
+   then search the subtrees concurrently, each into its own buffer.  The
+   buffers are merged at the end, on the calling thread, since
+   NSMutableSet isn't thread-safe.  Nothing here sends any messages, so
+   there are no autorelease pools to worry about. */
+struct rect_query {
+  NSRect  rect;
+  BOOL	  includeIntersect;
+  BOOL	  includeContained;
+  BOOL	  allObjects;
+};
+
+struct object_buffer {
+  id	  *objects;
+  size_t  count, capacity;
+  BOOL	  failed;
+};
+
+struct query_task {
+  struct quad_tree_node	*node;
+  NSRect		bounds;
+  struct object_buffer	results;
+};
+
+struct parallel_query {
+  const struct rect_query *query;
+  struct query_task	  *tasks;
+};
+
+/* These mirror the tests in addObjectsInRectToSet(), with the addition of
+   extent pruning */
+static inline BOOL
+queryMatchesObject (const struct rect_query *query, NSRect objectRect)
 {
-  CHECK_NODE (node);
-  
-  unsigned n;
-  struct quad_tree_node *found = NULL;
-  
-  for (n = 0; n < node->used; ++n) {
-    if (hash == [node->objects[n].object hash]
-	&& [object isEqualTo:node->objects[n].object]) {
-      if (ndx)
-	*ndx = n;
-      return node;
-    }
-  }
-  
-  if (node->tl)
-    found = findNodeForObject (node->tl, object, hash, ndx);
+  BOOL contained;
 
-  if (!found && node->tr)
-    found = findNodeForObject (node->tr, object, hash, ndx);
+  if (query->allObjects)
+    return YES;
 
-  if (!found && node->bl)
-    found = findNodeForObject (node->bl, object, hash, ndx);
-  
-  if (!found && node->br)
-    found = findNodeForObject (node->br, object, hash, ndx);
-  
-  return found;
+  contained = CSContainsRect (query->rect, objectRect);
+
+  if (query->includeContained && contained)
+    return YES;
+
+  return (query->includeIntersect && !contained
+	  && CSIntersectsRect (query->rect, objectRect));
 }
 
-/* Find the node for an object, with a rectangle. */
-static struct quad_tree_node *
-findNodeForObjectWithRect (struct quad_tree_node *node,
-			   NSRect		 bounds,
-			   id			 object,
-			   unsigned		 hash,
-			   NSRect		 rect,
-			   BOOL			 rectIsHint,
-			   unsigned		 *ndx)
+static inline BOOL
+queryVisitsNode (const struct rect_query *query,
+		 struct quad_tree_node	 *node,
+		 NSRect			 nodeBounds)
 {
-  CHECK_NODE (node);
-  
-  struct quad_tree_node *found = NULL;
-  unsigned n;
-  QuadTreeBox box;
-  
-  if (!rectIsHint && !CSContainsRect (bounds, rect))
-    return NULL;
-  
-  if (CSContainsRect (rect, bounds))
-    return findNodeForObject (node, object, hash, ndx);
-  
-  for (n = 0; n < node->used; ++n) {
-    if (hash == [node->objects[n].object hash]
-	&& [object isEqualTo:node->objects[n].object]
-	&& (rectIsHint || NSEqualRects (node->objects[n].bounds, rect))) {
-      if (ndx)
-	*ndx = n;
-      return node;
-    }
-  }
+  if (!node->count)
+    return NO;
 
-  for (box = 0; box < 4; ++box) {
-    if (node->boxes[box]) {
-      NSRect boxBounds = boundsForBox (bounds, box);
-      if (CSIntersectsRect (rect, boxBounds)) {
-	found = findNodeForObjectWithRect (node->boxes[box], boxBounds,
-					   object, hash, rect, rectIsHint, ndx);
-	if (found)
-	  return found;
-      }
-    }
-  }
+  if (query->allObjects)
+    return YES;
 
-  return found;
+  return (CSIntersectsRect (nodeBounds, query->rect)
+	  && CSIntersectsRect (node->extent, query->rect)
+	  && (query->includeContained
+	      || !CSContainsRect (query->rect, nodeBounds)));
 }
 
-/* Work out the rectangle that encloses all nodes in the quadtree */
-static void
-unionRectForAllNodes (struct quad_tree_node *node,
-                      NSRect                 bounds,
-                      NSRect                *unionRect,
-                      BOOL                  *foundRect)
+/* Estimates how many objects a query will return from the counts of the
+   nodes it visits, giving up once the estimate reaches limit.  Nodes below
+   ESTIMATE_LEVELS, or (if we want contained objects) whose extent lies
+   inside the rect, are counted whole. */
+static unsigned
+estimateQueryResults (const struct rect_query *query,
+		      struct quad_tree_node   *node,
+		      NSRect		      nodeBounds,
+		      unsigned		      level,
+		      unsigned		      limit)
 {
-  CHECK_NODE (node);
-  unsigned n;
+  unsigned estimate;
   QuadTreeBox box;
 
-  for (n = 0; n < node->used; ++n) {
-    if (!*foundRect) {
-      *foundRect = YES;
-      *unionRect = node->objects[n].bounds;
-    } else {
-      *unionRect = NSUnionRect (*unionRect, node->objects[n].bounds);
-    }
+  if (query->allObjects || level >= ESTIMATE_LEVELS
+      || (query->includeContained
+	  && CSContainsRect (query->rect, node->extent)))
+    return node->count;
+
+  estimate = node->used;
+
+  for (box = 0; box < 4 && estimate < limit; ++box) {
+    struct quad_tree_node *child = node->boxes[box];
+
+    if (child) {
+      NSRect boxBounds = boundsForBox (nodeBounds, box);
+
+      if (queryVisitsNode (query, child, boxBounds))
+	estimate += estimateQueryResults (query, child, boxBounds, level + 1,
+					  limit - estimate);
+    }
+  }
+
+  return estimate;
+}
+
+/* A small query over a big tree is quicker done serially, so this goes by
+   the expected size of the result, not of the tree */
+static BOOL
+shouldQueryInParallel (struct quad_tree_node *head,
+		       NSRect		     bounds,
+		       NSRect		     rect,
+		       BOOL		     includeIntersect,
+		       BOOL		     includeContained,
+		       BOOL		     allObjects)
+{
+  struct rect_query query = { rect, includeIntersect, includeContained,
+			      allObjects };
+
+  if (head->count < PARALLEL_QUERY_THRESHOLD || CSParallelCPUCount () < 2
+      || !queryVisitsNode (&query, head, bounds))
+    return NO;
+
+  return (estimateQueryResults (&query, head, bounds, 0,
+				PARALLEL_QUERY_THRESHOLD)
+	  >= PARALLEL_QUERY_THRESHOLD);
+}
+
+static inline void
+appendObject (struct object_buffer *buffer, id object)
+{
+  if (buffer->count >= buffer->capacity) {
+    size_t newCapacity = buffer->capacity ? buffer->capacity * 2 : 256;
+    id *newObjects = (id *)realloc (buffer->objects,
+				    sizeof (id) * newCapacity);
+
+    if (!newObjects) {
+      buffer->failed = YES;
+      return;
+    }
+
+    buffer->objects = newObjects;
+    buffer->capacity = newCapacity;
+  }
+
+  buffer->objects[buffer->count++] = object;
+}
+
+static void
+collectObjectsInNode (const struct rect_query *query,
+		      struct quad_tree_node   *node,
+		      NSRect		      nodeBounds,
+		      struct object_buffer    *buffer)
+{
+  unsigned n;
+  QuadTreeBox box;
+
+  for (n = 0; n < node->used; ++n) {
+    if (queryMatchesObject (query, node->objects[n].bounds))
+      appendObject (buffer, node->objects[n].object);
+  }
+
+  for (box = 0; box < 4; ++box) {
+    struct quad_tree_node *child = node->boxes[box];
+
+    if (child) {
+      NSRect boxBounds = boundsForBox (nodeBounds, box);
+
+      if (queryVisitsNode (query, child, boxBounds))
+	collectObjectsInNode (query, child, boxBounds, buffer);
+    }
+  }
+}
+
+static void
+runQueryTask (void *context, size_t n)
+{
+  struct parallel_query *parallel = (struct parallel_query *)context;
+  struct query_task *task = &parallel->tasks[n];
+
+  collectObjectsInNode (parallel->query, task->node, task->bounds,
+			&task->results);
+}
+
+static NSMutableSet *
+parallelQuery (struct quad_tree_node *head,
+	       NSRect		     bounds,
+	       NSRect		     rect,
+	       BOOL		     includeIntersect,
+	       BOOL		     includeContained,
+	       BOOL		     allObjects)
+{
+  struct rect_query query = { rect, includeIntersect, includeContained,
+			      allObjects };
+  struct object_buffer top = { NULL, 0, 0, NO };
+  struct parallel_query parallel;
+  struct query_task *tasks;
+  unsigned n, taskCount = 0, level;
+  unsigned target = CSParallelCPUCount () * TASKS_PER_CPU;
+  NSMutableSet *set = nil;
+  size_t total;
+  BOOL failed;
+  id *objects;
+
+  tasks = (struct query_task *)malloc (sizeof (struct query_task));
+
+  if (tasks && queryVisitsNode (&query, head, bounds)) {
+    memset (tasks, 0, sizeof (struct query_task));
+    tasks[0].node = head;
+    tasks[0].bounds = bounds;
+    taskCount = 1;
+  }
+
+  // Split the tree, collecting the objects from the nodes we expand
+  for (level = 0; 
+       tasks && taskCount && taskCount < target && level < MAX_SPLIT_LEVELS;
+       ++level) {
+    struct query_task *next
+      = (struct query_task *)calloc (taskCount * 4, sizeof (struct query_task));
+    unsigned nextCount = 0;
+
+    if (!next)
+      break;
+
+    for (n = 0; n < taskCount; ++n) {
+      struct quad_tree_node *node = tasks[n].node;
+      QuadTreeBox box;
+      unsigned m;
+
+      for (m = 0; m < node->used; ++m) {
+	if (queryMatchesObject (&query, node->objects[m].bounds))
+	  appendObject (&top, node->objects[m].object);
+      }
+
+      for (box = 0; box < 4; ++box) {
+	struct quad_tree_node *child = node->boxes[box];
+	NSRect boxBounds = boundsForBox (tasks[n].bounds, box);
+
+	if (child && queryVisitsNode (&query, child, boxBounds)) {
+	  next[nextCount].node = child;
+	  next[nextCount++].bounds = boxBounds;
+	}
+      }
+    }
+
+    free (tasks);
+    tasks = next;
+    taskCount = nextCount;
+  }
+
+  if (tasks) {
+    parallel.query = &query;
+    parallel.tasks = tasks;
+    CSParallelApply (taskCount, &parallel, runQueryTask);
+  }
+
+  // Merge the results
+  total = top.count;
+  failed = top.failed || !tasks;
+  for (n = 0; n < taskCount; ++n) {
+    total += tasks[n].results.count;
+    failed = failed || tasks[n].results.failed;
+  }
+
+  objects = failed ? NULL : (id *)malloc (sizeof (id) * (total ? total : 1));
+
+  if (objects) {
+    size_t pos = top.count;
+
+    memcpy (objects, top.objects, sizeof (id) * top.count);
+    for (n = 0; n < taskCount; ++n) {
+      memcpy (&objects[pos], tasks[n].results.objects,
+	      sizeof (id) * tasks[n].results.count);
+      pos += tasks[n].results.count;
+    }
+
+    set = [NSMutableSet setWithObjects:objects count:total];
+  }
+
+  for (n = 0; n < taskCount; ++n)
+    free (tasks[n].results.objects);
+  free (tasks);
+  free (top.objects);
+  free (objects);
+
+  if (!set) {
+    [NSException raise:@"CSOutOfMemory"
+		format:@"%@",
+      NSLocalizedString (@"Not enough memory.",
+                         @"Not enough memory.")];
+  }
+
+  return set;
+}
+
+/* Find the node for an object, without using information about its
+   rectangle. */
+static struct quad_tree_node *
+findNodeForObject (struct quad_tree_node *node,
+		   id			 object,
+		   unsigned		 hash,
+		   unsigned		 *ndx)
+{
+  CHECK_NODE (node);
+  
+  unsigned n;
+  struct quad_tree_node *found = NULL;
+  
+  for (n = 0; n < node->used; ++n) {
+    if (hash == [node->objects[n].object hash]
+	&& [object isEqualTo:node->objects[n].object]) {
+      if (ndx)
+	*ndx = n;
+      return node;
+    }
   }
   
+  if (node->tl)
+    found = findNodeForObject (node->tl, object, hash, ndx);
+
+  if (!found && node->tr)
+    found = findNodeForObject (node->tr, object, hash, ndx);
+
+  if (!found && node->bl)
+    found = findNodeForObject (node->bl, object, hash, ndx);
+  
+  if (!found && node->br)
+    found = findNodeForObject (node->br, object, hash, ndx);
+  
+  return found;
+}
+
+/* Find the node for an object, with a rectangle. */
+static struct quad_tree_node *
+findNodeForObjectWithRect (struct quad_tree_node *node,
+			   NSRect		 bounds,
+			   id			 object,
+			   unsigned		 hash,
+			   NSRect		 rect,
+			   BOOL			 rectIsHint,
+			   unsigned		 *ndx)
+{
+  CHECK_NODE (node);
+  
+  struct quad_tree_node *found = NULL;
+  unsigned n;
+  QuadTreeBox box;
+  
+  if (!rectIsHint && !CSContainsRect (bounds, rect))
+    return NULL;
+  
+  if (CSContainsRect (rect, bounds))
+    return findNodeForObject (node, object, hash, ndx);
+  
+  for (n = 0; n < node->used; ++n) {
+    if (hash == [node->objects[n].object hash]
+	&& [object isEqualTo:node->objects[n].object]
+	&& (rectIsHint || NSEqualRects (node->objects[n].bounds, rect))) {
+      if (ndx)
+	*ndx = n;
+      return node;
+    }
+  }
+
   for (box = 0; box < 4; ++box) {
     if (node->boxes[box]) {
       NSRect boxBounds = boundsForBox (bounds, box);
-      if (!CSContainsRect (*unionRect, boxBounds))
-	unionRectForAllNodes (node->boxes[box], boxBounds, unionRect, foundRect);
+      if (CSIntersectsRect (rect, boxBounds)) {
+	found = findNodeForObjectWithRect (node->boxes[box], boxBounds,
+					   object, hash, rect, rectIsHint, ndx);
+	if (found)
+	  return found;
+      }
     }
   }
+
+  return found;
 }
 
 /* Draw the quadtree (for debugging) */
@@ -930,3 +1639,535 @@ strokeQuadTreeNodes (struct quad_tree_node *node,
   }
 }
 
+/* Map an object's origin to a key and tie-break value for a directional
+   search, such that smaller values are better.  Returns NO if the search
+   has an origin and the object doesn't lie strictly beyond it. */
+static inline BOOL
+directionalKey (const struct nearest_search *search,
+		NSPoint			    pos,
+		CGFloat			    *key,
+		CGFloat			    *tieBreak)
+{
+  CGFloat along = search->axis ? pos.y : pos.x;
+  CGFloat across = search->axis ? pos.x : pos.y;
+
+  *key = search->sign * along;
+  *tieBreak = search->tieSign * across;
+
+  if (search->hasOrigin) {
+    CGFloat origin = search->axis ? search->origin.y : search->origin.x;
+
+    if (*key <= search->sign * origin)
+      return NO;
+  }
+
+  return YES;
+}
+
+/* The smallest key that any object in the specified node could have */
+static inline CGFloat
+directionalNodeKey (const struct nearest_search *search,
+		    struct quad_tree_node	*node)
+{
+  NSRect extent = node->extent;
+
+  if (search->axis)
+    return search->sign > 0 ? NSMinY (extent) : -NSMaxY (extent);
+  else
+    return search->sign > 0 ? NSMinX (extent) : -NSMaxX (extent);
+}
+
+/* Consider an object as a candidate for the search result */
+static inline void
+considerObject (struct nearest_search	      *search,
+		const struct quad_tree_object *obj)
+{
+  CGFloat key, tieBreak;
+
+  if ((search->hasStrip && !CSIntersectsRect (search->strip, obj->bounds))
+      || !directionalKey (search, obj->bounds.origin, &key, &tieBreak))
+    return;
+
+  if (search->best
+      && (key > search->bestKey
+	  || (key == search->bestKey && tieBreak >= search->bestTieBreak)))
+    return;
+
+  if (search->filter && !search->filter (obj->object, search->context))
+    return;
+
+  search->best = obj->object;
+  search->bestKey = key;
+  search->bestTieBreak = tieBreak;
+}
+
+/* A simple binary heap of nodes, ordered by key, for best-first searches.
+   Most searches only need a handful of entries, so we start off using the
+   storage inside the structure and only go to the heap if we need more. */
+struct node_queue_entry {
+  CGFloat		key;
+  struct quad_tree_node *node;
+};
+
+struct node_queue {
+  struct node_queue_entry *entries;
+  unsigned		  count, size;
+  struct node_queue_entry local[32];
+};
+
+static void
+initNodeQueue (struct node_queue *queue)
+{
+  queue->entries = queue->local;
+  queue->count = 0;
+  queue->size = sizeof (queue->local) / sizeof (queue->local[0]);
+}
+
+static void
+freeNodeQueue (struct node_queue *queue)
+{
+  if (queue->entries != queue->local)
+    free (queue->entries);
+}
+
+static BOOL
+pushNode (struct node_queue	*queue,
+	  CGFloat		key,
+	  struct quad_tree_node *node)
+{
+  unsigned n;
+
+  if (queue->count == queue->size) {
+    unsigned newSize = queue->size * 2;
+    struct node_queue_entry *newEntries;
+
+    if (queue->entries == queue->local) {
+      newEntries = (struct node_queue_entry *)
+	malloc (sizeof (struct node_queue_entry) * newSize);
+      if (newEntries)
+	memcpy (newEntries, queue->local, sizeof (queue->local));
+    } else {
+      newEntries = (struct node_queue_entry *)
+	realloc (queue->entries, sizeof (struct node_queue_entry) * newSize);
+    }
+
+    if (!newEntries)
+      return NO;
+
+    queue->entries = newEntries;
+    queue->size = newSize;
+  }
+
+  // Sift up
+  n = queue->count++;
+  while (n) {
+    unsigned parent = (n - 1) / 2;
+
+    if (queue->entries[parent].key <= key)
+      break;
+
+    queue->entries[n] = queue->entries[parent];
+    n = parent;
+  }
+
+  queue->entries[n].key = key;
+  queue->entries[n].node = node;
+
+  return YES;
+}
+
+static BOOL
+popNode (struct node_queue	 *queue,
+	 struct node_queue_entry *entry)
+{
+  struct node_queue_entry last;
+  unsigned n = 0;
+
+  if (!queue->count)
+    return NO;
+
+  *entry = queue->entries[0];
+  last = queue->entries[--queue->count];
+
+  // Sift down
+  for (;;) {
+    unsigned child = 2 * n + 1;
+
+    if (child >= queue->count)
+      break;
+    if (child + 1 < queue->count
+	&& queue->entries[child + 1].key < queue->entries[child].key)
+      ++child;
+    if (last.key <= queue->entries[child].key)
+      break;
+
+    queue->entries[n] = queue->entries[child];
+    n = child;
+  }
+
+  if (queue->count)
+    queue->entries[n] = last;
+
+  return YES;
+}
+
+/* Best-first directional search.  Returns NO if we ran out of memory.
+   Since the search only cares about the objects themselves, we use each
+   node's cached extent rather than its bounds, which lets us skip empty
+   space (and empty subtrees) entirely. */
+static BOOL
+findNearestObject (struct quad_tree_node *head,
+		   struct nearest_search *search)
+{
+  struct node_queue queue;
+  struct node_queue_entry entry;
+  BOOL ok = YES;
+
+  search->best = nil;
+
+  if (!head->count)
+    return YES;
+
+  initNodeQueue (&queue);
+
+  ok = pushNode (&queue, directionalNodeKey (search, head), head);
+
+  while (ok && popNode (&queue, &entry)) {
+    struct quad_tree_node *node = entry.node;
+    unsigned n;
+    QuadTreeBox box;
+
+    CHECK_NODE (node);
+
+    /* Everything left in the queue is at least this far away, so if we've
+       already found something nearer, we're done. */
+    if (search->best && entry.key > search->bestKey)
+      break;
+
+    for (n = 0; n < node->used; ++n)
+      considerObject (search, &node->objects[n]);
+
+    for (box = 0; box < 4 && ok; ++box) {
+      struct quad_tree_node *child = node->boxes[box];
+
+      if (child && child->count) {
+	CGFloat key = directionalNodeKey (search, child);
+
+	if ((!search->hasStrip || CSIntersectsRect (search->strip,
+						    child->extent))
+	    && (!search->best || key <= search->bestKey))
+	  ok = pushNode (&queue, key, child);
+      }
+    }
+  }
+
+  freeNodeQueue (&queue);
+
+  return ok;
+}
+
+#if DEBUG_NEAREST_SEARCH
+/* Exhaustive version of the above, used to check the results */
+static void
+bruteForceNearestObject (struct quad_tree_node *node,
+			 struct nearest_search *search)
+{
+  unsigned n;
+  QuadTreeBox box;
+
+  for (n = 0; n < node->used; ++n)
+    considerObject (search, &node->objects[n]);
+
+  for (box = 0; box < 4; ++box) {
+    if (node->boxes[box])
+      bruteForceNearestObject (node->boxes[box], search);
+  }
+}
+#endif
+
+#pragma mark Snapshots
+
+static inline struct snapshot_node *
+retainSnapshotNode (struct snapshot_node *node)
+{
+  __sync_add_and_fetch (&node->refCount, 1);
+  return node;
+}
+
+/* Release a snapshot node; this may be called on any thread */
+static void
+releaseSnapshotNode (struct snapshot_node *node)
+{
+  QuadTreeBox box;
+  unsigned n;
+
+  if (!node || __sync_sub_and_fetch (&node->refCount, 1))
+    return;
+
+  for (box = 0; box < 4; ++box)
+    releaseSnapshotNode (node->children[box]);
+
+  for (n = 0; n < node->used; ++n)
+    [node->objects[n].object release];
+
+  free (node);
+}
+
+/* Throw away the frozen copies of a node and its ancestors because the
+   node is about to change.  Snapshots that already share the copies keep
+   them alive. */
+static void
+thawNode (struct quad_tree_node *node)
+{
+  while (node && node->frozen) {
+    releaseSnapshotNode (node->frozen);
+    node->frozen = NULL;
+    node = node->parent;
+  }
+}
+
+/* Return a frozen copy of a node, making new copies of it and of any of its
+   children that have changed since they were last frozen.  Returns NULL if
+   we run out of memory. */
+static struct snapshot_node *
+freezeNode (struct quad_tree_node *node)
+{
+  struct snapshot_node *frozen;
+  QuadTreeBox box;
+  unsigned n;
+
+  if (node->frozen)
+    return node->frozen;
+
+  frozen = (struct snapshot_node *)malloc (sizeof (struct snapshot_node)
+					   + sizeof (frozen->objects[0])
+					   * node->used);
+
+  if (!frozen)
+    return NULL;
+
+  for (box = 0; box < 4; ++box) {
+    struct snapshot_node *child = NULL;
+
+    if (node->boxes[box]) {
+      child = freezeNode (node->boxes[box]);
+
+      if (!child) {
+	while (box--)
+	  releaseSnapshotNode (frozen->children[box]);
+	free (frozen);
+	return NULL;
+      }
+
+      retainSnapshotNode (child);
+    }
+
+    frozen->children[box] = child;
+  }
+
+  frozen->refCount = 1;		// Owned by the node
+  frozen->extent = node->extent;
+  frozen->count = node->count;
+  frozen->used = node->used;
+
+  for (n = 0; n < node->used; ++n) {
+    frozen->objects[n].object = [node->objects[n].object retain];
+    frozen->objects[n].bounds = node->objects[n].bounds;
+  }
+
+  node->frozen = frozen;
+
+  return frozen;
+}
+
+/* The snapshot equivalent of addObjectsInRectToSet(); we can also skip
+   any node whose extent doesn't touch the rectangle */
+static void
+addSnapshotObjectsInRectToSet (NSMutableSet		    *set,
+			       const struct snapshot_node   *node,
+			       NSRect			    bounds,
+			       NSRect			    rect,
+			       BOOL			    includeIntersect,
+			       BOOL			    includeContained)
+{
+  QuadTreeBox box;
+  unsigned n;
+
+  if (!node->count || !CSIntersectsRect (rect, node->extent))
+    return;
+
+  for (n = 0; n < node->used; ++n) {
+    NSRect objectRect = node->objects[n].bounds;
+    BOOL contained = CSContainsRect (rect, objectRect);
+    BOOL intersects = contained || CSIntersectsRect (rect, objectRect);
+
+    if ((includeContained && contained)
+	|| (includeIntersect && intersects && (includeContained || !contained)))
+      [set addObject:node->objects[n].object];
+  }
+
+  for (box = 0; box < 4; ++box) {
+    const struct snapshot_node *child = node->children[box];
+    NSRect childBounds = boundsForBox (bounds, box);
+
+    if (child && (includeContained || !CSContainsRect (rect, childBounds))) {
+      addSnapshotObjectsInRectToSet (set, child, childBounds, rect,
+				     includeIntersect, includeContained);
+    }
+  }
+}
+
+/* Adds the objects containing the point to the set, or, if set is nil,
+   just returns the first one */
+static id
+snapshotObjectsAtPoint (NSMutableSet		    *set,
+			const struct snapshot_node  *node,
+			NSPoint			    point)
+{
+  QuadTreeBox box;
+  unsigned n;
+
+  if (!node->count || !NSPointInRect (point, node->extent))
+    return nil;
+
+  for (n = 0; n < node->used; ++n) {
+    if (NSPointInRect (point, node->objects[n].bounds)) {
+      if (!set)
+	return node->objects[n].object;
+      [set addObject:node->objects[n].object];
+    }
+  }
+
+  for (box = 0; box < 4; ++box) {
+    if (node->children[box]) {
+      id found = snapshotObjectsAtPoint (set, node->children[box], point);
+
+      if (found)
+	return found;
+    }
+  }
+
+  return nil;
+}
+
+static void
+addAllSnapshotObjectsToSet (NSMutableSet		*set,
+			    const struct snapshot_node	*node)
+{
+  QuadTreeBox box;
+  unsigned n;
+
+  for (n = 0; n < node->used; ++n)
+    [set addObject:node->objects[n].object];
+
+  for (box = 0; box < 4; ++box) {
+    if (node->children[box])
+      addAllSnapshotObjectsToSet (set, node->children[box]);
+  }
+}
+
+@implementation CSRectQuadTreeSnapshot
+
+- (id)initWithQuadTree:(struct quad_tree_node *)head
+		bounds:(NSRect)treeBounds
+	       version:(unsigned long)treeVersion
+{
+  if ((self = [super init])) {
+    struct snapshot_node *frozen = freezeNode (head);
+
+    if (!frozen) {
+      [self release];
+      [NSException raise:@"CSOutOfMemory"
+		  format:@"%@",
+        NSLocalizedString (@"Not enough memory.",
+                           @"Not enough memory.")];
+    }
+
+    root = retainSnapshotNode (frozen);
+    bounds = treeBounds;
+    version = treeVersion;
+  }
+
+  return self;
+}
+
+- (void)dealloc
+{
+  releaseSnapshotNode (root);
+  [super dealloc];
+}
+
+- (unsigned long)version
+{
+  return version;
+}
+
+- (NSRect)bounds
+{
+  return bounds;
+}
+
+- (NSRect)objectBounds
+{
+  if (!root->count)
+    return NSZeroRect;
+
+  return root->extent;
+}
+
+- (unsigned)count
+{
+  return root->count;
+}
+
+- (id)objectAtPoint:(NSPoint)point
+{
+  return snapshotObjectsAtPoint (nil, root, point);
+}
+
+- (NSMutableSet *)objectsAtPoint:(NSPoint)point
+{
+  NSMutableSet *set = [NSMutableSet set];
+
+  snapshotObjectsAtPoint (set, root, point);
+
+  return set;
+}
+
+- (NSMutableSet *)objectsInRect:(NSRect)rect
+{
+  NSMutableSet *set = [NSMutableSet set];
+
+  addSnapshotObjectsInRectToSet (set, root, bounds, rect, NO, YES);
+
+  return set;
+}
+
+- (NSMutableSet *)objectsIntersectingRect:(NSRect)rect
+{
+  NSMutableSet *set = [NSMutableSet set];
+
+  addSnapshotObjectsInRectToSet (set, root, bounds, rect, YES, YES);
+
+  return set;
+}
+
+- (NSMutableSet *)objectsIntersectingRectBoundary:(NSRect)rect
+{
+  NSMutableSet *set = [NSMutableSet set];
+
+  addSnapshotObjectsInRectToSet (set, root, bounds, rect, YES, NO);
+
+  return set;
+}
+
+- (NSMutableSet *)allObjects
+{
+  NSMutableSet *set = [NSMutableSet setWithCapacity:root->count];
+
+  addAllSnapshotObjectsToSet (set, root);
+
+  return set;
+}
+
+@end
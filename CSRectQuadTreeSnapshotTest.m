@@ -0,0 +1,349 @@
+//
+//  CSRectQuadTreeSnapshotTest.m
+//  CSIconView
+//
+//  Created by Alastair Houghton on 19/03/2010.
+//  Copyright (c) 2005-2010 Coriolis Systems Limited
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+//
+
+/* Checks CSRectQuadTree snapshots while they're being read on several
+   threads at once.  Reader threads query whichever snapshot the main thread
+   last published and compare every answer with a record of what the tree
+   held when that snapshot was taken, while the main thread carries on
+   adding and removing objects.  The main thread also holds on to a few
+   older snapshots and checks them again at the end, to make sure that
+   sharing nodes with later snapshots hasn't changed them.
+
+   It is meant to be built with ThreadSanitizer, e.g.
+
+     cc -fsanitize=thread -g -o CSRectQuadTreeSnapshotTest \
+       CSRectQuadTreeSnapshotTest.m CSRectQuadTree.m CSParallel.c \
+       -framework Cocoa
+     ./CSRectQuadTreeSnapshotTest
+
+   It prints any failures and exits with a non-zero status if there were
+   any (ThreadSanitizer reports races itself). */
+
+#import <Cocoa/Cocoa.h>
+#import "CSRectQuadTree.h"
+#import "CSRectUtils.h"
+
+#define READER_COUNT	    4
+#define SLOT_COLUMNS	    50
+#define SLOT_COUNT	    (SLOT_COLUMNS * SLOT_COLUMNS)
+#define SLOT_SIZE	    100.0f
+#define MUTATION_COUNT	    20000
+#define BULK_ADD_INTERVAL   64
+#define BULK_ADD_COUNT	    16
+#define CLEAR_INTERVAL	    7919
+#define KEEP_INTERVAL	    2500
+#define KEEP_COUNT	    (MUTATION_COUNT / KEEP_INTERVAL)
+
+/* What the tree held when a snapshot was taken */
+@interface CSPublishedSnapshot : NSObject
+{
+@public
+  CSRectQuadTreeSnapshot  *snapshot;
+  BOOL			  present[SLOT_COUNT];
+  unsigned		  count;
+}
+- (id)initWithTree:(CSRectQuadTree *)tree present:(const BOOL *)present;
+@end
+
+@implementation CSPublishedSnapshot
+
+- (id)initWithTree:(CSRectQuadTree *)tree present:(const BOOL *)slots
+{
+  if ((self = [super init])) {
+    unsigned n;
+
+    snapshot = [[tree snapshot] retain];
+    memcpy (present, slots, sizeof (present));
+    for (n = 0; n < SLOT_COUNT; ++n) {
+      if (present[n])
+	++count;
+    }
+  }
+
+  return self;
+}
+
+- (void)dealloc
+{
+  [snapshot release];
+  [super dealloc];
+}
+
+@end
+
+static NSCondition	    *condition;
+static CSPublishedSnapshot  *published;
+static BOOL		    done;
+static unsigned		    readersRunning;
+static unsigned		    totalQueries, totalFailures;
+
+/* Where object n lives; inset so that neighbours don't touch */
+static NSRect
+slotRect (unsigned n)
+{
+  return NSMakeRect ((n % SLOT_COLUMNS) * SLOT_SIZE + 10.0f,
+		     (n / SLOT_COLUMNS) * SLOT_SIZE + 10.0f,
+		     SLOT_SIZE - 20.0f, SLOT_SIZE - 20.0f);
+}
+
+static uint32_t
+nextRandom (uint32_t *state)
+{
+  *state = *state * 1103515245u + 12345u;
+  return *state >> 8;
+}
+
+static BOOL
+fail (const char *what, unsigned long version)
+{
+  printf ("FAIL: %s (snapshot version %lu)\n", what, version);
+  return NO;
+}
+
+/* Checks a snapshot against what it should hold: its count and objects,
+   one random rect query of each kind, and a point query */
+static BOOL
+checkSnapshot (CSPublishedSnapshot *expected, uint32_t *state)
+{
+  CSRectQuadTreeSnapshot *snapshot = expected->snapshot;
+  unsigned long version = [snapshot version];
+  NSMutableSet *all = [snapshot allObjects];
+  NSMutableSet *intersecting, *inside, *boundary;
+  NSRect rect;
+  NSPoint point;
+  unsigned n, slot;
+  id hit;
+
+  if ([snapshot count] != expected->count || [all count] != expected->count)
+    return fail ("wrong object count", version);
+
+  rect = NSMakeRect (nextRandom (state) % (unsigned)(SLOT_COLUMNS * SLOT_SIZE),
+		     nextRandom (state) % (unsigned)(SLOT_COLUMNS * SLOT_SIZE),
+		     1 + nextRandom (state) % (unsigned)(8 * SLOT_SIZE),
+		     1 + nextRandom (state) % (unsigned)(8 * SLOT_SIZE));
+
+  intersecting = [snapshot objectsIntersectingRect:rect];
+  inside = [snapshot objectsInRect:rect];
+  boundary = [snapshot objectsIntersectingRectBoundary:rect];
+
+  for (n = 0; n < SLOT_COUNT; ++n) {
+    NSNumber *object = [NSNumber numberWithUnsignedInt:n];
+    NSRect objectRect = slotRect (n);
+    BOOL contained = expected->present[n] && CSContainsRect (rect, objectRect);
+    BOOL intersects = (expected->present[n]
+		       && (contained || CSIntersectsRect (rect, objectRect)));
+
+    if ([all containsObject:object] != expected->present[n])
+      return fail ("wrong objects", version);
+    if ([intersecting containsObject:object] != intersects)
+      return fail ("wrong result from -objectsIntersectingRect:", version);
+    if ([inside containsObject:object] != contained)
+      return fail ("wrong result from -objectsInRect:", version);
+    if ([boundary containsObject:object] != (intersects && !contained))
+      return fail ("wrong result from -objectsIntersectingRectBoundary:",
+		   version);
+  }
+
+  slot = nextRandom (state) % SLOT_COUNT;
+  point = NSMakePoint (NSMidX (slotRect (slot)), NSMidY (slotRect (slot)));
+  hit = [snapshot objectAtPoint:point];
+
+  if (expected->present[slot]
+      ? !hit || [hit unsignedIntValue] != slot
+      : hit != nil)
+    return fail ("wrong result from -objectAtPoint:", version);
+
+  return YES;
+}
+
+@interface CSSnapshotReader : NSObject
++ (void)readSnapshots:(NSNumber *)seed;
+@end
+
+@implementation CSSnapshotReader
+
++ (void)readSnapshots:(NSNumber *)seed
+{
+  NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+  uint32_t state = [seed unsignedIntValue];
+  unsigned long lastVersion = 0;
+  unsigned queries = 0, failures = 0;
+
+  for (;;) {
+    NSAutoreleasePool *queryPool;
+    CSPublishedSnapshot *current;
+
+    [condition lock];
+    current = done ? nil : [published retain];
+    [condition unlock];
+
+    if (!current)
+      break;
+
+    queryPool = [[NSAutoreleasePool alloc] init];
+    if ([current->snapshot version] < lastVersion)
+      failures += !fail ("snapshot versions went backwards",
+			 [current->snapshot version]);
+    else if (!checkSnapshot (current, &state))
+      ++failures;
+    lastVersion = [current->snapshot version];
+    ++queries;
+    [queryPool release];
+
+    // We may well be the last owner, so this tests cross-thread release too
+    [current release];
+  }
+
+  [condition lock];
+  totalQueries += queries;
+  totalFailures += failures;
+  --readersRunning;
+  [condition signal];
+  [condition unlock];
+
+  [pool release];
+}
+
+@end
+
+static void
+publish (CSRectQuadTree *tree, const BOOL *present)
+{
+  CSPublishedSnapshot *next = [[CSPublishedSnapshot alloc] initWithTree:tree
+								present:present];
+  CSPublishedSnapshot *old;
+
+  [condition lock];
+  old = published;
+  published = next;
+  [condition unlock];
+
+  [old release];
+}
+
+int
+main (void)
+{
+  NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+  // Deliberately small, so that the tree has to grow as objects are added
+  CSRectQuadTree *tree
+    = [CSRectQuadTree quadTreeWithBounds:NSMakeRect (0.0f, 0.0f,
+						     SLOT_SIZE, SLOT_SIZE)];
+  CSPublishedSnapshot *kept[KEEP_COUNT];
+  BOOL present[SLOT_COUNT];
+  uint32_t state = 1;
+  unsigned n, keptCount = 0, failures = 0;
+
+  condition = [[NSCondition alloc] init];
+
+  for (n = 0; n < SLOT_COUNT; ++n) {
+    present[n] = n & 1;
+    if (present[n])
+      [tree addObject:[NSNumber numberWithUnsignedInt:n]
+	   withBounds:slotRect (n)];
+  }
+
+  publish (tree, present);
+  readersRunning = READER_COUNT;
+
+  for (n = 0; n < READER_COUNT; ++n) {
+    [NSThread detachNewThreadSelector:@selector(readSnapshots:)
+			     toTarget:[CSSnapshotReader class]
+			   withObject:[NSNumber numberWithUnsignedInt:n + 2]];
+  }
+
+  for (n = 1; n <= MUTATION_COUNT; ++n) {
+    NSAutoreleasePool *mutationPool = [[NSAutoreleasePool alloc] init];
+
+    if (n % CLEAR_INTERVAL == 0) {
+      [tree removeAllObjects];
+      memset (present, 0, sizeof (present));
+    } else if (n % BULK_ADD_INTERVAL == 0) {
+      id objects[BULK_ADD_COUNT];
+      NSRect rects[BULK_ADD_COUNT];
+      unsigned count = 0;
+
+      while (count < BULK_ADD_COUNT) {
+	unsigned slot = nextRandom (&state) % SLOT_COUNT;
+
+	if (present[slot])
+	  continue;
+	present[slot] = YES;
+	objects[count] = [NSNumber numberWithUnsignedInt:slot];
+	rects[count++] = slotRect (slot);
+      }
+
+      [tree addObjects:objects withBounds:rects count:count];
+    } else {
+      unsigned slot = nextRandom (&state) % SLOT_COUNT;
+      NSNumber *object = [NSNumber numberWithUnsignedInt:slot];
+
+      if (present[slot])
+	[tree removeObject:object withBounds:slotRect (slot)];
+      else
+	[tree addObject:object withBounds:slotRect (slot)];
+      present[slot] = !present[slot];
+    }
+
+    publish (tree, present);
+
+    // Only this thread changes published, so we needn't lock to read it
+    if (n % KEEP_INTERVAL == 0 && keptCount < KEEP_COUNT)
+      kept[keptCount++] = [published retain];
+
+    [mutationPool release];
+  }
+
+  [condition lock];
+  done = YES;
+  while (readersRunning)
+    [condition wait];
+  [condition unlock];
+
+  // The tree has moved on since these were taken; they shouldn't have
+  for (n = 0; n < keptCount; ++n) {
+    NSAutoreleasePool *checkPool = [[NSAutoreleasePool alloc] init];
+    unsigned check;
+
+    for (check = 0; check < 16; ++check) {
+      if (!checkSnapshot (kept[n], &state))
+	++failures;
+    }
+
+    [kept[n] release];
+    [checkPool release];
+  }
+
+  [published release];
+  [condition release];
+
+  printf ("%u queries on %u threads, %u failures\n",
+	  totalQueries, READER_COUNT, totalFailures + failures);
+
+  [pool release];
+
+  return totalFailures + failures ? 1 : 0;
+}
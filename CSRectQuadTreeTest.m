@@ -0,0 +1,353 @@
+//
+//  CSRectQuadTreeTest.m
+//  CSIconView
+//
+//  Created by Alastair Houghton on 19/03/2010.
+//  Copyright (c) 2005-2010 Coriolis Systems Limited
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+//
+
+/* Checks CSRectQuadTree's searches against brute force over random trees:
+   the best-first -nearestObjectInDirection:fromRect:filter:context: in all
+   four directions, with and without a filter, and the rect and point
+   queries.  Build and run it with e.g.
+
+     cc -o CSRectQuadTreeTest CSRectQuadTreeTest.m CSRectQuadTree.m \
+       CSParallel.c -framework Cocoa
+     ./CSRectQuadTreeTest
+
+   It prints any failures and exits with a non-zero status if there were
+   any. */
+
+#import <Cocoa/Cocoa.h>
+#import "CSRectQuadTree.h"
+#import "CSRectUtils.h"
+
+#define TREE_COUNT	    20
+#define OBJECT_COUNT	    500
+#define QUERY_COUNT	    200
+
+#define RECT_TREE_COUNT	    2
+#define RECT_QUERY_COUNT    50
+
+/* A simple deterministic generator, so that failures are reproducible */
+static uint32_t randomState = 12345;
+
+static double
+nextRandom (void)
+{
+  randomState = randomState * 1103515245u + 12345u;
+  return (double)(randomState >> 8) / (double)(1u << 24);
+}
+
+/* Random rects with integral co-ordinates, so that there are plenty of
+   ties */
+static NSRect
+randomIntegralRect (NSRect bounds)
+{
+  NSSize size = NSMakeSize (10.0f + floor (nextRandom () * 90.0),
+			    10.0f + floor (nextRandom () * 90.0));
+
+  return NSMakeRect (NSMinX (bounds)
+		     + floor (nextRandom () * (NSWidth (bounds) - size.width)),
+		     NSMinY (bounds)
+		     + floor (nextRandom () * (NSHeight (bounds) - size.height)),
+		     size.width, size.height);
+}
+
+static BOOL
+isEvenObject (id object, void *context)
+{
+  (void)context;
+  return ([object unsignedIntValue] & 1) == 0;
+}
+
+/* Smaller keys are nearer; ties go to the smaller co-ordinate on the
+   other axis */
+static void
+directionalKey (CSQuadTreeDirection direction, NSRect rect,
+		CGFloat *key, CGFloat *tieBreak)
+{
+  switch (direction) {
+  case CSQuadTreeMinXDirection:
+    *key = -NSMinX (rect);
+    *tieBreak = NSMinY (rect);
+    break;
+  case CSQuadTreeMaxXDirection:
+    *key = NSMinX (rect);
+    *tieBreak = NSMinY (rect);
+    break;
+  case CSQuadTreeMinYDirection:
+    *key = -NSMinY (rect);
+    *tieBreak = NSMinX (rect);
+    break;
+  case CSQuadTreeMaxYDirection:
+    *key = NSMinY (rect);
+    *tieBreak = NSMinX (rect);
+    break;
+  }
+}
+
+/* The exhaustive version of -nearestObjectInDirection:fromRect:filter:
+   context:, written from its documentation rather than its code.  Returns
+   the index of the best rect, or -1, and its key and tie-break values. */
+static int
+bruteForceNearest (const NSRect	      *rects,
+		   unsigned	      count,
+		   NSRect	      treeBounds,
+		   CSQuadTreeDirection direction,
+		   NSRect	      rect,
+		   BOOL		      evenOnly,
+		   CGFloat	      *bestKey,
+		   CGFloat	      *bestTieBreak)
+{
+  NSRect strip = rect;
+  CGFloat originKey, originTieBreak;
+  int best = -1;
+  unsigned n;
+
+  directionalKey (direction, rect, &originKey, &originTieBreak);
+
+  switch (direction) {
+  case CSQuadTreeMinXDirection:
+    strip.size.width = NSMinX (rect) - NSMinX (treeBounds);
+    strip.origin.x = NSMinX (treeBounds);
+    break;
+  case CSQuadTreeMaxXDirection:
+    strip.size.width = NSMaxX (treeBounds) - NSMinX (rect);
+    break;
+  case CSQuadTreeMinYDirection:
+    strip.size.height = NSMinY (rect) - NSMinY (treeBounds);
+    strip.origin.y = NSMinY (treeBounds);
+    break;
+  case CSQuadTreeMaxYDirection:
+    strip.size.height = NSMaxY (treeBounds) - NSMinY (rect);
+    break;
+  }
+
+  for (n = 0; n < count; ++n) {
+    CGFloat key, tieBreak;
+
+    if ((evenOnly && (n & 1)) || !CSIntersectsRect (strip, rects[n]))
+      continue;
+
+    // Only objects strictly beyond the starting rect count
+    directionalKey (direction, rects[n], &key, &tieBreak);
+    if (key <= originKey)
+      continue;
+
+    if (best < 0 || key < *bestKey
+	|| (key == *bestKey && tieBreak < *bestTieBreak)) {
+      best = n;
+      *bestKey = key;
+      *bestTieBreak = tieBreak;
+    }
+  }
+
+  return best;
+}
+
+/* Checks the best-first nearest object search against brute force, over
+   random trees, in all four directions, with and without a filter.  Where
+   several objects are equally good, either answer will do. */
+static unsigned
+checkNearestObject (void)
+{
+  NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+  NSRect bounds = NSMakeRect (0.0f, 0.0f, 1000.0f, 1000.0f);
+  NSRect *rects = (NSRect *)malloc (sizeof (NSRect) * OBJECT_COUNT);
+  unsigned trees, n, cases = 0, failures = 0;
+
+  if (!rects) {
+    printf ("FAIL: out of memory\n");
+    exit (1);
+  }
+
+  for (trees = 0; trees < TREE_COUNT; ++trees) {
+    NSAutoreleasePool *treePool = [[NSAutoreleasePool alloc] init];
+    CSRectQuadTree *tree = [CSRectQuadTree quadTreeWithBounds:bounds];
+    NSMutableArray *objects 
+      = [NSMutableArray arrayWithCapacity:OBJECT_COUNT];
+    NSRect treeBounds;
+
+    for (n = 0; n < OBJECT_COUNT; ++n) {
+      NSNumber *object = [NSNumber numberWithUnsignedInt:n];
+
+      rects[n] = randomIntegralRect (bounds);
+      [objects addObject:object];
+      [tree addObject:object withBounds:rects[n]];
+    }
+
+    treeBounds = [tree bounds];
+
+    for (n = 0; n < QUERY_COUNT; ++n) {
+      NSRect rect = randomIntegralRect (bounds);
+      CSQuadTreeDirection direction;
+      unsigned filtered;
+
+      for (direction = CSQuadTreeMinXDirection;
+	   direction <= CSQuadTreeMaxYDirection; ++direction) {
+	for (filtered = 0; filtered < 2; ++filtered) {
+	  BOOL evenOnly = filtered ? YES : NO;
+	  CGFloat key = 0.0, tieBreak = 0.0;
+	  int expected = bruteForceNearest (rects, OBJECT_COUNT,
+					    treeBounds, direction, rect,
+					    evenOnly, &key, &tieBreak);
+	  id found = [tree nearestObjectInDirection:direction
+					   fromRect:rect
+					     filter:evenOnly ? isEvenObject : NULL
+					    context:NULL];
+	  BOOL ok;
+
+	  if (expected < 0 || !found)
+	    ok = expected < 0 && !found;
+	  else {
+	    unsigned ndx = [found unsignedIntValue];
+	    CGFloat foundKey, foundTieBreak;
+
+	    directionalKey (direction, rects[ndx], &foundKey, &foundTieBreak);
+	    ok = (foundKey == key && foundTieBreak == tieBreak
+		  && (!evenOnly || !(ndx & 1)));
+	  }
+
+	  if (!ok) {
+	    printf ("FAIL: nearest object (tree %u, query %u, direction %d, "
+		    "filter %d)\n", trees, n, (int)direction, (int)evenOnly);
+	    ++failures;
+	  }
+
+	  ++cases;
+	}
+      }
+    }
+
+    [treePool release];
+  }
+
+  free (rects);
+
+  printf ("%u nearest object queries, %u failures\n", cases, failures);
+
+  [pool release];
+
+  return failures;
+}
+
+/* Checks the rect and point queries against brute force.  The largest
+   trees are over PARALLEL_QUERY_THRESHOLD, so that the bigger queries take
+   the parallel path. */
+static unsigned
+checkRectQueries (void)
+{
+  static const unsigned sizes[] = { 500, 5000, 40000 };
+  NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+  NSRect bounds = NSMakeRect (0.0f, 0.0f, 1000.0f, 1000.0f);
+  unsigned size, trees, n, m, cases = 0, failures = 0;
+
+  for (size = 0; size < sizeof (sizes) / sizeof (sizes[0]); ++size) {
+    unsigned count = sizes[size];
+    NSRect *rects = (NSRect *)malloc (sizeof (NSRect) * count);
+    id *objects = (id *)malloc (sizeof (id) * count);
+
+    if (!rects || !objects) {
+      printf ("FAIL: out of memory\n");
+      exit (1);
+    }
+
+    for (trees = 0; trees < RECT_TREE_COUNT; ++trees) {
+      NSAutoreleasePool *treePool = [[NSAutoreleasePool alloc] init];
+      CSRectQuadTree *tree = [CSRectQuadTree quadTreeWithBounds:bounds];
+
+      for (n = 0; n < count; ++n) {
+	rects[n] = randomIntegralRect (bounds);
+	objects[n] = [NSNumber numberWithUnsignedInt:n];
+      }
+
+      [tree addObjects:objects withBounds:rects count:count];
+
+      for (n = 0; n < RECT_QUERY_COUNT; ++n) {
+	NSAutoreleasePool *queryPool = [[NSAutoreleasePool alloc] init];
+	CGFloat scale = 1.0f + floor (nextRandom () * 8.0);
+	NSRect rect = randomIntegralRect (bounds);
+	NSPoint point = NSMakePoint (NSMinX (rect), NSMinY (rect));
+	NSMutableSet *intersecting, *inside, *boundary, *atPoint;
+	id hit;
+	BOOL ok;
+
+	rect.size.width *= scale;
+	rect.size.height *= scale;
+
+	intersecting = [tree objectsIntersectingRect:rect];
+	inside = [tree objectsInRect:rect];
+	boundary = [tree objectsIntersectingRectBoundary:rect];
+	atPoint = [tree objectsAtPoint:point];
+	hit = [tree objectAtPoint:point];
+
+	ok = (hit
+	      ? NSPointInRect (point, rects[[hit unsignedIntValue]])
+	      : ![atPoint count]);
+
+	for (m = 0; m < count && ok; ++m) {
+	  BOOL contained = CSContainsRect (rect, rects[m]);
+	  BOOL intersects = contained || CSIntersectsRect (rect, rects[m]);
+
+	  if ([intersecting containsObject:objects[m]] != intersects
+	      || [inside containsObject:objects[m]] != contained
+	      || ([boundary containsObject:objects[m]]
+		  != (intersects && !contained))
+	      || ([atPoint containsObject:objects[m]]
+		  != NSPointInRect (point, rects[m])))
+	    ok = NO;
+	}
+
+	if (!ok) {
+	  printf ("FAIL: rect query (%u objects, tree %u, query %u)\n",
+		  count, trees, n);
+	  ++failures;
+	}
+
+	++cases;
+	[queryPool release];
+      }
+
+      [treePool release];
+    }
+
+    free (rects);
+    free (objects);
+  }
+
+  printf ("%u rect queries, %u failures\n", cases, failures);
+
+  [pool release];
+
+  return failures;
+}
+
+int
+main (void)
+{
+  unsigned failures = 0;
+
+  failures += checkNearestObject ();
+  failures += checkRectQueries ();
+
+  return failures ? 1 : 0;
+}
@@ -50,6 +50,7 @@ typedef struct {
 @interface NSBezierPath (CSShadingSupport)
 
 - (void)shade;
+- (void)shadeFromPoint:(NSPoint)startPoint toPoint:(NSPoint)endPoint;
 
 @end
 
@@ -63,6 +64,9 @@ typedef struct {
 
 + (CSShading *)currentShading;
 
++ (CSShading *)axialShadingWithColors:(CSShadingColorArray)colorArray
+				flags:(unsigned)flags;
+
 + (CSShading *)axialShadingFromPoint:(NSPoint)startPoint
 			     toPoint:(NSPoint)endPoint
 			  colorSpace:(CSColorSpace *)colorspace
@@ -120,6 +124,7 @@ typedef struct {
 			       flags:(unsigned)flags;
 
 - (void)draw;
+- (void)drawFromPoint:(NSPoint)startPoint toPoint:(NSPoint)endPoint;
 
 /* This isn't quite as sophisticated as the -set implementation for e.g.
    NSColor, in that it doesn't get saved when the graphics context saves
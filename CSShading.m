@@ -26,7 +26,11 @@
 
 #import "CSShading.h"
 
+/* The current shading belongs to the main thread; other threads keep
+   theirs in their thread dictionary, so that icons can be rendered on
+   several threads at once. */
 static CSShading *currentShading;
+static NSString * const kCSCurrentShading = @"CSCurrentShading";
 
 struct color {
   CGFloat fraction, r, g, b, a;
@@ -37,6 +41,33 @@ struct color_array {
   struct color	colors[0];
 };
 
+/* Colour stop shadings are evaluated from a lookup table, rather than by
+   searching the stops for every sample Core Graphics asks for. */
+#define COLOR_TABLE_SIZE 256
+
+struct color_table {
+  float		entries[COLOR_TABLE_SIZE][4];
+};
+
+/* Shadings returned by +axialShadingWithColors:flags: are kept in a small
+   most-recently-used cache, so that drawing the same label colours over and
+   over again doesn't create any new shading objects.  The cache is shared
+   between threads, so it is only touched with the CSShading class lock
+   held. */
+#define SHADING_CACHE_SIZE  32
+#define MAX_CACHED_STOPS    4
+
+struct shading_cache_entry {
+  unsigned  flags;
+  unsigned  count;
+  float	    fractions[MAX_CACHED_STOPS];
+  NSColor   *colors[MAX_CACHED_STOPS];
+  CSShading *shading;
+};
+
+static struct shading_cache_entry shadingCache[SHADING_CACHE_SIZE];
+static unsigned shadingCacheCount;
+
 @implementation CSShading
 
 static void
@@ -86,6 +117,35 @@ shadeFromColorArray (CGFloat input, CGFloat *outputs, void *colorArrayPtr)
   outputs[3] = last->a;
 }
 
+static void
+shadeFromColorTable (CGFloat input, CGFloat *outputs, void *colorTablePtr)
+{
+  struct color_table *colorTable = (struct color_table *)colorTablePtr;
+  const float *color1, *color2;
+  CGFloat pos, fraction;
+  unsigned ndx;
+
+  if (input <= 0.0f) {
+    ndx = 0;
+    fraction = 0.0f;
+  } else if (input >= 1.0f) {
+    ndx = COLOR_TABLE_SIZE - 1;
+    fraction = 0.0f;
+  } else {
+    pos = input * (COLOR_TABLE_SIZE - 1);
+    ndx = (unsigned)pos;
+    fraction = pos - ndx;
+  }
+
+  color1 = colorTable->entries[ndx];
+  color2 = colorTable->entries[ndx + 1 < COLOR_TABLE_SIZE ? ndx + 1 : ndx];
+
+  outputs[0] = color1[0] + (color2[0] - color1[0]) * fraction;
+  outputs[1] = color1[1] + (color2[1] - color1[1]) * fraction;
+  outputs[2] = color1[2] + (color2[2] - color1[2]) * fraction;
+  outputs[3] = color1[3] + (color2[3] - color1[3]) * fraction;
+}
+
 struct color_array *
 generateColorArray (CSShadingColorArray *oldArray)
 {
@@ -115,9 +175,77 @@ generateColorArray (CSShadingColorArray *oldArray)
   return colorArray;
 }
 
+/* Sample the colour stops into a lookup table */
+static struct color_table *
+generateColorTable (CSShadingColorArray *oldArray)
+{
+  struct color_array *colorArray = generateColorArray (oldArray);
+  struct color_table *colorTable;
+  unsigned n;
+
+  if (!colorArray)
+    return NULL;
+
+  colorTable = (struct color_table *) malloc (sizeof (struct color_table));
+
+  if (colorTable) {
+    for (n = 0; n < COLOR_TABLE_SIZE; ++n) {
+      CGFloat outputs[4];
+
+      shadeFromColorArray ((CGFloat)n / (COLOR_TABLE_SIZE - 1), outputs,
+			   colorArray);
+
+      colorTable->entries[n][0] = outputs[0];
+      colorTable->entries[n][1] = outputs[1];
+      colorTable->entries[n][2] = outputs[2];
+      colorTable->entries[n][3] = outputs[3];
+    }
+  }
+
+  free (colorArray);
+
+  return colorTable;
+}
+
+static BOOL
+cacheEntryMatches (struct shading_cache_entry *entry,
+		   CSShadingColorArray	      *colorArray,
+		   unsigned		      flags)
+{
+  unsigned n;
+
+  if (entry->flags != flags || entry->count != colorArray->count)
+    return NO;
+
+  for (n = 0; n < entry->count; ++n) {
+    NSColor *color = colorArray->colors[n].color;
+
+    if (entry->fractions[n] != colorArray->colors[n].fraction
+	|| (entry->colors[n] != color && ![entry->colors[n] isEqual:color]))
+      return NO;
+  }
+
+  return YES;
+}
+
+static void
+releaseCacheEntry (struct shading_cache_entry *entry)
+{
+  unsigned n;
+
+  for (n = 0; n < entry->count; ++n)
+    [entry->colors[n] release];
+
+  [entry->shading release];
+}
+
 + (CSShading *)currentShading
 {
-  return currentShading;
+  if ([NSThread isMainThread])
+    return currentShading;
+
+  return [[[NSThread currentThread] threadDictionary]
+	   objectForKey:kCSCurrentShading];
 }
 
 + (CSShading *)axialShadingFromPoint:(NSPoint)startPoint
@@ -284,6 +412,70 @@ generateColorArray (CSShadingColorArray *oldArray)
   return self;
 }
 
+/* Returns a shared axial shading running from (0, 0) to (0, 1); use
+   -[NSBezierPath shadeFromPoint:toPoint:] to map it onto the axis you
+   actually want.  The shading belongs to the cache, so retain it if you need
+   to keep it. */
++ (CSShading *)axialShadingWithColors:(CSShadingColorArray)colorArray
+				flags:(unsigned)flags
+{
+  // We don't bother caching shadings with lots of stops
+  if (colorArray.count > MAX_CACHED_STOPS) {
+    return [self axialShadingFromPoint:NSZeroPoint
+			       toPoint:NSMakePoint (0.0f, 1.0f)
+			    withColors:colorArray
+				 flags:flags];
+  }
+
+  @synchronized ([CSShading class]) {
+    struct shading_cache_entry entry;
+    unsigned n;
+
+    for (n = 0; n < shadingCacheCount; ++n) {
+      if (cacheEntryMatches (&shadingCache[n], &colorArray, flags)) {
+	entry = shadingCache[n];
+
+	if (n) {
+	  memmove (&shadingCache[1], &shadingCache[0], 
+		   sizeof (shadingCache[0]) * n);
+	  shadingCache[0] = entry;
+	}
+
+	// Another thread might push it out of the cache
+	return [[entry.shading retain] autorelease];
+      }
+    }
+
+    entry.shading = [[CSShading alloc] 
+		      initWithAxialShadingFromPoint:NSZeroPoint
+					    toPoint:NSMakePoint (0.0f, 1.0f)
+					 withColors:colorArray
+					      flags:flags];
+
+    if (!entry.shading)
+      return nil;
+
+    entry.flags = flags;
+    entry.count = colorArray.count;
+    for (n = 0; n < colorArray.count; ++n) {
+      entry.fractions[n] = colorArray.colors[n].fraction;
+      entry.colors[n] = [colorArray.colors[n].color retain];
+    }
+
+    if (shadingCacheCount == SHADING_CACHE_SIZE)
+      releaseCacheEntry (&shadingCache[--shadingCacheCount]);
+
+    memmove (&shadingCache[1], &shadingCache[0],
+	     sizeof (shadingCache[0]) * shadingCacheCount);
+    shadingCache[0] = entry;
+    ++shadingCacheCount;
+
+    return [[entry.shading retain] autorelease];
+  }
+
+  return nil;
+}
+
 - (id)initWithAxialShadingFromPoint:(NSPoint)startPoint
 			    toPoint:(NSPoint)endPoint
 			 withColors:(CSShadingColorArray)colors
@@ -293,9 +485,9 @@ generateColorArray (CSShadingColorArray *oldArray)
 					  toPoint:endPoint
 				       colorSpace:[CSColorSpace genericRGBColorSpace]
 					    flags:flags
-					 function:shadeFromColorArray
+					 function:shadeFromColorTable
 					  context:NULL])) {
-    functionContext = generateColorArray (&colors);
+    functionContext = generateColorTable (&colors);
     
     if (!functionContext) {
       [self release];
@@ -321,9 +513,9 @@ generateColorArray (CSShadingColorArray *oldArray)
 					    radius:r2
 					colorSpace:[CSColorSpace genericRGBColorSpace]
 					     flags:flags
-					  function:shadeFromColorArray
+					  function:shadeFromColorTable
 					   context:NULL])) {
-    functionContext = generateColorArray (&colors);
+    functionContext = generateColorTable (&colors);
 
     if (!functionContext) {
       [self release];
@@ -355,10 +547,44 @@ generateColorArray (CSShadingColorArray *oldArray)
   CGContextDrawShading (cgContext, shading);
 }
 
+/* Draw a shading whose axis runs from (0, 0) to (0, 1) so that its axis runs
+   from startPoint to endPoint instead. */
+- (void)drawFromPoint:(NSPoint)startPoint toPoint:(NSPoint)endPoint
+{
+  NSGraphicsContext *context = [NSGraphicsContext currentContext];
+  NSAffineTransform *transform;
+  NSAffineTransformStruct matrix;
+  CGFloat dx = endPoint.x - startPoint.x;
+  CGFloat dy = endPoint.y - startPoint.y;
+
+  if (dx == 0.0f && dy == 0.0f)
+    return;
+
+  matrix.m11 = dy;
+  matrix.m12 = -dx;
+  matrix.m21 = dx;
+  matrix.m22 = dy;
+  matrix.tX = startPoint.x;
+  matrix.tY = startPoint.y;
+
+  transform = [NSAffineTransform transform];
+  [transform setTransformStruct:matrix];
+
+  [context saveGraphicsState];
+  [transform concat];
+  [self draw];
+  [context restoreGraphicsState];
+}
+
 - (void)set
 {
-  [currentShading release];
-  currentShading = [self retain];
+  if ([NSThread isMainThread]) {
+    [currentShading release];
+    currentShading = [self retain];
+  } else {
+    [[[NSThread currentThread] threadDictionary]
+      setObject:self forKey:kCSCurrentShading];
+  }
 }
 
 @end
@@ -371,7 +597,17 @@ generateColorArray (CSShadingColorArray *oldArray)
   
   [context saveGraphicsState];
   [self addClip];
-  [currentShading draw];
+  [[CSShading currentShading] draw];
+  [context restoreGraphicsState];
+}
+
+- (void)shadeFromPoint:(NSPoint)startPoint toPoint:(NSPoint)endPoint
+{
+  NSGraphicsContext *context = [NSGraphicsContext currentContext];
+  
+  [context saveGraphicsState];
+  [self addClip];
+  [[CSShading currentShading] drawFromPoint:startPoint toPoint:endPoint];
   [context restoreGraphicsState];
 }
 
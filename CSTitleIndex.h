@@ -0,0 +1,61 @@
+//
+//  CSTitleIndex.h
+//  CSIconView
+//
+//  Created by Alastair Houghton on 17/03/2010.
+//  Copyright (c) 2005-2010 Coriolis Systems Limited
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+//
+
+#import <Cocoa/Cocoa.h>
+
+/* A sorted index of item titles, for type-ahead selection.  Titles are
+   folded (case, diacritic and width insensitive) before being indexed, so
+   that typing "e" finds "Élan".
+
+   The index is keyed by item index; for each item we also keep the folded
+   title, so that we can find and remove the old entry when a title
+   changes. */
+@interface CSTitleIndex : NSObject
+{
+  unsigned		  count;
+  struct title_index_entry *entries;	// Sorted by key, then item index
+  NSString		  **keys;	// Indexed by item index
+}
+
++ (NSString *)foldedString:(NSString *)string;
+
+/* Rebuild the index from scratch */
+- (void)setTitlesOfItems:(const id *)items count:(unsigned)count;
+
+- (void)setTitle:(NSString *)title forItemAtIndex:(unsigned)ndx;
+
+/* Returns the index of the item whose folded title sorts first of those
+   that start with the folded prefix, or NSNotFound. */
+- (NSUInteger)indexOfFirstItemWithPrefix:(NSString *)prefix;
+
+@end
+
+/*
+ * Local Variables:
+ * mode: ObjC
+ * End:
+ *
+ */
@@ -0,0 +1,196 @@
+//
+//  CSTitleIndex.m
+//  CSIconView
+//
+//  Created by Alastair Houghton on 17/03/2010.
+//  Copyright (c) 2005-2010 Coriolis Systems Limited
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+//
+
+#import "CSTitleIndex.h"
+
+struct title_index_entry {
+  NSString  *key;
+  unsigned  index;
+};
+
+static int compareEntries (const void *a, const void *b);
+static unsigned lowerBound (const struct title_index_entry *entries,
+			    unsigned count, NSString *key, unsigned index);
+
+@implementation CSTitleIndex
+
++ (NSString *)foldedString:(NSString *)string
+{
+  if (!string)
+    return @"";
+
+  return [string stringByFoldingWithOptions:(NSCaseInsensitiveSearch
+					     | NSDiacriticInsensitiveSearch
+					     | NSWidthInsensitiveSearch)
+				     locale:nil];
+}
+
+- (void)removeAllTitles
+{
+  unsigned n;
+
+  for (n = 0; n < count; ++n)
+    [keys[n] release];
+
+  free (entries);
+  free (keys);
+  entries = NULL;
+  keys = NULL;
+  count = 0;
+}
+
+- (void)dealloc
+{
+  [self removeAllTitles];
+  [super dealloc];
+}
+
+- (void)setTitlesOfItems:(const id *)items count:(unsigned)itemCount
+{
+  unsigned n;
+
+  [self removeAllTitles];
+
+  if (!itemCount)
+    return;
+
+  entries = (struct title_index_entry *) 
+    malloc (sizeof (struct title_index_entry) * itemCount);
+  keys = (NSString **) malloc (sizeof (NSString *) * itemCount);
+
+  if (!entries || !keys) {
+    free (entries);
+    free (keys);
+    entries = NULL;
+    keys = NULL;
+    [NSException raise:@"CSOutOfMemory"
+		format:@"%@", NSLocalizedString (@"Not enough memory.",
+						 @"Not enough memory.")];
+  }
+
+  for (n = 0; n < itemCount; ++n) {
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+
+    keys[n] = [[CSTitleIndex foldedString:[items[n] title]] retain];
+    entries[n].key = keys[n];
+    entries[n].index = n;
+
+    [pool release];
+  }
+
+  count = itemCount;
+
+  qsort (entries, count, sizeof (struct title_index_entry), compareEntries);
+}
+
+- (void)setTitle:(NSString *)title forItemAtIndex:(unsigned)ndx
+{
+  NSString *oldKey, *newKey;
+  unsigned oldPos, newPos;
+
+  NSAssert (ndx < count, @"Item index out of range");
+
+  oldKey = keys[ndx];
+  newKey = [[CSTitleIndex foldedString:title] retain];
+
+  // Take the old entry out...
+  oldPos = lowerBound (entries, count, oldKey, ndx);
+  memmove (&entries[oldPos], &entries[oldPos + 1],
+	   sizeof (struct title_index_entry) * (count - oldPos - 1));
+
+  // ...and put the new one in
+  newPos = lowerBound (entries, count - 1, newKey, ndx);
+  memmove (&entries[newPos + 1], &entries[newPos],
+	   sizeof (struct title_index_entry) * (count - 1 - newPos));
+  entries[newPos].key = newKey;
+  entries[newPos].index = ndx;
+
+  keys[ndx] = newKey;
+  [oldKey release];
+}
+
+- (NSUInteger)indexOfFirstItemWithPrefix:(NSString *)prefix
+{
+  NSString *key = [CSTitleIndex foldedString:prefix];
+  unsigned pos;
+
+  if (!count || ![key length])
+    return NSNotFound;
+
+  pos = lowerBound (entries, count, key, 0);
+
+  if (pos < count && [entries[pos].key hasPrefix:key])
+    return entries[pos].index;
+
+  return NSNotFound;
+}
+
+@end
+
+static inline int
+compareKeys (NSString *key1, unsigned index1, NSString *key2, unsigned index2)
+{
+  NSComparisonResult result = [key1 compare:key2 options:NSLiteralSearch];
+
+  if (result == NSOrderedAscending)
+    return -1;
+  else if (result == NSOrderedDescending)
+    return 1;
+  else if (index1 < index2)
+    return -1;
+  else if (index1 > index2)
+    return 1;
+
+  return 0;
+}
+
+static int
+compareEntries (const void *a, const void *b)
+{
+  const struct title_index_entry *ea = (const struct title_index_entry *)a;
+  const struct title_index_entry *eb = (const struct title_index_entry *)b;
+
+  return compareKeys (ea->key, ea->index, eb->key, eb->index);
+}
+
+/* Find the first entry that doesn't sort before (key, index) */
+static unsigned
+lowerBound (const struct title_index_entry *entries, unsigned count,
+	    NSString *key, unsigned index)
+{
+  unsigned low = 0, high = count;
+
+  while (low < high) {
+    unsigned mid = low + (high - low) / 2;
+
+    if (compareKeys (entries[mid].key, entries[mid].index, key, index) < 0)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+
+  return low;
+}
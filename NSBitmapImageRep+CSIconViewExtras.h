@@ -28,6 +28,17 @@
 
 @interface NSBitmapImageRep (CSIconViewExtras)
 
+/* An empty, non-planar, 8-bit premultiplied RGBA bitmap */
++ (NSBitmapImageRep *)premultipliedRGBARepWithPixelsWide:(NSInteger)width
+					      pixelsHigh:(NSInteger)height;
+- (BOOL)isPremultipliedRGBA;
+
+/* Returns a premultiplied RGBA copy of this bitmap, reduced to the
+   specified number of pixels with an area-averaging box filter.  The new
+   rep has the same -size as this one. */
+- (NSBitmapImageRep *)boxFilteredRepWithPixelsWide:(NSInteger)width
+					pixelsHigh:(NSInteger)height;
+
 /* Returns TRUE if the specified rectangle, in image coordinates, intersects
    with the non-transparent section of the image.  This function only supports
    8-bit, 16-bit or floating point sample data (i.e. it expects truecolor data
@@ -26,8 +26,91 @@
 
 #import "NSBitmapImageRep+CSIconViewExtras.h"
 
+static BOOL boxFilterRGBA (const uint8_t *src,
+			   unsigned srcWidth, unsigned srcHeight,
+			   size_t srcRowBytes,
+			   uint8_t *dst,
+			   unsigned dstWidth, unsigned dstHeight,
+			   size_t dstRowBytes);
+
 @implementation NSBitmapImageRep (CSIconViewExtras)
 
++ (NSBitmapImageRep *)premultipliedRGBARepWithPixelsWide:(NSInteger)width
+					      pixelsHigh:(NSInteger)height
+{
+  return [[[NSBitmapImageRep alloc]
+	   initWithBitmapDataPlanes:NULL
+			 pixelsWide:width
+			 pixelsHigh:height
+		      bitsPerSample:8
+		    samplesPerPixel:4
+			   hasAlpha:YES
+			   isPlanar:NO
+		     colorSpaceName:NSCalibratedRGBColorSpace
+			bytesPerRow:0
+		       bitsPerPixel:32] autorelease];
+}
+
+- (BOOL)isPremultipliedRGBA
+{
+  NSBitmapFormat bitmapFormat = 0;
+
+  if ([self respondsToSelector:@selector(bitmapFormat)])
+    bitmapFormat = [self bitmapFormat];
+
+  return (![self isPlanar]
+	  && [self bitsPerSample] == 8
+	  && [self samplesPerPixel] == 4
+	  && [self bitsPerPixel] == 32
+	  && [self hasAlpha]
+	  && !bitmapFormat
+	  && [[self colorSpaceName] isEqualToString:NSCalibratedRGBColorSpace]);
+}
+
+- (NSBitmapImageRep *)boxFilteredRepWithPixelsWide:(NSInteger)width
+					pixelsHigh:(NSInteger)height
+{
+  NSBitmapImageRep *source = self;
+  NSBitmapImageRep *result;
+  NSInteger srcWidth = [self pixelsWide], srcHeight = [self pixelsHigh];
+
+  NSAssert (width > 0 && height > 0
+	    && width <= srcWidth && height <= srcHeight,
+	    @"Box filtering can only reduce the size of an image.");
+
+  // Get the source pixels into the same format as the result
+  if (![self isPremultipliedRGBA]) {
+    NSGraphicsContext *context;
+
+    source = [NSBitmapImageRep premultipliedRGBARepWithPixelsWide:srcWidth
+						       pixelsHigh:srcHeight];
+    context = [NSGraphicsContext graphicsContextWithBitmapImageRep:source];
+
+    [NSGraphicsContext saveGraphicsState];
+    [NSGraphicsContext setCurrentContext:context];
+    [self drawInRect:NSMakeRect (0, 0, srcWidth, srcHeight)];
+    [NSGraphicsContext restoreGraphicsState];
+  }
+
+  result = [NSBitmapImageRep premultipliedRGBARepWithPixelsWide:width
+						     pixelsHigh:height];
+
+  if (!source || !result
+      || !boxFilterRGBA ([source bitmapData], srcWidth, srcHeight,
+			 [source bytesPerRow],
+			 [result bitmapData], width, height,
+			 [result bytesPerRow])) {
+    [NSException raise:@"CSOutOfMemory"
+		format:@"%@",
+      NSLocalizedString (@"Not enough memory.",
+                         @"Not enough memory.")];
+  }
+
+  [result setSize:[self size]];
+
+  return result;
+}
+
 - (BOOL)rectIntersectsWithImage:(NSRect)rect
 {
   return [self rectIntersectsWithImage:rect withAlphaThreshold:0.5f];
@@ -163,3 +246,137 @@
 }
 
 @end
+
+/* The taps of a one-dimensional box filter; output sample n is the sum of
+   weights[n * maxTaps + k] * input[first[n] + k] for k < count[n] */
+struct box_filter {
+  unsigned  *first;
+  unsigned  *count;
+  float	    *weights;
+  unsigned  maxTaps;
+};
+
+static BOOL
+makeBoxFilter (struct box_filter *filter, unsigned srcSize, unsigned dstSize)
+{
+  float scale = (float)srcSize / dstSize;
+  unsigned n;
+
+  filter->maxTaps = (unsigned)ceilf (scale) + 1;
+  filter->first = (unsigned *)malloc (sizeof (unsigned) * dstSize);
+  filter->count = (unsigned *)malloc (sizeof (unsigned) * dstSize);
+  filter->weights = (float *)malloc (sizeof (float) * dstSize
+				     * filter->maxTaps);
+
+  if (!filter->first || !filter->count || !filter->weights)
+    return NO;
+
+  for (n = 0; n < dstSize; ++n) {
+    float start = n * scale, end = (n + 1) * scale;
+    unsigned first = (unsigned)start, last = (unsigned)ceilf (end);
+    unsigned k;
+
+    if (last > srcSize)
+      last = srcSize;
+    if (last - first > filter->maxTaps)
+      last = first + filter->maxTaps;
+
+    filter->first[n] = first;
+    filter->count[n] = last - first;
+
+    // Each weight is the fraction of the input sample we cover
+    for (k = 0; k < last - first; ++k) {
+      float lo = first + k, hi = first + k + 1;
+
+      if (lo < start)
+	lo = start;
+      if (hi > end)
+	hi = end;
+
+      filter->weights[n * filter->maxTaps + k] = (hi - lo) / scale;
+    }
+  }
+
+  return YES;
+}
+
+static void
+freeBoxFilter (struct box_filter *filter)
+{
+  free (filter->first);
+  free (filter->count);
+  free (filter->weights);
+}
+
+/* Area-average premultiplied 8-bit RGBA pixels down to a smaller size.  We
+   filter horizontally into a float buffer, then vertically; the inner
+   loops are over the four channels of a pixel, which the compiler turns
+   into vector operations. */
+static BOOL
+boxFilterRGBA (const uint8_t *src, unsigned srcWidth, unsigned srcHeight,
+	       size_t srcRowBytes,
+	       uint8_t *dst, unsigned dstWidth, unsigned dstHeight,
+	       size_t dstRowBytes)
+{
+  struct box_filter horizontal = { NULL, NULL, NULL, 0 };
+  struct box_filter vertical = { NULL, NULL, NULL, 0 };
+  float *rows = (float *)malloc (sizeof (float) * 4 * dstWidth * srcHeight);
+  float *acc = (float *)malloc (sizeof (float) * 4 * dstWidth);
+  unsigned x, y, k, c;
+  BOOL ok = NO;
+
+  if (!rows || !acc
+      || !makeBoxFilter (&horizontal, srcWidth, dstWidth)
+      || !makeBoxFilter (&vertical, srcHeight, dstHeight))
+    goto done;
+
+  for (y = 0; y < srcHeight; ++y) {
+    const uint8_t *srcRow = src + y * srcRowBytes;
+    float *row = rows + 4 * dstWidth * y;
+
+    for (x = 0; x < dstWidth; ++x) {
+      const uint8_t *pixel = srcRow + 4 * horizontal.first[x];
+      const float *weights = horizontal.weights + x * horizontal.maxTaps;
+      float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+      for (k = 0; k < horizontal.count[x]; ++k, pixel += 4) {
+	for (c = 0; c < 4; ++c)
+	  sum[c] += weights[k] * pixel[c];
+      }
+
+      for (c = 0; c < 4; ++c)
+	row[4 * x + c] = sum[c];
+    }
+  }
+
+  for (y = 0; y < dstHeight; ++y) {
+    const float *weights = vertical.weights + y * vertical.maxTaps;
+    uint8_t *dstRow = dst + y * dstRowBytes;
+
+    memset (acc, 0, sizeof (float) * 4 * dstWidth);
+
+    for (k = 0; k < vertical.count[y]; ++k) {
+      const float *row = rows + 4 * dstWidth * (vertical.first[y] + k);
+      float weight = weights[k];
+
+      for (x = 0; x < 4 * dstWidth; ++x)
+	acc[x] += weight * row[x];
+    }
+
+    for (x = 0; x < 4 * dstWidth; ++x) {
+      float value = acc[x] + 0.5f;
+
+      dstRow[x] = value >= 255.0f ? 255 : (uint8_t)value;
+    }
+  }
+
+  ok = YES;
+
+ done:
+  freeBoxFilter (&horizontal);
+  freeBoxFilter (&vertical);
+  free (rows);
+  free (acc);
+
+  return ok;
+}
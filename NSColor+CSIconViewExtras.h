@@ -8,12 +8,20 @@
 
 #import <AppKit/NSColor.h>
 
+/* These use the sRGB colour space and the D65 white point; see
+   CSColorConversion.h if you need to convert lots of colours at once. */
 @interface NSColor (CSIconViewExtras) 
 
+- (void)getSRGBRed:(CGFloat *)r green:(CGFloat *)g blue:(CGFloat *)b
+	     alpha:(CGFloat *)alpha;
+
 - (void)getL:(CGFloat *)pL u:(CGFloat *)pu v:(CGFloat *)pv alpha:(CGFloat *)alpha;
 - (void)getL:(CGFloat *)pL a:(CGFloat *)pa b:(CGFloat *)pb alpha:(CGFloat *)alpha;
 - (void)getX:(CGFloat *)X Y:(CGFloat *)Y Z:(CGFloat *)Z alpha:(CGFloat *)alpha;
 
+/* The L* component, from 0 (black) to 100 (white) */
+- (CGFloat)lightness;
+
 @end
 
 /*